@@ -4,6 +4,7 @@
 
 #include "Arduino.h"
 #include "bus.h"
+#include "regcache.h"
 #include "utils.h"
 
 class AK8963 {
@@ -13,6 +14,7 @@ public:
     static const uint8_t WIA      =  0x00;  // R  Device Id, should return 0x48
     static const uint8_t INFO     =  0x01;  // R  
     static const uint8_t ST1      =  0x02;  // R  data ready status bit 0
+    static const uint8_t ST1_DRDY =  0x01;
     static const uint8_t HXL      =  0x03;  // R  data
     static const uint8_t HXH      =  0x04;  // R  
     static const uint8_t HYL      =  0x05;  // R  
@@ -39,13 +41,69 @@ public:
     static const uint8_t CNTL2_RESET        =  0x01;
 
     Bus* _bus;
+    RegisterCache<ASAZ + 1> _regs;  // shadow of control registers and fuse ROM
 
     float _magCalibration[3] = {0, 0, 0};  // Factory mag calibration
     float _magBias[3] = {12.5, 15.0,  -33.0};  // Calibration bias
-    float _magScale[3] = {1.02,  1.04,   0.95};  // Calibration scale
+    float _magScale[3] = {1.02,  1.04,   0.95};  // Calibration scale, diagonal of _magSoftIron
+    float _magSoftIron[3][3];                   // Soft iron correction applied after bias removal
+    // Factory adjustment, bias, soft iron and chip to sensor axes remap fused into a single matrix and offset:
+    // sensor = _kernel * raw - _kernelOffset, see correct()
+    float _kernel[3][3];
+    float _kernelOffset[3];
 
     AK8963 (Bus* bus){
         this->_bus = bus;
+        setCorrection(_magBias, _magScale);
+    }
+
+    void setFactoryCalibration(uint8_t* asa){
+        float magnetometerResolution = 4912.0f / 32760.0f; // micro Tesla
+        for (uint8_t i = 0; i < 3; i++)
+            _magCalibration[i] = ((float)(asa[i] - 128)/256. + 1.) * magnetometerResolution; 
+        updateKernel();
+    }
+
+    // Per axis correction, as estimated from min/max
+    void setCorrection(const float* bias, const float* scale){
+        float softIron[3][3] = {
+            {scale[0], 0, 0},
+            {0, scale[1], 0},
+            {0, 0, scale[2]}
+        };
+        setCorrection(bias, softIron);
+    }
+
+    // Full soft iron matrix, as estimated by ellipsoid fit
+    void setCorrection(const float* bias, const float softIron[3][3]){
+        for (uint8_t i = 0; i < 3; i++){
+            _magBias[i] = bias[i];
+            _magScale[i] = softIron[i][i];
+            for (uint8_t j = 0; j < 3; j++) _magSoftIron[i][j] = softIron[i][j];
+        }
+        updateKernel();
+    }
+
+    // Sensor axes are chip y, chip x and -chip z
+    void updateKernel(){
+        const uint8_t axis[3] = {1, 0, 2};
+        const float sign[3] = {1.0f, 1.0f, -1.0f};
+        for (uint8_t r = 0; r < 3; r++){
+            float* softIron = _magSoftIron[axis[r]];
+            _kernelOffset[r] = 0.0f;
+            for (uint8_t j = 0; j < 3; j++){
+                _kernel[r][j] = sign[r] * softIron[j] * _magCalibration[j];
+                _kernelOffset[r] += sign[r] * softIron[j] * _magBias[j];
+            }
+        }
+    }
+
+    // Raw counts (chip axes) to calibrated field in uT (sensor axes)
+    void correct(const int16_t* raw, float* dest){
+        float x = raw[0], y = raw[1], z = raw[2];
+        dest[0] = _kernel[0][0] * x + _kernel[0][1] * y + _kernel[0][2] * z - _kernelOffset[0];
+        dest[1] = _kernel[1][0] * x + _kernel[1][1] * y + _kernel[1][2] * z - _kernelOffset[1];
+        dest[2] = _kernel[2][0] * x + _kernel[2][1] * y + _kernel[2][2] * z - _kernelOffset[2];
     }
 
     void setup()
@@ -55,11 +113,11 @@ public:
 
         // Extract the factory calibration for each magnetometer axis
         uint8_t rawData[3];  
-        readRegisters(ASAX, 3, &rawData[0]);  // Read the x-, y-, and z-axis calibration values
-        float magnetometerResolution = 4912.0f / 32760.0f; // micro Tesla
-        _magCalibration[0] = ((float)(rawData[0] - 128)/256. + 1.) * magnetometerResolution; 
-        _magCalibration[1] = ((float)(rawData[1] - 128)/256. + 1.) * magnetometerResolution;  
-        _magCalibration[2] = ((float)(rawData[2] - 128)/256. + 1.) * magnetometerResolution; 
+        if (!readFuseCache(&rawData[0])) {
+            readRegisters(ASAX, 3, &rawData[0]);  // Read the x-, y-, and z-axis calibration values
+            writeFuseCache(&rawData[0]);
+        }
+        setFactoryCalibration(&rawData[0]);
 
         powerDown();  
         writeRegister(CNTL1, CNTL1_CONT_MEAS_2); // Set mode to 16 bit resolution at 100Hz 
@@ -133,6 +191,47 @@ public:
 
     void writeRegister(uint8_t address, uint8_t data){
         _bus->writeByte(I2C_ADDRESS, address, data);
+        cacheRegister(address, data);
+    }
+
+    // Single measurement and self test modes fall back to power down on their own, soft reset restores defaults
+    void cacheRegister(uint8_t address, uint8_t data){
+        if ((address == CNTL2) && (data & CNTL2_RESET)) {
+            _regs.invalidate(CNTL1);
+            _regs.invalidate(ASTC);
+            _regs.invalidate(I2CDIS);
+            return;
+        }
+        uint8_t mode = data & 0x0F;
+        if ((address == CNTL1) && ((mode == CNTL1_SINGLE_MEAS) || (mode == CNTL1_SELF_TEST))) {
+            _regs.invalidate(CNTL1);
+            return;
+        }
+        if ((address == CNTL1) || (address == ASTC) || (address == I2CDIS)) _regs.set(address, data);
+    }
+
+    bool readFuseCache(uint8_t* asa){
+        if (!_regs.isValid(ASAX)) return false;
+        for (uint8_t i = 0; i < 3; i++) asa[i] = _regs.get(ASAX + i);
+        return true;
+    }
+
+    void writeFuseCache(uint8_t* asa){
+        for (uint8_t i = 0; i < 3; i++) _regs.set(ASAX + i, asa[i]);
+    }
+
+    // Compares count registers read back from address with the shadow copy. Returns number of mismatches.
+    uint8_t verifyRegisters(uint8_t address, uint8_t count, uint8_t* actual){
+        uint8_t mismatches = 0;
+        for (uint8_t i = 0; i < count; i++){
+            uint8_t reg = address + i;
+            if (!_regs.isValid(reg) || (actual[i] == _regs.get(reg))) continue;
+            mismatches++;
+            Serial.print(F("WARNING: AK8963 register write failed: "));
+            Serial.println(reg, HEX);
+            _regs.set(reg, actual[i]);
+        }
+        return mismatches;
     }
 
     void readRegisters(uint8_t address, uint8_t count, uint8_t* dest){
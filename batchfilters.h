@@ -0,0 +1,251 @@
+#ifndef batchfilters_h
+#define batchfilters_h
+
+#include "filters.h"
+#include "simdlanes.h"
+
+// Madgwick filter states of N independent streams in structure of arrays layout
+template <uint16_t N, typename T = float>
+struct MadgwickBatch {
+    T q0[N];
+    T q1[N];
+    T q2[N];
+    T q3[N];
+
+    void reset(){
+        for (uint16_t i = 0; i < N; i++){
+            q0[i] = 1.0f;
+            q1[i] = 0.0f;
+            q2[i] = 0.0f;
+            q3[i] = 0.0f;
+        }
+    }
+};
+
+// Updates lanes i .. i + Lanes<V>::WIDTH - 1 of the batch, one stream per lane of V (see simdlanes.h).
+// Same math as MadgwickQuaternionUpdate, but the body has no early returns: streams with invalid accel keep their
+// previous state through a select. Streams without magnetometer sample (all zero) take MadgwickImuUpdate: their
+// field stays zero, which zeroes every magnetometer term of the gradient.
+template <typename V, uint16_t N, typename T>
+inline void MadgwickBatchLanes(const T* sensor_data, MadgwickBatch<N, T>& state, const T* deltat, uint16_t i)
+{
+    typedef Lanes<V> L;
+    V ax = L::load(&sensor_data[0 * N + i]),
+    ay = L::load(&sensor_data[1 * N + i]),
+    az = L::load(&sensor_data[2 * N + i]),
+    gx = L::load(&sensor_data[3 * N + i]),
+    gy = L::load(&sensor_data[4 * N + i]),
+    gz = L::load(&sensor_data[5 * N + i]),
+    mx = L::load(&sensor_data[6 * N + i]),
+    my = L::load(&sensor_data[7 * N + i]),
+    mz = L::load(&sensor_data[8 * N + i]);
+    V q0 = L::load(&state.q0[i]), q1 = L::load(&state.q1[i]), q2 = L::load(&state.q2[i]), q3 = L::load(&state.q3[i]);
+    V dt = L::load(&deltat[i]);
+
+    // Auxiliary variables to avoid repeated arithmetic
+    V _2q0 = 2.0f * q0;
+    V _2q1 = 2.0f * q1;
+    V _2q2 = 2.0f * q2;
+    V _2q3 = 2.0f * q3;
+    V _2q0q2 = 2.0f * q0 * q2;
+    V _2q2q3 = 2.0f * q2 * q3;
+    V q0q0 = q0 * q0;
+    V q0q1 = q0 * q1;
+    V q0q2 = q0 * q2;
+    V q0q3 = q0 * q3;
+    V q1q1 = q1 * q1;
+    V q1q2 = q1 * q2;
+    V q1q3 = q1 * q3;
+    V q2q2 = q2 * q2;
+    V q2q3 = q2 * q3;
+    V q3q3 = q3 * q3;
+
+    // Normalise accelerometer and magnetometer measurements
+    V anorm = scalarSqrt(ax * ax + ay * ay + az * az);
+    V mnorm = scalarSqrt(mx * mx + my * my + mz * mz);
+    auto valid = (anorm != 0.0f);
+    auto magValid = (mnorm != 0.0f);
+    anorm = 1.0f / laneSelect(valid, anorm, V(1.0f));
+    mnorm = 1.0f / laneSelect(magValid, mnorm, V(1.0f));
+    ax *= anorm;
+    ay *= anorm;
+    az *= anorm;
+    mx *= mnorm;
+    my *= mnorm;
+    mz *= mnorm;
+
+    // Reference direction of Earth's magnetic field
+    V _2q0mx = 2.0f * q0 * mx;
+    V _2q0my = 2.0f * q0 * my;
+    V _2q0mz = 2.0f * q0 * mz;
+    V _2q1mx = 2.0f * q1 * mx;
+    V hx = mx * q0q0 - _2q0my * q3 + _2q0mz * q2 + mx * q1q1 + _2q1 * my * q2 + _2q1 * mz * q3 - mx * q2q2 - mx * q3q3;
+    V hy = _2q0mx * q3 + my * q0q0 - _2q0mz * q1 + _2q1mx * q2 - my * q1q1 + my * q2q2 + _2q2 * mz * q3 - my * q3q3;
+    V _2bx = scalarSqrt(hx * hx + hy * hy);
+    V _2bz = -_2q0mx * q2 + _2q0my * q1 + mz * q0q0 + _2q1mx * q3 - mz * q1q1 + _2q2 * my * q3 - mz * q2q2 + mz * q3q3;
+    V _4bx = 2.0f * _2bx;
+    V _4bz = 2.0f * _2bz;
+
+    // Gradient decent algorithm corrective step
+    V s0 = -_2q2 * (2.0f * q1q3 - _2q0q2 - ax) + _2q1 * (2.0f * q0q1 + _2q2q3 - ay) - _2bz * q2 * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (-_2bx * q3 + _2bz * q1) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + _2bx * q2 * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
+    V s1 = _2q3 * (2.0f * q1q3 - _2q0q2 - ax) + _2q0 * (2.0f * q0q1 + _2q2q3 - ay) - 4.0f * q1 * (1.0f - 2.0f * q1q1 - 2.0f * q2q2 - az) + _2bz * q3 * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (_2bx * q2 + _2bz * q0) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + (_2bx * q3 - _4bz * q1) * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
+    V s2 = -_2q0 * (2.0f * q1q3 - _2q0q2 - ax) + _2q3 * (2.0f * q0q1 + _2q2q3 - ay) - 4.0f * q2 * (1.0f - 2.0f * q1q1 - 2.0f * q2q2 - az) + (-_4bx * q2 - _2bz * q0) * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (_2bx * q1 + _2bz * q3) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + (_2bx * q0 - _4bz * q2) * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
+    V s3 = _2q1 * (2.0f * q1q3 - _2q0q2 - ax) + _2q2 * (2.0f * q0q1 + _2q2q3 - ay) + (-_4bx * q3 + _2bz * q1) * (_2bx * (0.5f - q2q2 - q3q3) + _2bz * (q1q3 - q0q2) - mx) + (-_2bx * q0 + _2bz * q2) * (_2bx * (q1q2 - q0q3) + _2bz * (q0q1 + q2q3) - my) + _2bx * q1 * (_2bx * (q0q2 + q1q3) + _2bz * (0.5f - q1q1 - q2q2) - mz);
+
+    V norm = scalarSqrt(s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3);    // normalise step magnitude
+    auto stepping = (norm != 0.0f);     // zero when estimate already matches, like MadgwickImuUpdate
+    norm = laneSelect(stepping, 1.0f / laneSelect(stepping, norm, V(1.0f)), V(0.0f));
+    s0 *= norm;
+    s1 *= norm;
+    s2 *= norm;
+    s3 *= norm;
+
+    // Compute rate of change of quaternion and integrate
+    V n0 = q0 + (0.5f * (-q1 * gx - q2 * gy - q3 * gz) - beta * s0) * dt;
+    V n1 = q1 + (0.5f * (q0 * gx + q2 * gz - q3 * gy) - beta * s1) * dt;
+    V n2 = q2 + (0.5f * (q0 * gy - q1 * gz + q3 * gx) - beta * s2) * dt;
+    V n3 = q3 + (0.5f * (q0 * gz + q1 * gy - q2 * gx) - beta * s3) * dt;
+    norm = 1.0f / scalarSqrt(n0 * n0 + n1 * n1 + n2 * n2 + n3 * n3);    // normalise quaternion
+
+    L::store(&state.q0[i], laneSelect(valid, n0 * norm, q0));
+    L::store(&state.q1[i], laneSelect(valid, n1 * norm, q1));
+    L::store(&state.q2[i], laneSelect(valid, n2 * norm, q2));
+    L::store(&state.q3[i], laneSelect(valid, n3 * norm, q3));
+}
+
+// Updates first count streams of the batch with one sample each.
+// sensor_data is channel major: sensor_data[c * N + i] is channel c (ax, ay, az, gx, gy, gz, mx, my, mz) of stream i,
+// deltat[i] is the time since the previous sample of stream i. Streams go through V lanes at a time (the widest
+// SIMD type the target has by default, see simdlanes.h), the ones left over one by one.
+template <uint16_t N, typename T, typename V = typename BatchLanes<T>::Vector>
+void MadgwickBatchUpdate(const T* sensor_data, MadgwickBatch<N, T>& state, const T* deltat, uint16_t count = N)
+{
+    uint16_t i = 0;
+    for (; i + Lanes<V>::WIDTH <= count; i += Lanes<V>::WIDTH) MadgwickBatchLanes<V>(sensor_data, state, deltat, i);
+    for (; i < count; i++) MadgwickBatchLanes<T>(sensor_data, state, deltat, i);
+}
+
+// Mahony filter states of N independent streams in structure of arrays layout
+template <uint16_t N, typename T = float>
+struct MahonyBatch {
+    T q0[N];
+    T q1[N];
+    T q2[N];
+    T q3[N];
+    T eInt[3][N];   // integral error, x, y, z
+
+    void reset(){
+        for (uint16_t i = 0; i < N; i++){
+            q0[i] = 1.0f;
+            q1[i] = 0.0f;
+            q2[i] = 0.0f;
+            q3[i] = 0.0f;
+            eInt[0][i] = 0.0f;
+            eInt[1][i] = 0.0f;
+            eInt[2][i] = 0.0f;
+        }
+    }
+};
+
+// Same math as MahonyQuaternionUpdate for lanes i .. i + Lanes<V>::WIDTH - 1, streams without magnetometer sample
+// take MahonyImuUpdate, see MadgwickBatchLanes()
+template <typename V, uint16_t N, typename T>
+inline void MahonyBatchLanes(const T* sensor_data, MahonyBatch<N, T>& state, const T* deltat, uint16_t i)
+{
+    typedef Lanes<V> L;
+    V ax = L::load(&sensor_data[0 * N + i]),
+    ay = L::load(&sensor_data[1 * N + i]),
+    az = L::load(&sensor_data[2 * N + i]),
+    gx = L::load(&sensor_data[3 * N + i]),
+    gy = L::load(&sensor_data[4 * N + i]),
+    gz = L::load(&sensor_data[5 * N + i]),
+    mx = L::load(&sensor_data[6 * N + i]),
+    my = L::load(&sensor_data[7 * N + i]),
+    mz = L::load(&sensor_data[8 * N + i]);
+    V q0 = L::load(&state.q0[i]), q1 = L::load(&state.q1[i]), q2 = L::load(&state.q2[i]), q3 = L::load(&state.q3[i]);
+    V eIntX = L::load(&state.eInt[0][i]), eIntY = L::load(&state.eInt[1][i]), eIntZ = L::load(&state.eInt[2][i]);
+    V dt = L::load(&deltat[i]);
+
+    // Auxiliary variables to avoid repeated arithmetic
+    V q0q0 = q0 * q0;
+    V q0q1 = q0 * q1;
+    V q0q2 = q0 * q2;
+    V q0q3 = q0 * q3;
+    V q1q1 = q1 * q1;
+    V q1q2 = q1 * q2;
+    V q1q3 = q1 * q3;
+    V q2q2 = q2 * q2;
+    V q2q3 = q2 * q3;
+    V q3q3 = q3 * q3;
+
+    // Normalise accelerometer and magnetometer measurements
+    V anorm = scalarSqrt(ax * ax + ay * ay + az * az);
+    V mnorm = scalarSqrt(mx * mx + my * my + mz * mz);
+    auto valid = (anorm != 0.0f);
+    auto magValid = (mnorm != 0.0f);
+    anorm = 1.0f / laneSelect(valid, anorm, V(1.0f));
+    mnorm = 1.0f / laneSelect(magValid, mnorm, V(1.0f));
+    ax *= anorm;
+    ay *= anorm;
+    az *= anorm;
+    mx *= mnorm;
+    my *= mnorm;
+    mz *= mnorm;
+
+    // Reference direction of Earth's magnetic field
+    V hx = 2.0f * mx * (0.5f - q2q2 - q3q3) + 2.0f * my * (q1q2 - q0q3) + 2.0f * mz * (q1q3 + q0q2);
+    V hy = 2.0f * mx * (q1q2 + q0q3) + 2.0f * my * (0.5f - q1q1 - q3q3) + 2.0f * mz * (q2q3 - q0q1);
+    V bx = scalarSqrt((hx * hx) + (hy * hy));
+    V bz = 2.0f * mx * (q1q3 - q0q2) + 2.0f * my * (q2q3 + q0q1) + 2.0f * mz * (0.5f - q1q1 - q2q2);
+
+    // Estimated direction of gravity and magnetic field
+    V vx = 2.0f * (q1q3 - q0q2);
+    V vy = 2.0f * (q0q1 + q2q3);
+    V vz = q0q0 - q1q1 - q2q2 + q3q3;
+    V wx = 2.0f * bx * (0.5f - q2q2 - q3q3) + 2.0f * bz * (q1q3 - q0q2);
+    V wy = 2.0f * bx * (q1q2 - q0q3) + 2.0f * bz * (q0q1 + q2q3);
+    V wz = 2.0f * bx * (q0q2 + q1q3) + 2.0f * bz * (0.5f - q1q1 - q2q2);
+
+    // Error is cross product between estimated direction and measured direction of gravity
+    V ex = (ay * vz - az * vy) + (my * wz - mz * wy);
+    V ey = (az * vx - ax * vz) + (mz * wx - mx * wz);
+    V ez = (ax * vy - ay * vx) + (mx * wy - my * wx);
+    V nIntX = 0.0f, nIntY = 0.0f, nIntZ = 0.0f;    // no integral wind up
+    if (Ki > 0.0f) {
+        nIntX = eIntX + ex;
+        nIntY = eIntY + ey;
+        nIntZ = eIntZ + ez;
+    }
+
+    // Apply feedback terms
+    gx = gx + Kp * ex + Ki * nIntX;
+    gy = gy + Kp * ey + Ki * nIntY;
+    gz = gz + Kp * ez + Ki * nIntZ;
+
+    // Integrate rate of change of quaternion, q1 .. q3 take the new q0 like the scalar filter
+    V n0 = q0 + (-q1 * gx - q2 * gy - q3 * gz) * (0.5f * dt);
+    V n1 = q1 + (n0 * gx + q2 * gz - q3 * gy) * (0.5f * dt);
+    V n2 = q2 + (n0 * gy - q1 * gz + q3 * gx) * (0.5f * dt);
+    V n3 = q3 + (n0 * gz + q1 * gy - q2 * gx) * (0.5f * dt);
+
+    // Normalise quaternion
+    V norm = 1.0f / scalarSqrt(n0 * n0 + n1 * n1 + n2 * n2 + n3 * n3);
+    L::store(&state.q0[i], laneSelect(valid, n0 * norm, q0));
+    L::store(&state.q1[i], laneSelect(valid, n1 * norm, q1));
+    L::store(&state.q2[i], laneSelect(valid, n2 * norm, q2));
+    L::store(&state.q3[i], laneSelect(valid, n3 * norm, q3));
+    L::store(&state.eInt[0][i], laneSelect(valid, nIntX, eIntX));
+    L::store(&state.eInt[1][i], laneSelect(valid, nIntY, eIntY));
+    L::store(&state.eInt[2][i], laneSelect(valid, nIntZ, eIntZ));
+}
+
+// Layout and lanes as MadgwickBatchUpdate()
+template <uint16_t N, typename T, typename V = typename BatchLanes<T>::Vector>
+void MahonyBatchUpdate(const T* sensor_data, MahonyBatch<N, T>& state, const T* deltat, uint16_t count = N)
+{
+    uint16_t i = 0;
+    for (; i + Lanes<V>::WIDTH <= count; i += Lanes<V>::WIDTH) MahonyBatchLanes<V>(sensor_data, state, deltat, i);
+    for (; i < count; i++) MahonyBatchLanes<T>(sensor_data, state, deltat, i);
+}
+
+#endif
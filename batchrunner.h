@@ -0,0 +1,45 @@
+#ifndef BATCHRUNNER_h
+#define BATCHRUNNER_h
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "batchfilters.h"
+
+// Reprocessing of recorded streams off-target: streams are grouped N to a batch (batchfilters.h) and batches are
+// spread over threads. Each thread takes the next batch not yet done and runs it through all of its steps, so the
+// state of a batch stays in one core's cache and no two threads ever touch the same batch.
+//
+// Log of one batch, laid out as the batch updates take it: step k of the streams is data[k * 9 * N ...] (channel
+// major, see MadgwickBatchUpdate) and deltat[k * N ...]. count streams of the batch are in use.
+template <uint16_t N, typename T = float>
+struct BatchLog {
+    const T* data;
+    const T* deltat;
+    uint32_t steps;
+    uint16_t count;
+};
+
+// Runs update(data, state, deltat, count) for every step of every batch, states[b] goes with logs[b].
+// threads = 0 takes one per core.
+template <typename State, uint16_t N, typename T, typename Update>
+void runBatches(State* states, const BatchLog<N, T>* logs, size_t batches, Update update, unsigned threads = 0)
+{
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+    if (threads > batches) threads = batches;
+    std::atomic<size_t> next(0);
+    auto worker = [&](){
+        for (size_t b = next++; b < batches; b = next++) {
+            const BatchLog<N, T>& log = logs[b];
+            for (uint32_t k = 0; k < log.steps; k++)
+                update(&log.data[(size_t) k * 9 * N], states[b], &log.deltat[(size_t) k * N], log.count);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; i++) pool.emplace_back(worker);
+    worker();
+    for (std::thread& thread : pool) thread.join();
+}
+
+#endif
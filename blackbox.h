@@ -0,0 +1,134 @@
+#ifndef BLACKBOX_h
+#define BLACKBOX_h
+
+#include <stdint.h>
+
+// Pre-trigger recorder: keeps the last samples of one sensor at full rate in RAM while armed. A trigger (shock on
+// accelerometer, fast rotation, or a host request) lets postTrigger more samples in and then freezes the window,
+// so it can be uploaded at link speed while acquisition goes on. release() clears it and arms it again.
+class BlackBox {
+public:
+    static const uint8_t SAMPLE_VALUES = 9;     // ax, ay, az, gx, gy, gz, hx, hy, hz
+
+    // Raw values as in StartSensorsCommand packed stream samples. The window is contiguous and uploaded without loss,
+    // so an interval to the previous sample takes the place of the stream's sample time.
+    struct Sample {
+        int16_t _raw[SAMPLE_VALUES];
+        uint16_t _dt_us;    // since the previous sample, saturated
+    };
+
+    enum State
+    {
+        IDLE,       // not recording
+        ARMED,      // recording, watching triggers
+        TRIGGERED,  // recording post trigger samples
+        FROZEN      // window complete, waits for release()
+    };
+
+    enum Cause
+    {
+        CAUSE_NONE,
+        CAUSE_ACCEL,
+        CAUSE_GYRO,
+        CAUSE_HOST
+    };
+
+    Sample* _samples;
+    uint16_t _capacity;
+    uint16_t _head;         // next sample slot
+    uint16_t _count;        // recorded samples, up to _capacity
+    uint16_t _postTrigger;
+    uint16_t _remaining;    // post trigger samples still to come
+    float _accelLimit;      // m/s^2, squared magnitude is compared, 0 = off
+    float _gyroLimit;       // rad/s
+    State _state;
+    Cause _cause;
+
+    BlackBox(Sample* samples, uint16_t capacity)
+        :_samples(samples), _capacity(capacity), _postTrigger(0), _accelLimit(0), _gyroLimit(0), _state(IDLE) {
+        clear();
+    };
+
+    void clear(){
+        _head = 0;
+        _count = 0;
+        _remaining = 0;
+        _cause = CAUSE_NONE;
+    }
+
+    // postTrigger is limited so at least a quarter of the window stays pre trigger history
+    void arm(float accelLimit, float gyroLimit, uint16_t postTrigger){
+        _accelLimit = accelLimit;
+        _gyroLimit = gyroLimit;
+        _postTrigger = (postTrigger < _capacity - _capacity / 4) ? postTrigger : _capacity - _capacity / 4;
+        clear();
+        _state = ARMED;
+    }
+
+    void disarm(){
+        _state = IDLE;
+        clear();
+    }
+
+    void trigger(Cause cause){
+        if (_state != ARMED) return;
+        _cause = cause;
+        _remaining = _postTrigger;
+        _state = _remaining ? TRIGGERED : FROZEN;
+    }
+
+    // raw and scaled sensor_data of one sample (see MPU9250::parseData()), dt in s
+    void add(const int16_t* raw, const float* sensor_data, float dt){
+        if ((_state == IDLE) || (_state == FROZEN)) return;
+        Sample& sample = _samples[_head];
+        for (uint8_t i = 0; i < SAMPLE_VALUES; i++) sample._raw[i] = raw[i];
+        sample._dt_us = (dt < 0.065535f) ? (uint16_t)(dt * 1000000.0f) : 0xFFFF;
+        _head = (_head + 1 == _capacity) ? 0 : _head + 1;
+        if (_count < _capacity) _count++;
+
+        if (_state == TRIGGERED) {
+            if (--_remaining == 0) _state = FROZEN;
+            return;
+        }
+        if (_accelLimit > 0) {
+            float a = sensor_data[0] * sensor_data[0] + sensor_data[1] * sensor_data[1] + sensor_data[2] * sensor_data[2];
+            if (a > _accelLimit * _accelLimit) {
+                trigger(CAUSE_ACCEL);
+                return;
+            }
+        }
+        if (_gyroLimit > 0) {
+            float w = sensor_data[3] * sensor_data[3] + sensor_data[4] * sensor_data[4] + sensor_data[5] * sensor_data[5];
+            if (w > _gyroLimit * _gyroLimit) trigger(CAUSE_GYRO);
+        }
+    }
+
+    // Window of a frozen recording, oldest sample first
+    const Sample& at(uint16_t i){
+        uint16_t pos = (_count < _capacity) ? i : _head + i;
+        return _samples[(pos < _capacity) ? pos : pos - _capacity];
+    }
+
+    // Position of the trigger sample in the window
+    uint16_t triggerIndex(){
+        return _count - 1 - (_postTrigger - _remaining);
+    }
+
+    void release(){
+        clear();
+        _state = ARMED;
+    }
+};
+
+// Black box with its own storage, e.g. StaticBlackBox<1600> takes 32 KB, 1.6 s at 1 kHz
+template <uint16_t SAMPLES>
+class StaticBlackBox : public BlackBox {
+public:
+    static_assert(SAMPLES <= 3200, "window has to fit one upload message of up to 64 KB");
+
+    Sample _storage[SAMPLES];
+
+    StaticBlackBox():BlackBox(_storage, SAMPLES) {};
+};
+
+#endif
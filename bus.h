@@ -3,6 +3,8 @@
 
 #include "Arduino.h"
 
+typedef void (*BusCallback)(void* context);
+
 class Bus {
 public:
     virtual void begin(){};
@@ -14,6 +16,27 @@ public:
     virtual bool writeByte(uint8_t address, uint8_t subAddress, uint8_t data) = 0;
 
     virtual void readBytes(uint8_t address, uint8_t subAddress, uint8_t count, uint8_t* dest, bool fast = false) = 0;
+
+    // Writes count consecutive registers. Buses which can burst do it in one transfer, so the chip never acts
+    // on a half written multi byte value. Returns false if any byte failed.
+    virtual bool writeBytes(uint8_t address, uint8_t subAddress, uint8_t count, const uint8_t* data){
+        bool res = true;
+        for (uint8_t i = 0; i < count; i++)
+            res &= writeByte(address, subAddress + i, data[i]);
+        return res;
+    }
+
+    // Starts a read and calls callback(context) once dest is filled. Returns false if bus is busy.
+    // Buses without DMA support complete the read synchronously before returning.
+    virtual bool readBytesAsync(uint8_t address, uint8_t subAddress, uint8_t count, uint8_t* dest, BusCallback callback, void* context = nullptr){
+        readBytes(address, subAddress, count, dest, true);
+        callback(context);
+        return true;
+    }
+
+    virtual bool busy(){
+        return false;
+    }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,78 @@
+#ifndef CALIBSTORE_h
+#define CALIBSTORE_h
+
+#include <stddef.h>
+#include "storage.h"
+#include "utils.h"
+
+// Calibration and configuration of one sensor as it is kept in storage. Loaded on boot, so setup() restores
+// offsets instead of measuring them again. Any layout change must bump VERSION, old records are then ignored.
+struct CalibrationRecord {
+    static const uint16_t MAGIC = 0x4D43;
+    static const uint8_t VERSION = 2;
+
+    uint16_t magic;
+    uint8_t version;
+    uint8_t length;
+    float accelBias[3];         // g, measured by MPU9250::calibrate(), informational
+    float magBias[3];           // uT
+    float magSoftIron[3][3];
+    uint8_t gyroOffset[6];      // XG_OFFSET_H .. ZG_OFFSET_L register values
+    uint8_t magAsa[3];          // AK8963 fuse ROM sensitivity adjustment
+    uint8_t algorythm;
+    uint8_t gyroRes;
+    uint8_t accelRes;
+    uint8_t gyroDLPF;
+    uint8_t accelDLPF;
+    uint8_t fifoMode;
+    uint8_t reserved;
+    uint16_t outputDataRate;    // Hz, 0 = not set
+    uint16_t crc;               // CRC-16/CCITT of all preceding bytes
+
+    uint16_t checksum() const {
+        return crc16((const uint8_t*) this, offsetof(CalibrationRecord, crc));
+    }
+
+    void seal(){
+        magic = MAGIC;
+        version = VERSION;
+        length = sizeof(CalibrationRecord);
+        reserved = 0;
+        crc = checksum();
+    }
+
+    bool valid() const {
+        return (magic == MAGIC) && (version == VERSION) && (length == sizeof(CalibrationRecord)) && (crc == checksum());
+    }
+};
+
+// Fixed size slot per sensor id
+class CalibrationStore {
+public:
+    static const uint16_t SLOT_SIZE = 128;
+    static_assert(sizeof(CalibrationRecord) <= SLOT_SIZE, "calibration record doesn't fit its slot");
+
+    Storage* _storage;
+
+    CalibrationStore(Storage* storage) : _storage(storage) {};
+
+    bool load(uint8_t slot, CalibrationRecord& record){
+        if ((uint32_t)(slot + 1) * SLOT_SIZE > _storage->size()) return false;
+        _storage->read(slot * SLOT_SIZE, (uint8_t*) &record, sizeof(record));
+        return record.valid();
+    }
+
+    bool save(uint8_t slot, CalibrationRecord& record){
+        record.seal();
+        return _storage->write(slot * SLOT_SIZE, (const uint8_t*) &record, sizeof(record));
+    }
+
+    // Erased slot fails validation, so sensor calibrates from scratch on next setup
+    bool erase(uint8_t slot){
+        uint8_t erased[sizeof(CalibrationRecord)];
+        for (uint16_t i = 0; i < sizeof(erased); i++) erased[i] = 0xFF;
+        return _storage->write(slot * SLOT_SIZE, &erased[0], sizeof(erased));
+    }
+};
+
+#endif
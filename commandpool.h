@@ -0,0 +1,109 @@
+#ifndef COMMANDPOOL_h
+#define COMMANDPOOL_h
+
+#include <new>
+#include "commands.h"
+
+// Largest of command classes, used as pool slot size
+template <class C>
+constexpr size_t commandSize(){
+    return sizeof(C);
+}
+
+template <class C, class D, class... Rest>
+constexpr size_t commandSize(){
+    return (sizeof(C) > commandSize<D, Rest...>()) ? sizeof(C) : commandSize<D, Rest...>();
+}
+
+// Fixed number of command slots in static storage, commands are constructed in place, so dispatch never touches heap.
+// Several commands can be active at once, e.g. a register read while sensors stream.
+template <uint8_t SLOTS, size_t SLOT_SIZE>
+class CommandPool {
+public:
+    struct Slot {
+        alignas(8) uint8_t _storage[SLOT_SIZE];
+        BaseCommand* _command;
+    };
+
+    Slot _slots[SLOTS];
+    uint8_t _next;  // slot which runs first on next exec(), rotates for fairness
+    Transport* _transport;  // commands send their responses through it
+
+    CommandPool(Transport* transport):_next(0), _transport(transport) {
+        for (uint8_t i = 0; i < SLOTS; i++) _slots[i]._command = nullptr;
+    }
+
+    ~CommandPool(){
+        releaseAll();
+    }
+
+    // Exclusive command stops all active ones, like the single command dispatch did.
+    // Otherwise it only replaces an active command with the same code.
+    template <class C>
+    BaseCommand* start(SensorArray* sensors, byte* buffer){
+        static_assert(sizeof(C) <= SLOT_SIZE, "command doesn't fit pool slot");
+        if (C::exclusive(buffer)) releaseAll();
+        else release(BaseCommand::getCommandCode(buffer));
+
+        int slot = freeSlot();
+        if (slot < 0) {
+            Serial.print(F("Command pool is full, command dropped: "));
+            Serial.println(BaseCommand::getCommandCode(buffer));
+            return nullptr;
+        }
+        BaseCommand* command = new (_slots[slot]._storage) C(sensors, _transport, buffer);
+        _slots[slot]._command = command;
+        command->setup();
+        return command;
+    }
+
+    // Runs every active command once, finished commands free their slots
+    void exec(){
+        for (uint8_t i = 0; i < SLOTS; i++){
+            uint8_t slot = (_next + i) % SLOTS;
+            BaseCommand* command = _slots[slot]._command;
+            if (command && !command->exec()) release(slot);
+        }
+        _next = (_next + 1) % SLOTS;
+    }
+
+    // Host acknowledgement of fragments (see framing.h): uint8 cmd, transfer, uint16 next index, uint8 status
+    void ack(byte* packet){
+        if (BaseCommand::getDataLen(packet) < 5) return;
+        uint16_t next;
+        memcpy(&next, &packet[4], sizeof(next));
+        for (uint8_t i = 0; i < SLOTS; i++)
+            if (_slots[i]._command && (_slots[i]._command->_cmd_code == packet[2]))
+                _slots[i]._command->messageAck(packet[3], next, (FragmentAck) packet[6]);
+    }
+
+    int freeSlot(){
+        for (uint8_t i = 0; i < SLOTS; i++)
+            if (!_slots[i]._command) return i;
+        return -1;
+    }
+
+    uint8_t activeCount(){
+        uint8_t count = 0;
+        for (uint8_t i = 0; i < SLOTS; i++)
+            if (_slots[i]._command) count++;
+        return count;
+    }
+
+    void release(uint8_t slot){
+        if (!_slots[slot]._command) return;
+        _slots[slot]._command->~BaseCommand();
+        _slots[slot]._command = nullptr;
+    }
+
+    void release(USBCommand cmd_code){
+        for (uint8_t i = 0; i < SLOTS; i++)
+            if (_slots[i]._command && _slots[i]._command->_cmd_code == cmd_code) release(i);
+    }
+
+    void releaseAll(){
+        for (uint8_t i = 0; i < SLOTS; i++) release(i);
+    }
+};
+
+#endif
@@ -1,8 +1,14 @@
 #ifndef COMMANDS_h
 #define COMMANDS_h
 #include "MPU9250.h"
+#include "sensorarray.h"
 #include "filters.h"
+#include "ekf.h"
 #include "utils.h"
+#include "decimator.h"
+#include "profiler.h"
+#include "transport.h"
+#include "framing.h"
 
 enum USBCommand
 {
@@ -10,19 +16,41 @@ enum USBCommand
     CMD_STOP,
     CMD_MAG_CALIB,
     CMD_READ_REGS,
-    CMD_SETUP
+    CMD_SETUP,
+    CMD_TIMING,
+    CMD_STATS,
+    CMD_LINK_STATS,
+    CMD_BLACKBOX,
+    CMD_CALIBRATION
 };
 
 
 class BaseCommand {
 public:
     static const uint USB_PACKET_SIZE = 64;
-    MPU9250* _mpu9250;
-    byte* _buffer;
+    SensorArray* _sensors;
+    MPU9250* _mpu9250;  // sensor the command works with, first one unless selected by request
+    Transport* _transport;
+    byte* _buffer;      // request, shared with the receiver
+    byte _packet[USB_PACKET_SIZE];  // response being written, goes to transport queue whole
     USBCommand _cmd_code;
     uint _write_counter;
-    BaseCommand(MPU9250* mpu9250, byte* buffer)
-        :_mpu9250(mpu9250), _buffer(buffer), _write_counter(0) {
+    const uint8_t* _message;    // long response being sent in fragments, see messageStart()
+    uint16_t _messageLength;
+    uint16_t _messageCrc;
+    uint16_t _fragment;         // next one to send
+    uint16_t _fragments;
+    uint16_t _acked;            // first fragment the host hasn't acknowledged
+    uint16_t _fragmentCrc[FRAGMENT_WINDOW];     // CRC before each fragment of the window, for resending from it
+    unsigned long _ackTime;     // ms of the last fragment sent or acknowledgement taken
+    uint8_t _retries;           // windows sent again without an answer
+    uint8_t _transfer;
+    bool _messageFinal;         // last fragment is the final packet of the command
+    bool _messageAcked;         // host has the whole message
+    BaseCommand(SensorArray* sensors, Transport* transport, byte* buffer)
+        :_sensors(sensors), _mpu9250(sensors->get(0)), _transport(transport), _buffer(buffer), _write_counter(0),
+        _message(nullptr), _messageLength(0), _messageCrc(0), _fragment(0), _fragments(0), _acked(0), _ackTime(0),
+        _retries(0), _transfer(0), _messageFinal(true), _messageAcked(false) {
             _cmd_code = getCommandCode(buffer);
         };
 
@@ -32,6 +60,12 @@ public:
     
     virtual bool exec() = 0;
 
+    // Exclusive command stops every active one before it starts, others run alongside them (see commandpool.h).
+    // Request buffer is shared with the receiver and other commands, so request data must be parsed in setup().
+    static bool exclusive(byte* data){
+        return true;
+    }
+
     static USBCommand getCommandCode(byte* data){
         return (USBCommand) data[0];
     }
@@ -53,13 +87,22 @@ public:
         return getDataLen(_buffer);
     }
 
+    void selectSensor(uint8_t id){
+        if (id < _sensors->count()) {
+            _mpu9250 = _sensors->get(id);
+            return;
+        }
+        Serial.print(F("Unknown sensor id: "));
+        Serial.println(id);
+    }
+
     void bufWrite(byte data){
-        _buffer[_write_counter++] = data;
+        _packet[_write_counter++] = data;
     }
 
     void bufWrite(void* data, uint data_len){
         for (uint i=0; i < data_len; i++){
-            _buffer[i + _write_counter] = *((unsigned char*)(data)+i);
+            _packet[i + _write_counter] = *((unsigned char*)(data)+i);
         }
         _write_counter += data_len;
     }
@@ -73,91 +116,364 @@ public:
 
     void bufWriteEnd(){
         for (uint i=_write_counter; i < USB_PACKET_SIZE; i++){
-            _buffer[i] = 0;
+            _packet[i] = 0;
         }
         _write_counter = USB_PACKET_SIZE;
     }
 
     bool bufSend(){
+        PROFILE_SCOPE(STAGE_SEND);
         bufWriteEnd();
-        int n = RawHID.send(_buffer, 100);
+        int n = _transport->send(_packet, 0);  // acquisition never waits for the host, see txqueue.h
         return n > 0;
     }
     void bufPrint(){
         bufPrint(_buffer);
     }
 
+    // Long packet series take at most half of the transmit queue, so live stream packets aren't pushed out
+    bool txRoom(){
+        return !_transport->capacity() || (_transport->queued() * 2 < _transport->capacity());
+    }
+
+    // Response of any length as fragments (see framing.h). Call messageSend() from exec() until it returns true.
+    // Message bytes are taken by messageRead() while sending, from data unless it is overridden, so data must stay
+    // until the host acknowledged it.
+    void messageStart(const void* data, uint16_t length, bool final_packet = true){
+        static uint8_t transfer = 0;
+        _messageFinal = final_packet;
+        _message = (const uint8_t*) data;
+        _messageLength = length;
+        _messageCrc = 0xFFFF;
+        _fragment = 0;
+        _fragments = fragmentCount(length);
+        _acked = 0;
+        _retries = 0;
+        _messageAcked = false;
+        _transfer = transfer++;
+    }
+
+    virtual void messageRead(uint16_t offset, uint8_t* dest, uint16_t count){
+        memcpy(dest, &_message[offset], count);
+    }
+
+    // Sends the window of fragments while transmit queue has room and waits for the host to acknowledge it. Returns
+    // true once the host has the whole message (_messageAcked) or didn't answer FRAGMENT_RETRIES windows in a row.
+    bool messageSend(){
+        if (_messageAcked || (_retries > FRAGMENT_RETRIES)) return true;
+        uint16_t windowEnd = (_acked / FRAGMENT_WINDOW + 1) * FRAGMENT_WINDOW;
+        if (windowEnd > _fragments) windowEnd = _fragments;
+        if (_fragment == windowEnd) {
+            if (millis() - _ackTime < FRAGMENT_ACK_TIMEOUT) return false;
+            if (++_retries > FRAGMENT_RETRIES) {
+                Serial.print(F("No acknowledgement of response, message dropped: "));
+                Serial.println(_cmd_code);
+                return true;
+            }
+            messageRewind(_acked);
+        }
+        while ((_fragment < windowEnd) && txRoom()){
+            uint8_t data[FRAGMENT_DATA];
+            uint16_t offset = (uint32_t) _fragment * FRAGMENT_DATA;
+            uint16_t streamLength = _messageLength + sizeof(uint16_t);
+            uint16_t end = (streamLength - offset < FRAGMENT_DATA) ? streamLength : offset + FRAGMENT_DATA;
+            uint16_t messageEnd = (end < _messageLength) ? end : _messageLength;
+            uint8_t count = (offset < messageEnd) ? messageEnd - offset : 0;
+            _fragmentCrc[_fragment % FRAGMENT_WINDOW] = _messageCrc;
+            messageRead(offset, &data[0], count);
+            _messageCrc = crc16(&data[0], count, _messageCrc);
+            for (uint16_t pos = offset + count; pos < end; pos++)   // CRC after the message, little endian
+                data[pos - offset] = (pos == _messageLength) ? (_messageCrc & 0xFF) : (_messageCrc >> 8);
+
+            bool final_packet = _messageFinal && (_fragment + 1 == _fragments);
+            _write_counter = 0;
+            bufWrite((byte) (_cmd_code | FRAGMENT_FLAG));
+            bufWrite((byte) (FRAGMENT_HEADER + end - offset));
+            bufWrite((byte) final_packet);
+            bufWrite(_transfer);
+            bufWrite(&_fragment, sizeof(_fragment));
+            bufWrite(&_fragments, sizeof(_fragments));
+            bufWrite(&data[0], end - offset);
+            bufSend();
+            _fragment++;
+            _ackTime = millis();
+        }
+        return false;
+    }
+
+    // Next fragment to send, from the window sent but not acknowledged yet, or the start
+    void messageRewind(uint16_t index){
+        if (index == _fragment) return;
+        _messageCrc = index ? _fragmentCrc[index % FRAGMENT_WINDOW] : 0xFFFF;
+        _fragment = index;
+    }
+
+    // Host acknowledgement of the message being sent, see FRAGMENT_ACK in framing.h
+    void messageAck(uint8_t transfer, uint16_t next, FragmentAck status){
+        if (!_fragments || (transfer != _transfer) || _messageAcked) return;
+        switch (status){
+            case ACK_DONE:
+                _messageAcked = (_fragment == _fragments);
+                break;
+            case ACK_PROGRESS:
+                if ((next <= _acked) || (next > _fragment)) return;
+                _acked = next;
+                break;
+            case ACK_RESEND:
+                if ((next && (next < _acked)) || (next > _fragment)) return;
+                messageRewind(next);
+                _acked = next;
+                break;
+            default:
+                return;
+        }
+        _retries = 0;
+        _ackTime = millis();
+    }
 };
 
 class StartSensorsCommand:public BaseCommand {
 public:
-    float _eInt[3];
-    float _q[4];
-    TimeCounter _timeCounter;
-    uint _updateCounter;
-    uint _sendThre;
-    StartSensorsCommand(MPU9250* mpu9250, byte* buffer):BaseCommand(mpu9250, buffer){};
-    ~StartSensorsCommand(){}
+    enum StreamFormat
+    {
+        STREAM_FLOAT,   // one sample per packet as 14 floats, uint32 sample time and sensor id byte
+        STREAM_PACKED   // header packet with scales, then several raw int16 samples per packet
+    };
+
+    static const uint SENSOR_DATA_SIZE = 15;
+    static const uint FLOAT_DATA_LEN = SENSOR_DATA_SIZE * sizeof(float) + 1;
+    // Packed stream: header packet of every sensor carries its id byte and scale factors as floats:
+    // accelScale, gyroScale, magnetometer kernel[9] (row major) and kernelOffset[3], see AK8963::correct().
+    // Data packets carry tag byte (sensor id in high bits, sequence number in low bits) followed by samples of
+    // int16 ax, ay, az, gx, gy, gz, hx, hy, hz (magnetometer axes) and uint16 sample time.
+    // Sample time is us from stream start to the data ready interrupt of the newest sample that went into the output
+    // (see SampleClock), as uint32 in float stream and its low 16 bits in packed stream. The host keeps the timeline
+    // across lost packets and FIFO overflows, the sequence number tells how many samples a wrap of the short time
+    // has to account for.
+    static const uint PACKED_HEADER_LEN = 1 + 14 * sizeof(float);
+    static const uint PACKED_SAMPLE_SIZE = 9 * sizeof(int16_t) + sizeof(uint16_t);
+    static const uint PACKED_SAMPLES_PER_PACKET = 3;
+    static const uint PACKED_DATA_LEN = 1 + PACKED_SAMPLES_PER_PACKET * PACKED_SAMPLE_SIZE;
+    static const uint8_t PACKED_SEQ_BITS = 6;
+    static const uint8_t PACKED_SEQ_MASK = (1 << PACKED_SEQ_BITS) - 1;
+    static_assert(SensorArray::MAX_SENSORS <= (1 << (8 - PACKED_SEQ_BITS)), "sensor id doesn't fit packed tag byte");
+
+    // Fusion and output state, kept separately for every sensor of the array
+    struct SensorState {
+        float _eInt[3];
+        float _q[4];
+        QuaternionEKF<float> _ekf;
+        CicDecimator<MPU9250::RAW_DATA_SIZE> _decimator;
+        uint8_t _packedData[PACKED_DATA_LEN];
+        uint _packedCount;
+        uint8_t _packedSeq;
+    };
+
+    SensorState _states[SensorArray::MAX_SENSORS];
+    uint _sendThre;     // fused samples per sent one, filtered by decimator rather than dropped
+    StreamFormat _streamFormat;
+    uint8_t _fifoData[MPU9250::FIFO_BURST_FRAMES * MPU9250::FIFO_FRAME_SIZE];
+    StartSensorsCommand(SensorArray* sensors, Transport* transport, byte* buffer):BaseCommand(sensors, transport, buffer){};
+    ~StartSensorsCommand(){
+        for (uint8_t id = 0; id < _sensors->count(); id++) _sensors->get(id)->_streaming = false;
+    }
 
     void setup(){
         bufPrint();
-        _mpu9250->setup();
-        _eInt[0] = 0.0;
-        _eInt[1] = 0.0;
-        _eInt[2] = 0.0;
-        _q[0] = 0.39;
-        _q[1] = 0.0;
-        _q[2] = 0.0;
-        _q[3] = -0.92;
-        _updateCounter = 0;
         uint data_len = getDataLen();
         if (data_len>0) _sendThre = _buffer[2];
         else _sendThre = 100;
+        if ((data_len>1) && (_buffer[3] == STREAM_PACKED)) _streamFormat = STREAM_PACKED;
+        else _streamFormat = STREAM_FLOAT;
+
+        for (uint8_t id = 0; id < _sensors->count(); id++){
+            MPU9250* mpu9250 = _sensors->get(id);
+            SensorState& state = _states[id];
+            mpu9250->setup();
+            if (mpu9250->_algorythm == MPU9250::DMP) mpu9250->setupDmp();
+            mpu9250->_streaming = true;
+            state._eInt[0] = 0.0;
+            state._eInt[1] = 0.0;
+            state._eInt[2] = 0.0;
+            state._q[0] = 0.39;
+            state._q[1] = 0.0;
+            state._q[2] = 0.0;
+            state._q[3] = -0.92;
+            state._ekf.reset(state._q);
+            mpu9250->_sampleClock.start();
+            if (!state._decimator.setFactor(_sendThre)) {
+                Serial.print(F("Stream divisor out of range, sending every sample: "));
+                Serial.println(_sendThre);
+                _sendThre = 1;
+                state._decimator.setFactor(_sendThre);
+            }
+            state._packedCount = 0;
+            state._packedSeq = 0;
+            if (_streamFormat == STREAM_PACKED) sendPackedHeader(id);
+        }
     }
 
     bool exec(){
-        if (!_mpu9250->readInterrupt()) return true;
+        int16_t raw[MPU9250::RAW_DATA_SIZE];
+        float sensor_data[SENSOR_DATA_SIZE]; //ax, ay, az, gx, gy, gz, hx, hy, hz, t, qx, qy, qz, qw;
+        int ready = _sensors->fetchData(&raw[0], &sensor_data[0]);
+        uint32_t stamp = (ready >= 0) ? _sensors->get(ready)->_sampleStamp : 0; // schedule() takes the next one
+
+        // start clocking in the next sample before fusing this one
+        _sensors->schedule();
+
+        if (ready >= 0) {
+            SampleClock& clock = _sensors->get(ready)->_sampleClock;
+            float dt = clock.update(stamp);
+            processSample(ready, raw, sensor_data, dt, clock.timeMicros());
+        }
+
+        for (uint8_t id = 0; id < _sensors->count(); id++){
+            MPU9250* mpu9250 = _sensors->get(id);
+            if (mpu9250->_dmpReady) execDmp(id);
+            else if (mpu9250->_fifoMode) execFifo(id);
+        }
+        return true;
+    }
+
+    void execFifo(uint8_t id){
+        MPU9250* mpu9250 = _sensors->get(id);
+        uint32_t stamp;
+        mpu9250->takeTimestamp(stamp);  // newest data ready time is that of the last frame in FIFO
+        int frames = mpu9250->readFifo(_fifoData, MPU9250::FIFO_BURST_FRAMES);
+        if (frames < 0) {
+            mpu9250->_sampleClock.resync(stamp); // samples were dropped, don't let the gap leak into dt
+            return;
+        }
+        if (frames == 0) return;
+
+        // FIFO samples are taken at a fixed rate, so elapsed time is spread evenly over the block
+        auto dt = mpu9250->_sampleClock.update(stamp) / frames;
+        uint32_t last = mpu9250->_sampleClock.timeMicros();
+        for (int i = 0; i < frames; i++){
+            int16_t raw[MPU9250::RAW_DATA_SIZE];
+            float sensor_data[SENSOR_DATA_SIZE];
+            mpu9250->parseData(&_fifoData[i * MPU9250::FIFO_FRAME_SIZE], &raw[0], &sensor_data[0]);
+            processSample(id, raw, sensor_data, dt, last - (uint32_t)((frames - 1 - i) * dt * 1000000.0f));
+        }
+    }
 
-        float sensor_data[15]; //ax, ay, az, gx, gy, gz, hx, hy, hz, t, qx, qy, qz, qw;
-        _mpu9250->readData(&sensor_data[0]);
+    // Quaternions come ready from DMP through FIFO, raw sensor values are read alongside for the output stream
+    void execDmp(uint8_t id){
+        MPU9250* mpu9250 = _sensors->get(id);
+        SensorState& state = _states[id];
+        float q[MPU9250::FIFO_BURST_FRAMES * 4];
+        uint32_t stamp;
+        mpu9250->takeTimestamp(stamp);
+        int count = mpu9250->readDmpQuaternions(&q[0], MPU9250::FIFO_BURST_FRAMES);
+        if (count <= 0) return;
+
+        int last = (count - 1) * 4;
+        state._q[0] = q[last];
+        state._q[1] = q[last + 1];
+        state._q[2] = q[last + 2];
+        state._q[3] = q[last + 3];
+
+        int16_t raw[MPU9250::RAW_DATA_SIZE];
+        float sensor_data[SENSOR_DATA_SIZE];
+        mpu9250->readData(&raw[0], &sensor_data[0]);
+        float dt = mpu9250->_sampleClock.update(stamp);
+        processSample(id, raw, sensor_data, dt, mpu9250->_sampleClock.timeMicros());
+    }
 
+    // time_us is the sample time sent with the output, see PACKED_SAMPLE_SIZE
+    void processSample(uint8_t id, int16_t* raw, float* sensor_data, float dt, uint32_t time_us){
+        MPU9250* mpu9250 = _sensors->get(id);
+        SensorState& state = _states[id];
+        if (mpu9250->_blackBox) mpu9250->_blackBox->add(raw, sensor_data, dt);
+        updateFilter(mpu9250, state, sensor_data, dt);
+
+        // Every sample is fused, output goes at the lower transmit rate through anti alias decimator
+        int16_t decimated[MPU9250::RAW_DATA_SIZE];
+        if (state._decimator.add(raw, &decimated[0])){
+            if (_streamFormat == STREAM_PACKED) {
+                packSample(id, decimated, time_us);
+                return;
+            }
+            float output[SENSOR_DATA_SIZE];
+            if (_sendThre > 1) mpu9250->scaleOutput(decimated, output);
+            else memcpy(output, sensor_data, MPU9250::RAW_DATA_SIZE * sizeof(float));
+            output[10] = state._q[0];
+            output[11] = state._q[1];
+            output[12] = state._q[2];
+            output[13] = state._q[3];
+            memcpy(&output[14], &time_us, sizeof(time_us));
+            bufWriteStart(FLOAT_DATA_LEN);
+            bufWrite(output, SENSOR_DATA_SIZE * sizeof(float));
+            bufWrite(id);
+            bufSend();
+        }
+    }
+
+    void updateFilter(MPU9250* mpu9250, SensorState& state, float* sensor_data, float dt){
+        PROFILE_SCOPE(STAGE_FILTER);
+        mpu9250->trackGyroBias(sensor_data, dt);
         // quaternion
-        auto dt = _timeCounter.update();
-        switch (_mpu9250->_algorythm){
+        // 9-DOF while magnetometer sample is valid, 6-DOF otherwise so gyro keeps being integrated
+        bool mag = mpu9250->_magValid;
+        switch (mpu9250->_algorythm){
             case MPU9250::MADGWICK :        
-                MadgwickQuaternionUpdate(sensor_data, _q, dt); break;
+                if (mag) MadgwickQuaternionUpdate(sensor_data, state._q, dt, mpu9250->_magFresh);
+                else MadgwickImuUpdate(sensor_data, state._q, dt);
+                break;
             case MPU9250::MAHONY :
-                MahonyQuaternionUpdate(sensor_data, _eInt, _q, dt); break;
-            case MPU9250::DMP :
-                
+                if (mag) MahonyQuaternionUpdate(sensor_data, state._eInt, state._q, dt, mpu9250->_magFresh);
+                else MahonyImuUpdate(sensor_data, state._eInt, state._q, dt);
+                break;
+            case MPU9250::MADGWICK_IMU :
+                MadgwickImuUpdate(sensor_data, state._q, dt); break;
+            case MPU9250::MAHONY_IMU :
+                MahonyImuUpdate(sensor_data, state._eInt, state._q, dt); break;
             case MPU9250::EKF :
-                
+                state._ekf.update(sensor_data, dt, mpu9250->_magFresh);
+                state._ekf.getQuaternion(state._q);
+                break;
+            case MPU9250::DMP :
+                if (mpu9250->_dmpReady) break; // quaternion is already taken from DMP
             case MPU9250::NONE :
-                _q[0] = 0;
-                _q[1] = 0;
-                _q[2] = 0;
-                _q[3] = 0;
+                state._q[0] = 0;
+                state._q[1] = 0;
+                state._q[2] = 0;
+                state._q[3] = 0;
                 break;
         }
-        _updateCounter = (_updateCounter + 1) % _sendThre;
-        if (_updateCounter == 0){
-            sensor_data[10] = _q[0]; 
-            sensor_data[11] = _q[1];
-            sensor_data[12] = _q[2];
-            sensor_data[13] = _q[3];
-            sensor_data[14] = 1/dt;
-            uint data_len = sizeof(sensor_data);
-            bufWriteStart(data_len);
-            bufWrite(sensor_data, data_len);
-            bufSend();
-        }
-        return true;
+    }
+
+    void sendPackedHeader(uint8_t id){
+        MPU9250* mpu9250 = _sensors->get(id);
+        bufWriteStart(PACKED_HEADER_LEN);
+        bufWrite(id);
+        bufWrite(&mpu9250->_accelScale, sizeof(float));
+        bufWrite(&mpu9250->_gyroScale, sizeof(float));
+        bufWrite(mpu9250->_mag._kernel, sizeof(mpu9250->_mag._kernel));
+        bufWrite(mpu9250->_mag._kernelOffset, sizeof(mpu9250->_mag._kernelOffset));
+        bufSend();
+    }
+
+    void packSample(uint8_t id, int16_t* raw, uint32_t time_us){
+        SensorState& state = _states[id];
+        uint8_t* sample = &state._packedData[1 + state._packedCount * PACKED_SAMPLE_SIZE];
+        memcpy(sample, raw, 9 * sizeof(int16_t));
+        uint16_t time16 = (uint16_t) time_us;
+        memcpy(sample + 9 * sizeof(int16_t), &time16, sizeof(time16));
+        if (++state._packedCount < PACKED_SAMPLES_PER_PACKET) return;
+
+        state._packedData[0] = (id << PACKED_SEQ_BITS) | (state._packedSeq++ & PACKED_SEQ_MASK);
+        bufWriteStart(PACKED_DATA_LEN);
+        bufWrite(state._packedData, PACKED_DATA_LEN);
+        bufSend();
+        state._packedCount = 0;
     }
 };
 
 class GenericStopCommand:public BaseCommand {
 public:
-    GenericStopCommand(MPU9250* mpu9250, byte* buffer):BaseCommand(mpu9250, buffer){};
+    GenericStopCommand(SensorArray* sensors, Transport* transport, byte* buffer):BaseCommand(sensors, transport, buffer){};
     ~GenericStopCommand(){}
 
     void setup(){
@@ -171,86 +487,441 @@ public:
     }
 };
 
+// Calibration runs as a background task on magnetometer samples of the normal data path, so it can go on while
+// sensors stream. Without streaming the command reads every accel/gyro sample itself, once per data ready or output
+// data rate period: SLV0 clears magnetometer DRDY each sample cycle (see readMagData()), so a slower poll would
+// miss magnetometer samples. A stream reads them all, so the command doesn't read in between.
+// Progress packets: uint16 samples, uint8 covered bins, uint8 total bins, uint32 coverage mask, int16 min[3], max[3].
+// Final packet: float bias[3], soft iron matrix[9] (row major), uint8 covered bins, uint8 1 if ellipsoid fit was used.
 class CalibrateMagnetometerCommand:public BaseCommand {
 public:
-    CalibrateMagnetometerCommand(MPU9250* mpu9250, byte* buffer):BaseCommand(mpu9250, buffer){};
-    ~CalibrateMagnetometerCommand(){}
+    static const uint PROGRESS_LEN = sizeof(uint16_t) + 2 + sizeof(uint32_t) + 6 * sizeof(int16_t);
+    static const uint16_t PROGRESS_PERIOD = 25;     // new samples between progress packets
+
+    uint16_t _reported;
+    unsigned long _lastPoll;    // micros() of the last sample read by the command
+
+    CalibrateMagnetometerCommand(SensorArray* sensors, Transport* transport, byte* buffer)
+        :BaseCommand(sensors, transport, buffer), _reported(0), _lastPoll(0){};
+    ~CalibrateMagnetometerCommand(){
+        _mpu9250->_magCalibrator.stop();
+    }
+
+    static bool exclusive(byte* data){
+        return false;
+    }
 
     void setup(){
-        _mpu9250->setup();
+        if (getDataLen()>0) selectSensor(_buffer[2]);
+        if (!_mpu9250->_initialized) _mpu9250->setup();
+        _mpu9250->_magCalibrator.start();
+        _lastPoll = micros();
     }
 
     bool exec() {
-        _mpu9250->AK8963calibrate(_mpu9250->_mag._magBias, _mpu9250->_mag._magScale);
-        uint bias_len = sizeof(_mpu9250->_mag._magBias), scale_len = sizeof(_mpu9250->_mag._magScale);
-        bufWriteStart(bias_len + scale_len, 1);
-        bufWrite(_mpu9250->_mag._magBias, bias_len);
-        bufWrite(_mpu9250->_mag._magScale, scale_len);
-        bufSend();
-        return false;
+        MagCalibrator& calibrator = _mpu9250->_magCalibrator;
+        if (pollDue()) {
+            float sensor_data[StartSensorsCommand::SENSOR_DATA_SIZE];
+            _mpu9250->readData(&sensor_data[0]);
+        }
+
+        if (calibrator.done()) {
+            float bias[3], softIron[3][3];
+            bool fitted = calibrator.finish(_mpu9250->_mag._magCalibration, &bias[0], softIron);
+            _mpu9250->_mag.setCorrection(&bias[0], softIron);
+            _mpu9250->saveCalibration();
+            bufWriteStart(sizeof(bias) + sizeof(softIron) + 2, 1);
+            bufWrite(&bias[0], sizeof(bias));
+            bufWrite(softIron, sizeof(softIron));
+            bufWrite(calibrator.coverageCount());
+            bufWrite(fitted);
+            bufSend();
+            return false;
+        }
+
+        if (calibrator._samples >= _reported + PROGRESS_PERIOD) {
+            _reported = calibrator._samples;
+            bufWriteStart(PROGRESS_LEN);
+            bufWrite(&calibrator._samples, sizeof(calibrator._samples));
+            bufWrite(calibrator.coverageCount());
+            bufWrite(MagCalibrator::COVERAGE_BINS);
+            bufWrite(&calibrator._coverage, sizeof(calibrator._coverage));
+            bufWrite(calibrator._min, sizeof(calibrator._min));
+            bufWrite(calibrator._max, sizeof(calibrator._max));
+            bufSend();
+        }
+        return true;
+    }
+
+    bool pollDue(){
+        if (_mpu9250->_streaming) return false;
+        unsigned long now = micros();
+        float rate = _mpu9250->outputDataRate();
+        if ((rate > 0) && (now - _lastPoll < (unsigned long)(1000000.0f / rate))) return false;
+        if (!_mpu9250->readInterrupt()) return false;
+        _lastPoll = now;
+        return true;
     }
 };
 
+// Response: one message of uint8 start address (0) and the registers from there
 class ReadRegistersCommand:public BaseCommand {
 public:
-    ReadRegistersCommand(MPU9250* mpu9250, byte* buffer):BaseCommand(mpu9250, buffer){};
+    byte _regs[1 + MPU9250::REGISTER_MAP_SIZE];
+
+    ReadRegistersCommand(SensorArray* sensors, Transport* transport, byte* buffer):BaseCommand(sensors, transport, buffer){};
     ~ReadRegistersCommand(){}
 
+    // Plain register dump can run while sensors stream, re-running sensor setup can't
+    static bool exclusive(byte* data){
+        return (getDataLen(data)>0) && data[2];
+    }
+
     void setup(){
         uint data_len = getDataLen();
+        if (data_len>1) selectSensor(_buffer[3]);
         if ((data_len>0) && _buffer[2])
             _mpu9250->setup();
+        _regs[0] = 0x00;
+        _mpu9250->dumpRegisters(&_regs[1]);    // INT_STATUS and FIFO_R_W read as 0, a stream may be running
+        bufPrint(&_regs[1], sizeof(_regs) - 1);
+        messageStart(_regs, sizeof(_regs));
+    }
+
+    bool exec() {
+        return !messageSend();
+    }
+};
+
+class SetupCommand:public BaseCommand {
+public:
+    SetupCommand(SensorArray* sensors, Transport* transport, byte* buffer):BaseCommand(sensors, transport, buffer){};
+    ~SetupCommand(){}
+
+    void setup(){
     }
 
+    // Same configuration is applied to every sensor of the array
     bool exec() {
-        byte reg_data[127];
-        _mpu9250->readRegisters(0x00, sizeof(reg_data), reg_data);
-        delay(10);
-        bufPrint(reg_data, sizeof(reg_data));
-        uint startAddr = 0;
-        bufWriteStart(61);
-        bufWrite(startAddr);
-        bufWrite(reg_data, 60);
+        for (uint8_t id = 0; id < _sensors->count(); id++)
+            configure(_sensors->get(id));
+        bufWriteStart(0, 1);
         bufSend();
-        delay(10);
-        startAddr += 60;
-        bufWriteStart(61);
-        bufWrite(startAddr);
-        bufWrite(&reg_data[startAddr], 60);
+        return false;
+    }
+
+    void configure(MPU9250* mpu9250){
+        uint data_len = getDataLen();
+        if (data_len>=5){
+            mpu9250->setAlgorythm((MPU9250::Algorythm ) _buffer[2]);
+            mpu9250->setGyroRes  ((MPU9250::GyroRes   ) _buffer[3]);
+            mpu9250->setAccelRes ((MPU9250::AccelRes  ) _buffer[4]);
+            mpu9250->setGyroDLPF ((MPU9250::GyroDLPF  ) _buffer[5]);
+            mpu9250->setAccelDLPF((MPU9250::AccelDLPF ) _buffer[6]);
+        }
+        if (data_len>=6){
+            mpu9250->setFifoMode(_buffer[7]);
+        }
+        if ((data_len>=7) && _buffer[8]){
+            mpu9250->forgetCalibration();   // gyro offsets are measured again on next start
+        }
+        if (data_len>=9){
+            mpu9250->setOutputDataRate(_buffer[9] | ((uint16_t)_buffer[10] << 8));  // Hz, 0 = DLPF default
+        }
+    }
+};
+
+
+// Sample interval statistics of one sensor, query doesn't disturb streaming. Request: optional sensor id.
+// Response: uint8 sensor id, uint32 intervals, missed data ready events, ISR timestamp overflows,
+// then interval min, max, mean, and p50, p90, p99, max over the last JitterStats::WINDOW intervals, in us.
+class TimingStatsCommand:public BaseCommand {
+public:
+    static const uint RESPONSE_LEN = 1 + 10 * sizeof(uint32_t);
+    uint8_t _id;
+
+    TimingStatsCommand(SensorArray* sensors, Transport* transport, byte* buffer):BaseCommand(sensors, transport, buffer), _id(0) {};
+    ~TimingStatsCommand(){}
+
+    static bool exclusive(byte* data){
+        return false;
+    }
+
+    void setup(){
+        if (getDataLen() > 0) _id = _buffer[2];
+        selectSensor(_id);
+    }
+
+    bool exec() {
+        const JitterStats& jitter = _mpu9250->_sampleClock._jitter;
+        uint32_t values[10] = {
+            jitter._count, jitter._missed, _mpu9250->_stamps._overflows,
+            jitter._count ? jitter._min : 0, jitter._max, jitter.mean(),
+            jitter.percentile(50), jitter.percentile(90), jitter.percentile(99), jitter.percentile(100)
+        };
+        bufWriteStart(RESPONSE_LEN, 1);
+        bufWrite(_id);
+        bufWrite(&values[0], sizeof(values));
         bufSend();
-        delay(10);
-        startAddr += 60;
-        bufWriteStart(sizeof(reg_data)+1-startAddr, 1);
-        bufWrite(startAddr);
-        bufWrite(&reg_data[startAddr], sizeof(reg_data)-startAddr);
+        return false;
+    }
+};
+
+// Per stage cycle statistics of profiler(), one packet per stage, final packet is the last stage.
+// Request: optional byte, non zero resets statistics once they are sent.
+// Response: uint8 stage, uint32 ticks per second, uint32 count, min, max, mean ticks, uint16 histogram[20]
+// (see StageStats).
+class StatsCommand:public BaseCommand {
+public:
+    static const uint RESPONSE_LEN = 1 + 5 * sizeof(uint32_t) + StageStats::HIST_BINS * sizeof(uint16_t);
+    bool _reset;
+    uint8_t _stage;
+
+    StatsCommand(SensorArray* sensors, Transport* transport, byte* buffer):BaseCommand(sensors, transport, buffer), _reset(false), _stage(0) {};
+    ~StatsCommand(){}
+
+    static bool exclusive(byte* data){
+        return false;
+    }
+
+    void setup(){
+        _reset = (getDataLen() > 0) && _buffer[2];
+    }
+
+    bool exec() {
+        const StageStats& stats = profiler()._stages[_stage];
+        uint32_t values[5] = {TICKS_PER_SECOND, stats._count, stats._count ? stats._min : 0, stats._max, stats.mean()};
+        bool final_packet = (_stage == STAGE_COUNT - 1);
+        bufWriteStart(RESPONSE_LEN, final_packet);
+        bufWrite(_stage);
+        bufWrite(&values[0], sizeof(values));
+        bufWrite((void*) stats._hist, sizeof(stats._hist));
         bufSend();
-        delay(10);
+        if (!final_packet) {
+            _stage++;
+            return true;
+        }
+        if (_reset) profiler().reset();
         return false;
     }
 };
 
-class SetupCommand:public BaseCommand {
+// Packet counters of the transport commands send through (see txqueue.h). Request: optional byte, non zero resets
+// counters once they are sent. Response: uint32 packets sent, dropped, uint8 queued, queue capacity, most queued.
+class LinkStatsCommand:public BaseCommand {
 public:
-    SetupCommand(MPU9250* mpu9250, byte* buffer):BaseCommand(mpu9250, buffer){};
-    ~SetupCommand(){}
+    static const uint RESPONSE_LEN = 2 * sizeof(uint32_t) + 3;
+    bool _reset;
+
+    LinkStatsCommand(SensorArray* sensors, Transport* transport, byte* buffer):BaseCommand(sensors, transport, buffer), _reset(false) {};
+    ~LinkStatsCommand(){}
+
+    static bool exclusive(byte* data){
+        return false;
+    }
 
     void setup(){
+        _reset = (getDataLen() > 0) && _buffer[2];
     }
 
     bool exec() {
+        uint32_t counters[2] = {_transport->_sent, _transport->_dropped};
+        bufWriteStart(RESPONSE_LEN, 1);
+        bufWrite(&counters[0], sizeof(counters));
+        bufWrite(_transport->queued());
+        bufWrite(_transport->capacity());
+        bufWrite(_transport->highWater());
+        bufSend();
+        if (_reset) _transport->resetCounters();
+        return false;
+    }
+};
+
+// Arms, triggers or queries the black box of a sensor (see blackbox.h) and uploads every frozen window while
+// sensors keep streaming. Request: uint8 action, sensor id, for BB_ARM also float accel limit m/s^2, float gyro
+// limit rad/s (0 = off) and uint16 post trigger samples.
+// Every request is answered with status. While the box records, the command keeps running (a new request replaces
+// it and takes over): a frozen window goes out as one message (see framing.h) of status, header (as in packed
+// stream) and the window as packed stream samples, then the box is armed again once the host acknowledged the
+// message. Without acknowledgement the command ends and the window stays frozen until a new request uploads it.
+// Status: uint8 sensor id, state, cause, uint16 window samples, capacity, trigger index, final when command ends.
+class BlackBoxCommand:public BaseCommand {
+public:
+    enum Action
+    {
+        BB_STATUS,
+        BB_ARM,
+        BB_TRIGGER,
+        BB_DISARM
+    };
+
+    static const uint STATUS_LEN = 3 + 3 * sizeof(uint16_t);
+    static const uint HEADER_LEN = 1 + 14 * sizeof(float);
+    uint8_t _id;
+    bool _answered;
+    bool _watch;
+    bool _uploading;
+    uint8_t _prefix[STATUS_LEN + HEADER_LEN];   // of the upload message, samples are read from the box
+
+    BlackBoxCommand(SensorArray* sensors, Transport* transport, byte* buffer)
+        :BaseCommand(sensors, transport, buffer), _id(0), _answered(false), _watch(false), _uploading(false) {};
+    ~BlackBoxCommand(){}
+
+    static bool exclusive(byte* data){
+        return false;
+    }
+
+    void setup(){
         uint data_len = getDataLen();
-        if (data_len==5){
-            _mpu9250->setAlgorythm((MPU9250::Algorythm ) _buffer[2]);
-            _mpu9250->setGyroRes  ((MPU9250::GyroRes   ) _buffer[3]);
-            _mpu9250->setAccelRes ((MPU9250::AccelRes  ) _buffer[4]);
-            _mpu9250->setGyroDLPF ((MPU9250::GyroDLPF  ) _buffer[5]);
-            _mpu9250->setAccelDLPF((MPU9250::AccelDLPF ) _buffer[6]);
+        uint8_t action = (data_len > 0) ? _buffer[2] : BB_STATUS;
+        if (data_len > 1) _id = _buffer[3];
+        selectSensor(_id);
+        BlackBox* box = _mpu9250->_blackBox;
+        if (!box) {
+            Serial.print(F("No black box attached to sensor: "));
+            Serial.println(_id);
+            return;
         }
-        bufWriteStart(0, 1);
+        switch (action){
+            case BB_ARM : {
+                float accelLimit = 0, gyroLimit = 0;
+                uint16_t postTrigger = 0;
+                if (data_len >= 12) {
+                    memcpy(&accelLimit, &_buffer[4], sizeof(float));
+                    memcpy(&gyroLimit, &_buffer[8], sizeof(float));
+                    memcpy(&postTrigger, &_buffer[12], sizeof(uint16_t));
+                }
+                box->arm(accelLimit, gyroLimit, postTrigger);
+                break;
+            }
+            case BB_TRIGGER :
+                box->trigger(BlackBox::CAUSE_HOST);
+                break;
+            case BB_DISARM :
+                box->disarm();
+                break;
+        }
+        _watch = (box->_state != BlackBox::IDLE);
+    }
+
+    bool exec() {
+        BlackBox* box = _mpu9250->_blackBox;
+        if (!_answered) {
+            _answered = true;
+            writeStatus(box, &_prefix[0]);
+            bufWriteStart(STATUS_LEN, !_watch);
+            bufWrite(&_prefix[0], STATUS_LEN);
+            bufSend();
+            return _watch;
+        }
+        if (box->_state != BlackBox::FROZEN) return true;
+
+        if (!_uploading) {
+            _uploading = true;
+            writeStatus(box, &_prefix[0]);
+            writeHeader(&_prefix[STATUS_LEN]);
+            messageStart(nullptr, sizeof(_prefix) + box->_count * sizeof(BlackBox::Sample), false);
+        }
+        if (!messageSend()) return true;
+        _uploading = false;
+        if (_messageAcked) box->release();    // else the window stays frozen for the next request
+        return _messageAcked;
+    }
+
+    void messageRead(uint16_t offset, uint8_t* dest, uint16_t count){
+        for (; (count > 0) && (offset < sizeof(_prefix)); count--) *dest++ = _prefix[offset++];
+        BlackBox* box = _mpu9250->_blackBox;
+        offset -= sizeof(_prefix);
+        while (count > 0) {
+            const uint8_t* sample = (const uint8_t*) &box->at(offset / sizeof(BlackBox::Sample));
+            uint8_t pos = offset % sizeof(BlackBox::Sample);
+            uint8_t n = sizeof(BlackBox::Sample) - pos;
+            if (n > count) n = count;
+            memcpy(dest, sample + pos, n);
+            dest += n;
+            offset += n;
+            count -= n;
+        }
+    }
+
+    void writeStatus(BlackBox* box, uint8_t* dest){
+        uint16_t values[3] = {0, 0, 0};
+        dest[0] = _id;
+        dest[1] = BlackBox::IDLE;
+        dest[2] = BlackBox::CAUSE_NONE;
+        if (box) {
+            dest[1] = box->_state;
+            dest[2] = box->_cause;
+            values[0] = box->_count;
+            values[1] = box->_capacity;
+            values[2] = (box->_state >= BlackBox::TRIGGERED) ? box->triggerIndex() : 0;
+        }
+        memcpy(&dest[3], &values[0], sizeof(values));
+    }
+
+    void writeHeader(uint8_t* dest){
+        dest[0] = _id;
+        memcpy(&dest[1], &_mpu9250->_accelScale, sizeof(float));
+        memcpy(&dest[1 + sizeof(float)], &_mpu9250->_gyroScale, sizeof(float));
+        memcpy(&dest[1 + 2 * sizeof(float)], _mpu9250->_mag._kernel, sizeof(_mpu9250->_mag._kernel));
+        memcpy(&dest[1 + 11 * sizeof(float)], _mpu9250->_mag._kernelOffset, sizeof(_mpu9250->_mag._kernelOffset));
+    }
+};
+
+// Calibration record of a sensor (see calibstore.h) to and from host. Request: uint8 sensor id, optionally followed
+// by a record, which needs a fragmented request (see framing.h).
+// Without record the response is a message of uint8 sensor id and the sealed current record. A valid record is
+// restored and saved, settings take effect with the next setup(), response is uint8 sensor id and uint8 1 if taken.
+class CalibrationCommand:public BaseCommand {
+public:
+    uint8_t _id;
+    bool _upload;
+    bool _taken;
+    uint8_t _response[1 + sizeof(CalibrationRecord)];
+
+    CalibrationCommand(SensorArray* sensors, Transport* transport, byte* buffer)
+        :BaseCommand(sensors, transport, buffer), _id(0), _upload(false), _taken(false) {};
+    ~CalibrationCommand(){}
+
+    // Uploaded record changes sensor settings, which streaming can't follow
+    static bool exclusive(byte* data){
+        return getDataLen(data) > 1;
+    }
+
+    void setup(){
+        uint data_len = getDataLen();
+        if (data_len > 0) _id = _buffer[2];
+        selectSensor(_id);
+        _upload = (data_len > 1);
+        if (_upload) {
+            CalibrationRecord record;
+            if (data_len >= 1 + sizeof(record)) memcpy(&record, &_buffer[3], sizeof(record));
+            _taken = (data_len >= 1 + sizeof(record)) && record.valid();
+            if (!_taken) {
+                Serial.println(F("Invalid calibration record received"));
+                return;
+            }
+            _mpu9250->restoreCalibration(record);
+            _mpu9250->saveCalibration();
+            return;
+        }
+        CalibrationRecord record;
+        memset(&record, 0, sizeof(record));
+        _mpu9250->captureCalibration(record);
+        record.seal();
+        _response[0] = _id;
+        memcpy(&_response[1], &record, sizeof(record));
+        messageStart(_response, sizeof(_response));
+    }
+
+    bool exec() {
+        if (!_upload) return !messageSend();
+        bufWriteStart(2, 1);
+        bufWrite(_id);
+        bufWrite((byte) _taken);
         bufSend();
         return false;
     }
 };
 
-
 #endif
\ No newline at end of file
@@ -0,0 +1,71 @@
+#ifndef DECIMATOR_h
+#define DECIMATOR_h
+
+#include <stdint.h>
+
+// CIC decimator for int16 channels: ORDER integrators run at input rate, ORDER combs at output rate, output is
+// normalized by factor^ORDER, so it is a (repeated) moving average taken every factor-th sample. Nulls of the
+// response sit at multiples of the output rate, which is where aliases would fold to DC. Integer state wraps
+// modulo 2^32, the comb differences come out exact as long as 16 + ORDER * log2(factor) <= 32 bits,
+// setFactor() rejects factors beyond that. First ORDER - 1 outputs after reset() are still settling.
+template <uint8_t CHANNELS, uint8_t ORDER = 2>
+class CicDecimator {
+public:
+    static const uint32_t MAX_FACTOR = ((uint32_t)1 << (16 / ORDER)) - 1;
+
+    uint32_t _integrators[ORDER][CHANNELS];
+    uint32_t _delays[ORDER][CHANNELS];  // previous input of each comb
+    uint16_t _factor;
+    uint16_t _phase;
+    int32_t _gain;
+
+    CicDecimator(){
+        setFactor(1);
+    }
+
+    // Returns false and keeps the current factor if factor is outside 1..MAX_FACTOR
+    bool setFactor(uint16_t factor){
+        if ((factor < 1) || (factor > MAX_FACTOR)) return false;
+        _factor = factor;
+        _gain = 1;
+        for (uint8_t i = 0; i < ORDER; i++) _gain *= factor;
+        reset();
+        return true;
+    }
+
+    void reset(){
+        for (uint8_t i = 0; i < ORDER; i++)
+            for (uint8_t c = 0; c < CHANNELS; c++){
+                _integrators[i][c] = 0;
+                _delays[i][c] = 0;
+            }
+        _phase = 0;
+    }
+
+    // Returns true when out got a new output sample
+    bool add(const int16_t* in, int16_t* out){
+        for (uint8_t c = 0; c < CHANNELS; c++){
+            uint32_t v = (uint32_t)(int32_t) in[c];
+            for (uint8_t i = 0; i < ORDER; i++){
+                _integrators[i][c] += v;
+                v = _integrators[i][c];
+            }
+        }
+        if (++_phase < _factor) return false;
+        _phase = 0;
+
+        for (uint8_t c = 0; c < CHANNELS; c++){
+            uint32_t v = _integrators[ORDER - 1][c];
+            for (uint8_t i = 0; i < ORDER; i++){
+                uint32_t prev = _delays[i][c];
+                _delays[i][c] = v;
+                v -= prev;
+            }
+            int32_t sum = (int32_t) v;
+            out[c] = (sum >= 0) ? (sum + _gain / 2) / _gain : -((-sum + _gain / 2) / _gain);
+        }
+        return true;
+    }
+};
+
+#endif
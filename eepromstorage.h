@@ -0,0 +1,28 @@
+#ifndef EEPROMStorage_h
+#define EEPROMStorage_h
+
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "storage.h"
+
+// Teensy EEPROM (2 KB on Teensy 3.2). Only bytes which differ are written, to spare erase cycles.
+class EEPROMStorage : public Storage {
+public:
+    uint16_t size(){
+        return EEPROM.length();
+    }
+
+    void read(uint16_t address, uint8_t* dest, uint16_t count){
+        for (uint16_t i = 0; i < count; i++)
+            dest[i] = EEPROM.read(address + i);
+    }
+
+    bool write(uint16_t address, const uint8_t* data, uint16_t count){
+        if ((uint32_t)address + count > size()) return false;
+        for (uint16_t i = 0; i < count; i++)
+            EEPROM.update(address + i, data[i]);
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef EKF_h
+#define EKF_h
+
+#include "matrix.h"
+#include "fixed.h"
+
+const float ekfGyroNoise  = 0.01f;   // rad/s, gyro measurement noise
+const float ekfBiasNoise  = 0.0001f; // rad/s per sqrt(s), gyro bias random walk
+const float ekfAccelNoise = 0.05f;   // normalised accelerometer noise
+const float ekfMagNoise   = 0.1f;    // normalised magnetometer noise
+const float ekfMinHorizontalField = 0.1f;   // normalised, heading isn't corrected closer to magnetic poles
+
+// Quaternion extended Kalman filter which also estimates gyro bias.
+// State: q0, q1, q2, q3, gyro bias x, y, z (rad/s).
+// Measurements (normalised gravity direction and magnetic heading) are applied one by one
+// as scalar updates, so no matrix inversion is needed and covariance stays in symmetric storage.
+template <typename T = float>
+class QuaternionEKF {
+public:
+    static const uint8_t N = 7;
+    T _x[N];
+    SymMatrix<N, T> _P;
+
+    QuaternionEKF(){
+        const T q[4] = {1.0f, 0.0f, 0.0f, 0.0f};
+        reset(q);
+    }
+
+    void reset(const T* q){
+        for (uint8_t i = 0; i < 4; i++) _x[i] = q[i];
+        for (uint8_t i = 4; i < N; i++) _x[i] = 0.0f;
+        _P.setDiagonal(0.01f);
+        for (uint8_t i = 4; i < N; i++) _P(i, i) = 0.0001f;
+    }
+
+    void getQuaternion(T* q) const {
+        for (uint8_t i = 0; i < 4; i++) q[i] = _x[i];
+    }
+
+    void update(T* sensor_data, T deltat, bool magFresh = true){
+        predict(sensor_data[3], sensor_data[4], sensor_data[5], deltat);
+        correct(sensor_data, magFresh);
+    }
+
+    void predict(T gx, T gy, T gz, T deltat){
+        T q0 = _x[0], q1 = _x[1], q2 = _x[2], q3 = _x[3];
+        T wx = gx - _x[4], wy = gy - _x[5], wz = gz - _x[6];
+        T hdt = 0.5f * deltat;
+
+        // Integrate rate of change of quaternion
+        _x[0] = q0 + (-q1 * wx - q2 * wy - q3 * wz) * hdt;
+        _x[1] = q1 + (q0 * wx + q2 * wz - q3 * wy) * hdt;
+        _x[2] = q2 + (q0 * wy - q1 * wz + q3 * wx) * hdt;
+        _x[3] = q3 + (q0 * wz + q1 * wy - q2 * wx) * hdt;
+        normalize();
+
+        // State transition Jacobian
+        Matrix<N, N, T> J = Matrix<N, N, T>::identity();
+        J(0, 1) = -wx * hdt; J(0, 2) = -wy * hdt; J(0, 3) = -wz * hdt;
+        J(1, 0) =  wx * hdt; J(1, 2) =  wz * hdt; J(1, 3) = -wy * hdt;
+        J(2, 0) =  wy * hdt; J(2, 1) = -wz * hdt; J(2, 3) =  wx * hdt;
+        J(3, 0) =  wz * hdt; J(3, 1) =  wy * hdt; J(3, 2) = -wx * hdt;
+        J(0, 4) =  q1 * hdt; J(0, 5) =  q2 * hdt; J(0, 6) =  q3 * hdt;
+        J(1, 4) = -q0 * hdt; J(1, 5) =  q3 * hdt; J(1, 6) = -q2 * hdt;
+        J(2, 4) = -q3 * hdt; J(2, 5) = -q0 * hdt; J(2, 6) =  q1 * hdt;
+        J(3, 4) =  q2 * hdt; J(3, 5) = -q1 * hdt; J(3, 6) = -q0 * hdt;
+        _P.transform(J);
+
+        T qNoise = ekfGyroNoise * ekfGyroNoise * hdt * hdt;
+        T bNoise = ekfBiasNoise * ekfBiasNoise * deltat;
+        for (uint8_t i = 0; i < 4; i++) _P(i, i) += qNoise;
+        for (uint8_t i = 4; i < N; i++) _P(i, i) += bNoise;
+    }
+
+    // Without magFresh sensor_data[6..8] hold an older magnetometer sample, only gravity is corrected
+    void correct(T* sensor_data, bool magFresh = true){
+        T ax = sensor_data[0], ay = sensor_data[1], az = sensor_data[2];
+        T mx = sensor_data[6], my = sensor_data[7], mz = sensor_data[8];
+        T q0 = _x[0], q1 = _x[1], q2 = _x[2], q3 = _x[3];
+        T norm;
+
+        // Normalise accelerometer measurement
+        norm = scalarSqrt(ax * ax + ay * ay + az * az);
+        if (norm == 0.0f) return; // handle NaN
+        norm = 1.0f / norm;
+        ax *= norm;
+        ay *= norm;
+        az *= norm;
+
+        // Gravity direction predicted from the prior estimate and its Jacobian rows
+        T vx = 2.0f * (q1 * q3 - q0 * q2);
+        T vy = 2.0f * (q0 * q1 + q2 * q3);
+        T vz = q0 * q0 - q1 * q1 - q2 * q2 + q3 * q3;
+        T Hv[3][4] = {
+            {-2.0f * q2,  2.0f * q3, -2.0f * q0, 2.0f * q1},
+            { 2.0f * q1,  2.0f * q0,  2.0f * q3, 2.0f * q2},
+            { 2.0f * q0, -2.0f * q1, -2.0f * q2, 2.0f * q3}
+        };
+
+        T rAccel = ekfAccelNoise * ekfAccelNoise;
+        scalarUpdate(Hv[0], ax - vx, rAccel);
+        scalarUpdate(Hv[1], ay - vy, rAccel);
+        scalarUpdate(Hv[2], az - vz, rAccel);
+
+        // Magnetometer corrects heading only: the field rotated to the earth frame must point north (+x) in the
+        // horizontal plane. Its vertical part and magnitude aren't measured, so a field distorted by residual
+        // hard or soft iron doesn't pull the tilt away from gravity and the difference into the gyro bias.
+        // An invalid measurement only skips the heading correction.
+        norm = magFresh ? scalarSqrt(mx * mx + my * my + mz * mz) : 0.0f;
+        if (!(norm == 0.0f)) {
+            norm = 1.0f / norm;
+            mx *= norm;
+            my *= norm;
+            mz *= norm;
+            normalize();
+            q0 = _x[0]; q1 = _x[1]; q2 = _x[2]; q3 = _x[3];
+            T hx = 2.0f * mx * (0.5f - q2 * q2 - q3 * q3) + 2.0f * my * (q1 * q2 - q0 * q3) + 2.0f * mz * (q1 * q3 + q0 * q2);
+            T hy = 2.0f * mx * (q1 * q2 + q0 * q3) + 2.0f * my * (0.5f - q1 * q1 - q3 * q3) + 2.0f * mz * (q2 * q3 - q0 * q1);
+            T h2 = hx * hx + hy * hy;
+            if (h2 > ekfMinHorizontalField * ekfMinHorizontalField) {
+                // heading = atan2(hy, hx), d heading = (hx * d hy - hy * d hx) / h2
+                T dhx[4] = {-2.0f * my * q3 + 2.0f * mz * q2,  2.0f * my * q2 + 2.0f * mz * q3,
+                            -4.0f * mx * q2 + 2.0f * my * q1 + 2.0f * mz * q0, -4.0f * mx * q3 - 2.0f * my * q0 + 2.0f * mz * q1};
+                T dhy[4] = { 2.0f * mx * q3 - 2.0f * mz * q1,  2.0f * mx * q2 - 4.0f * my * q1 - 2.0f * mz * q0,
+                             2.0f * mx * q1 + 2.0f * mz * q3,  2.0f * mx * q0 - 4.0f * my * q3 + 2.0f * mz * q2};
+                T H[4];
+                for (uint8_t j = 0; j < 4; j++) H[j] = (hx * dhy[j] - hy * dhx[j]) / h2;
+                scalarUpdate(H, -atan2(hy, hx), ekfMagNoise * ekfMagNoise / h2);
+            }
+        }
+        normalize();
+    }
+
+    // Kalman update for one measurement with Jacobian row h (non-zero for quaternion states only)
+    void scalarUpdate(const T* h, T residual, T r){
+        T PHt[N];
+        for (uint8_t i = 0; i < N; i++){
+            T sum = 0.0f;
+            for (uint8_t j = 0; j < 4; j++)
+                sum += _P(i, j) * h[j];
+            PHt[i] = sum;
+        }
+        T S = r;
+        for (uint8_t j = 0; j < 4; j++)
+            S += h[j] * PHt[j];
+        T invS = 1.0f / S;
+        for (uint8_t i = 0; i < N; i++){
+            T K = PHt[i] * invS;
+            _x[i] += K * residual;
+            for (uint8_t j = 0; j <= i; j++)
+                _P(i, j) -= K * PHt[j];
+        }
+    }
+
+    void normalize(){
+        T norm = scalarSqrt(_x[0] * _x[0] + _x[1] * _x[1] + _x[2] * _x[2] + _x[3] * _x[3]);
+        norm = 1.0f / norm;
+        for (uint8_t i = 0; i < 4; i++) _x[i] *= norm;
+    }
+};
+
+#endif
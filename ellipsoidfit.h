@@ -0,0 +1,160 @@
+#ifndef ELLIPSOIDFIT_h
+#define ELLIPSOIDFIT_h
+
+#include "matrix.h"
+#include "fixed.h"
+
+// Recursive least squares fit of a general ellipsoid
+//   a x^2 + b y^2 + c z^2 + 2d xy + 2e xz + 2f yz + 2g x + 2h y + 2i z = 1
+// to magnetometer samples, one sample at a time with constant memory (9 parameters, 9x9 covariance).
+// solve() turns the ellipsoid into hard iron offset and a symmetric soft iron matrix which maps it onto a sphere,
+// so cross axis soft iron is corrected as well.
+template <typename T = float>
+class EllipsoidFit {
+public:
+    static const uint8_t N = 9;
+    static constexpr float INPUT_SCALE = 1.0f / 64.0f;  // keeps uT samples near unit range for float precision
+    static constexpr float RESIDUAL_RATE = 0.02f;       // smoothing of residual mean square
+
+    T _theta[N];
+    SymMatrix<N, T> _P;
+    T _residual;        // smoothed mean square of a priori fit error, ~0 once samples lie on the fitted surface
+    uint16_t _samples;
+
+    EllipsoidFit(){
+        reset();
+    }
+
+    void reset(){
+        for (uint8_t i = 0; i < N; i++) _theta[i] = 0.0f;
+        _P.setDiagonal(1000.0f);
+        _residual = 1.0f;
+        _samples = 0;
+    }
+
+    // Sample in uT
+    void addSample(const T* m){
+        T x = m[0] * INPUT_SCALE, y = m[1] * INPUT_SCALE, z = m[2] * INPUT_SCALE;
+        T phi[N] = {x * x, y * y, z * z, 2.0f * x * y, 2.0f * x * z, 2.0f * y * z, 2.0f * x, 2.0f * y, 2.0f * z};
+
+        T Pphi[N];
+        T error = 1.0f, S = 1.0f;
+        for (uint8_t i = 0; i < N; i++){
+            T sum = 0.0f;
+            for (uint8_t j = 0; j < N; j++)
+                sum += _P(i, j) * phi[j];
+            Pphi[i] = sum;
+            error -= phi[i] * _theta[i];
+        }
+        for (uint8_t i = 0; i < N; i++)
+            S += phi[i] * Pphi[i];
+
+        T invS = 1.0f / S;
+        for (uint8_t i = 0; i < N; i++){
+            T K = Pphi[i] * invS;
+            _theta[i] += K * error;
+            for (uint8_t j = 0; j <= i; j++)
+                _P(i, j) -= K * Pphi[j];
+        }
+        _residual += (error * error - _residual) * RESIDUAL_RATE;
+        _samples++;
+    }
+
+    // Correction is corrected = softIron * (m - bias), field magnitude is kept at the ellipsoid's mean radius.
+    // Returns false while the fitted quadric is not an ellipsoid.
+    bool solve(T* bias, T softIron[3][3]) const {
+        T A[3][3] = {
+            {_theta[0], _theta[3], _theta[4]},
+            {_theta[3], _theta[1], _theta[5]},
+            {_theta[4], _theta[5], _theta[2]}
+        };
+        T Ainv[3][3];
+        if (!inverse(A, Ainv)) return false;
+
+        // Center and ellipsoid (m - c)^T A (m - c) = k
+        T c[3];
+        for (uint8_t i = 0; i < 3; i++)
+            c[i] = -(Ainv[i][0] * _theta[6] + Ainv[i][1] * _theta[7] + Ainv[i][2] * _theta[8]);
+        T k = 1.0f;
+        for (uint8_t i = 0; i < 3; i++)
+            for (uint8_t j = 0; j < 3; j++)
+                k += c[i] * A[i][j] * c[j];
+        if (k == 0.0f) return false;     // origin on the surface, k < 0 when the hard iron offset puts it outside
+
+        T M[3][3];
+        for (uint8_t i = 0; i < 3; i++)
+            for (uint8_t j = 0; j < 3; j++)
+                M[i][j] = A[i][j] / k;
+
+        // softIron = sqrt(M) * radius, radius chosen so that the ellipsoid volume is preserved
+        T V[3][3], e[3];
+        eigenSym3(M, V, e);
+        if (!(e[0] > 0.0f) || !(e[1] > 0.0f) || !(e[2] > 0.0f)) return false;
+        T radius = 1.0f / scalarCbrt(scalarSqrt(e[0] * e[1] * e[2]));  // det(M)^(-1/6), geometric mean of semi-axes
+        for (uint8_t i = 0; i < 3; i++)
+            for (uint8_t j = 0; j < 3; j++){
+                T sum = 0.0f;
+                for (uint8_t l = 0; l < 3; l++)
+                    sum += V[i][l] * scalarSqrt(e[l]) * V[j][l];
+                softIron[i][j] = sum * radius;
+            }
+        for (uint8_t i = 0; i < 3; i++) bias[i] = c[i] / INPUT_SCALE;
+        return true;
+    }
+
+    static bool inverse(const T m[3][3], T inv[3][3]){
+        T det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+              - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+              + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+        if (det == 0.0f) return false;
+        T invDet = 1.0f / det;
+        inv[0][0] = (m[1][1] * m[2][2] - m[1][2] * m[2][1]) * invDet;
+        inv[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * invDet;
+        inv[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * invDet;
+        inv[1][0] = (m[1][2] * m[2][0] - m[1][0] * m[2][2]) * invDet;
+        inv[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * invDet;
+        inv[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * invDet;
+        inv[2][0] = (m[1][0] * m[2][1] - m[1][1] * m[2][0]) * invDet;
+        inv[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * invDet;
+        inv[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * invDet;
+        return true;
+    }
+
+    // Cyclic Jacobi eigen decomposition of symmetric 3x3 matrix: m = V diag(e) V^T, eigenvectors are columns of V
+    static void eigenSym3(const T m[3][3], T V[3][3], T* e){
+        T a[3][3];
+        for (uint8_t i = 0; i < 3; i++)
+            for (uint8_t j = 0; j < 3; j++){
+                a[i][j] = m[i][j];
+                V[i][j] = (i == j) ? 1.0f : 0.0f;
+            }
+        for (uint8_t sweep = 0; sweep < 10; sweep++){
+            for (uint8_t p = 0; p < 2; p++)
+                for (uint8_t q = p + 1; q < 3; q++){
+                    if (a[p][q] == 0.0f) continue;
+                    T theta = (a[q][q] - a[p][p]) / (2.0f * a[p][q]);
+                    T t = 1.0f / ((theta >= 0.0f ? theta : -theta) + scalarSqrt(theta * theta + 1.0f));
+                    if (theta < 0.0f) t = -t;
+                    T c = 1.0f / scalarSqrt(t * t + 1.0f), s = t * c;
+                    for (uint8_t k = 0; k < 3; k++){
+                        T akp = a[k][p], akq = a[k][q];
+                        a[k][p] = c * akp - s * akq;
+                        a[k][q] = s * akp + c * akq;
+                    }
+                    for (uint8_t k = 0; k < 3; k++){
+                        T apk = a[p][k], aqk = a[q][k];
+                        a[p][k] = c * apk - s * aqk;
+                        a[q][k] = s * apk + c * aqk;
+                    }
+                    for (uint8_t k = 0; k < 3; k++){
+                        T vkp = V[k][p], vkq = V[k][q];
+                        V[k][p] = c * vkp - s * vkq;
+                        V[k][q] = s * vkp + c * vkq;
+                    }
+                }
+        }
+        for (uint8_t i = 0; i < 3; i++) e[i] = a[i][i];
+    }
+};
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef FILEStorage_h
+#define FILEStorage_h
+
+#include <stdio.h>
+#include "storage.h"
+
+// Storage backed by a file, so calibration persistence can be exercised off-target.
+// Missing file, bytes past its end and anything that failed to read come back as erased.
+class FileStorage : public Storage {
+public:
+    const char* _path;
+    uint16_t _size;
+
+    FileStorage(const char* path, uint16_t size = 2048) : _path(path), _size(size) {};
+
+    uint16_t size(){
+        return _size;
+    }
+
+    void read(uint16_t address, uint8_t* dest, uint16_t count){
+        for (uint16_t i = 0; i < count; i++) dest[i] = 0xFF;
+        FILE* file = fopen(_path, "rb");
+        if (!file) return;
+        size_t got = 0;
+        if (fseek(file, address, SEEK_SET) == 0) got = fread(dest, 1, count, file);
+        if (ferror(file)) got = 0;
+        for (uint16_t i = got; i < count; i++) dest[i] = 0xFF;
+        fclose(file);
+    }
+
+    bool write(uint16_t address, const uint8_t* data, uint16_t count){
+        if ((uint32_t)address + count > _size) return false;
+        FILE* file = fopen(_path, "r+b");
+        if (!file) {
+            file = fopen(_path, "w+b");
+            if (!file) return false;
+        }
+        // file shorter than the storage, e.g. truncated, is padded with erased bytes up to the write
+        if (fseek(file, 0, SEEK_END) != 0) {
+            fclose(file);
+            return false;
+        }
+        for (long end = ftell(file); (end >= 0) && (end < address); end++) fputc(0xFF, file);
+        bool ok = (fseek(file, address, SEEK_SET) == 0) && (fwrite(data, 1, count, file) == count);
+        fclose(file);
+        return ok;
+    }
+};
+
+#endif
@@ -1,5 +1,16 @@
 #ifndef filters_h
 #define filters_h
+
+#include "fixed.h"
+
+// Magnetometer updates at 100 Hz only. Accel/gyro samples in between hold the last field, which the quaternion has
+// moved away from since, so filters take their IMU update for samples without fresh magnetometer data (magFresh).
+
+template <typename T>
+void MadgwickImuUpdate(T* sensor_data, T* q, T deltat);
+template <typename T>
+void MahonyImuUpdate(T* sensor_data, T* eInt, T* q, T deltat);
+
 const float beta = 0.41f;
 //const float deltat = 0.011;
 // Implementation of Sebastian Madgwick's "...efficient orientation filter for... inertial/magnetic sensor arrays"
@@ -8,9 +19,16 @@ const float beta = 0.41f;
 // device orientation -- which can be converted to yaw, pitch, and roll. Useful for stabilizing quadcopters, etc.
 // The performance of the orientation filter is at least as good as conventional Kalman-based filtering algorithms
 // but is much less computationally intensive---it can be performed on a 3.3 V Pro Mini operating at 8 MHz!
-void MadgwickQuaternionUpdate(float* sensor_data, float* q, float deltat)
+// Templated over scalar type: float, double or Fixed (see fixed.h).
+// Samples without fresh magnetometer data take MadgwickImuUpdate().
+template <typename T>
+void MadgwickQuaternionUpdate(T* sensor_data, T* q, T deltat, bool magFresh = true)
 {
-    float ax = sensor_data[0], 
+    if (!magFresh) {
+        MadgwickImuUpdate(sensor_data, q, deltat);
+        return;
+    }
+    T ax = sensor_data[0], 
     ay = sensor_data[1], 
     az = sensor_data[2], 
     gx = sensor_data[3], 
@@ -19,38 +37,38 @@ void MadgwickQuaternionUpdate(float* sensor_data, float* q, float deltat)
     mx = sensor_data[6], 
     my = sensor_data[7], 
     mz = sensor_data[8];
-    float q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];   // short name local variable for readability
-    float norm;
-    float hx, hy, _2bx, _2bz;
-    float s0, s1, s2, s3;
-    float qDot1, qDot2, qDot3, qDot4;
+    T q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];   // short name local variable for readability
+    T norm;
+    T hx, hy, _2bx, _2bz;
+    T s0, s1, s2, s3;
+    T qDot1, qDot2, qDot3, qDot4;
 
     // Auxiliary variables to avoid repeated arithmetic
-    float _2q0mx;
-    float _2q0my;
-    float _2q0mz;
-    float _2q1mx;
-    float _4bx;
-    float _4bz;
-    float _2q0 = 2.0f * q0;
-    float _2q1 = 2.0f * q1;
-    float _2q2 = 2.0f * q2;
-    float _2q3 = 2.0f * q3;
-    float _2q0q2 = 2.0f * q0 * q2;
-    float _2q2q3 = 2.0f * q2 * q3;
-    float q0q0 = q0 * q0;
-    float q0q1 = q0 * q1;
-    float q0q2 = q0 * q2;
-    float q0q3 = q0 * q3;
-    float q1q1 = q1 * q1;
-    float q1q2 = q1 * q2;
-    float q1q3 = q1 * q3;
-    float q2q2 = q2 * q2;
-    float q2q3 = q2 * q3;
-    float q3q3 = q3 * q3;
+    T _2q0mx;
+    T _2q0my;
+    T _2q0mz;
+    T _2q1mx;
+    T _4bx;
+    T _4bz;
+    T _2q0 = 2.0f * q0;
+    T _2q1 = 2.0f * q1;
+    T _2q2 = 2.0f * q2;
+    T _2q3 = 2.0f * q3;
+    T _2q0q2 = 2.0f * q0 * q2;
+    T _2q2q3 = 2.0f * q2 * q3;
+    T q0q0 = q0 * q0;
+    T q0q1 = q0 * q1;
+    T q0q2 = q0 * q2;
+    T q0q3 = q0 * q3;
+    T q1q1 = q1 * q1;
+    T q1q2 = q1 * q2;
+    T q1q3 = q1 * q3;
+    T q2q2 = q2 * q2;
+    T q2q3 = q2 * q3;
+    T q3q3 = q3 * q3;
 
     // Normalise accelerometer measurement
-    norm = sqrtf(ax * ax + ay * ay + az * az);
+    norm = scalarSqrt(ax * ax + ay * ay + az * az);
     if (norm == 0.0f) return; // handle NaN
     norm = 1.0f/norm;
     ax *= norm;
@@ -58,7 +76,7 @@ void MadgwickQuaternionUpdate(float* sensor_data, float* q, float deltat)
     az *= norm;
 
     // Normalise magnetometer measurement
-    norm = sqrtf(mx * mx + my * my + mz * mz);
+    norm = scalarSqrt(mx * mx + my * my + mz * mz);
     if (norm == 0.0f) return; // handle NaN
     norm = 1.0f/norm;
     mx *= norm;
@@ -72,7 +90,7 @@ void MadgwickQuaternionUpdate(float* sensor_data, float* q, float deltat)
     _2q1mx = 2.0f * q1 * mx;
     hx = mx * q0q0 - _2q0my * q3 + _2q0mz * q2 + mx * q1q1 + _2q1 * my * q2 + _2q1 * mz * q3 - mx * q2q2 - mx * q3q3;
     hy = _2q0mx * q3 + my * q0q0 - _2q0mz * q1 + _2q1mx * q2 - my * q1q1 + my * q2q2 + _2q2 * mz * q3 - my * q3q3;
-    _2bx = sqrtf(hx * hx + hy * hy);
+    _2bx = scalarSqrt(hx * hx + hy * hy);
     _2bz = -_2q0mx * q2 + _2q0my * q1 + mz * q0q0 + _2q1mx * q3 - mz * q1q1 + _2q2 * my * q3 - mz * q2q2 + mz * q3q3;
     _4bx = 2.0f * _2bx;
     _4bz = 2.0f * _2bz;
@@ -91,7 +109,7 @@ void MadgwickQuaternionUpdate(float* sensor_data, float* q, float deltat)
 //    s2 = -_2q0 * (2.0f * (q1q3 - q0q2) - ax) + _2q3 * (2.0f * (q0q1 + q2q3) - ay) - 4.0f * q2 * (1.0f - 2.0f * q1q1 - 2.0f * q2q2 - az) + (-_8bx * q2 - _4bz * q0) * (_4bx * (0.5f - q2q2 - q3q3) + _4bz * (q1q3 - q0q2) - mx) + (_4bx * q1 + _4bz * q3) * (_4bx * (q1q2 - q0q3) + _4bz * (q0q1 + q2q3) - my) + (_4bx * q0 - _8bz * q2) * (_4bx * (q0q2 + q1q3) + _4bz * (0.5f - q1q1 - q2q2) - mz);
 //    s3 = _2q1 * (2.0f * (q1q3 - q0q2) - ax) + _2q2 * (2.0f * (q0q1 + q2q3) - ay) + (-_8bx * q3 + _4bz * q1) * (_4bx * (0.5f - q2q2 - q3q3) + _4bz * (q1q3 - q0q2) - mx) + (-_4bx * q0 + _4bz * q2) * (_4bx * (q1q2 - q0q3) + _4bz * (q0q1 + q2q3) - my) + _4bx * q1 * (_4bx * (q0q2 + q1q3) + _4bz * (0.5f - q1q1 - q2q2) - mz);     
 
-    norm = sqrtf(s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3);    // normalise step magnitude
+    norm = scalarSqrt(s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3);    // normalise step magnitude
     norm = 1.0f/norm;
     s0 *= norm;
     s1 *= norm;
@@ -109,7 +127,78 @@ void MadgwickQuaternionUpdate(float* sensor_data, float* q, float deltat)
     q1 += qDot2 * deltat;
     q2 += qDot3 * deltat;
     q3 += qDot4 * deltat;
-    norm = sqrtf(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);    // normalise quaternion
+    norm = scalarSqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);    // normalise quaternion
+    norm = 1.0f/norm;
+    q[0] = q0 * norm;
+    q[1] = q1 * norm;
+    q[2] = q2 * norm;
+    q[3] = q3 * norm;
+}
+
+// Accelerometer and gyro only (6-DOF) variant of MadgwickQuaternionUpdate, same gradient without magnetometer
+// terms: heading drifts with gyro bias but tilt stays corrected. sensor_data[6..8] are not used.
+template <typename T>
+void MadgwickImuUpdate(T* sensor_data, T* q, T deltat)
+{
+    T ax = sensor_data[0], 
+    ay = sensor_data[1], 
+    az = sensor_data[2], 
+    gx = sensor_data[3], 
+    gy = sensor_data[4], 
+    gz = sensor_data[5];
+    T q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];   // short name local variable for readability
+    T norm;
+    T s0, s1, s2, s3;
+    T qDot1, qDot2, qDot3, qDot4;
+
+    // Auxiliary variables to avoid repeated arithmetic
+    T _2q0 = 2.0f * q0;
+    T _2q1 = 2.0f * q1;
+    T _2q2 = 2.0f * q2;
+    T _2q3 = 2.0f * q3;
+    T _2q0q2 = 2.0f * q0 * q2;
+    T _2q2q3 = 2.0f * q2 * q3;
+    T q0q1 = q0 * q1;
+    T q1q1 = q1 * q1;
+    T q1q3 = q1 * q3;
+    T q2q2 = q2 * q2;
+
+    // Rate of change of quaternion from gyroscope
+    qDot1 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+    qDot2 = 0.5f * (q0 * gx + q2 * gz - q3 * gy);
+    qDot3 = 0.5f * (q0 * gy - q1 * gz + q3 * gx);
+    qDot4 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
+
+    // Normalise accelerometer measurement, without one gyro is integrated alone
+    norm = scalarSqrt(ax * ax + ay * ay + az * az);
+    if (!(norm == 0.0f)) {
+        norm = 1.0f/norm;
+        ax *= norm;
+        ay *= norm;
+        az *= norm;
+
+        // Gradient decent algorithm corrective step
+        s0 = -_2q2 * (2.0f * q1q3 - _2q0q2 - ax) + _2q1 * (2.0f * q0q1 + _2q2q3 - ay);
+        s1 = _2q3 * (2.0f * q1q3 - _2q0q2 - ax) + _2q0 * (2.0f * q0q1 + _2q2q3 - ay) - 4.0f * q1 * (1.0f - 2.0f * q1q1 - 2.0f * q2q2 - az);
+        s2 = -_2q0 * (2.0f * q1q3 - _2q0q2 - ax) + _2q3 * (2.0f * q0q1 + _2q2q3 - ay) - 4.0f * q2 * (1.0f - 2.0f * q1q1 - 2.0f * q2q2 - az);
+        s3 = _2q1 * (2.0f * q1q3 - _2q0q2 - ax) + _2q2 * (2.0f * q0q1 + _2q2q3 - ay);
+
+        norm = scalarSqrt(s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3);    // normalise step magnitude
+        if (!(norm == 0.0f)) {  // zero when estimate already matches
+            norm = 1.0f/norm;
+            qDot1 -= beta * s0 * norm;
+            qDot2 -= beta * s1 * norm;
+            qDot3 -= beta * s2 * norm;
+            qDot4 -= beta * s3 * norm;
+        }
+    }
+
+    // Integrate to yield quaternion
+    q0 += qDot1 * deltat;
+    q1 += qDot2 * deltat;
+    q2 += qDot3 * deltat;
+    q3 += qDot4 * deltat;
+    norm = scalarSqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);    // normalise quaternion
     norm = 1.0f/norm;
     q[0] = q0 * norm;
     q[1] = q1 * norm;
@@ -121,10 +210,15 @@ const float Kp = 1.;
 const float Ki = 0.0;
 
  // Similar to Madgwick scheme but uses proportional and integral filtering on the error between estimated reference vectors and
- // measured ones. 
-void MahonyQuaternionUpdate(float* sensor_data, float* eInt, float* q, float deltat)
+ // measured ones. Samples without fresh magnetometer data take MahonyImuUpdate().
+template <typename T>
+void MahonyQuaternionUpdate(T* sensor_data, T* eInt, T* q, T deltat, bool magFresh = true)
 {
-    float ax = sensor_data[0], 
+    if (!magFresh) {
+        MahonyImuUpdate(sensor_data, eInt, q, deltat);
+        return;
+    }
+    T ax = sensor_data[0], 
     ay = sensor_data[1], 
     az = sensor_data[2], 
     gx = sensor_data[3], 
@@ -133,27 +227,27 @@ void MahonyQuaternionUpdate(float* sensor_data, float* eInt, float* q, float del
     mx = sensor_data[6], 
     my = sensor_data[7], 
     mz = sensor_data[8];
-    float q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];   // short name local variable for readability
-    float norm;
-    float hx, hy, bx, bz;
-    float vx, vy, vz, wx, wy, wz;
-    float ex, ey, ez;
-    float pa, pb, pc;
+    T q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];   // short name local variable for readability
+    T norm;
+    T hx, hy, bx, bz;
+    T vx, vy, vz, wx, wy, wz;
+    T ex, ey, ez;
+    T pa, pb, pc;
 
     // Auxiliary variables to avoid repeated arithmetic
-    float q0q0 = q0 * q0;
-    float q0q1 = q0 * q1;
-    float q0q2 = q0 * q2;
-    float q0q3 = q0 * q3;
-    float q1q1 = q1 * q1;
-    float q1q2 = q1 * q2;
-    float q1q3 = q1 * q3;
-    float q2q2 = q2 * q2;
-    float q2q3 = q2 * q3;
-    float q3q3 = q3 * q3;   
+    T q0q0 = q0 * q0;
+    T q0q1 = q0 * q1;
+    T q0q2 = q0 * q2;
+    T q0q3 = q0 * q3;
+    T q1q1 = q1 * q1;
+    T q1q2 = q1 * q2;
+    T q1q3 = q1 * q3;
+    T q2q2 = q2 * q2;
+    T q2q3 = q2 * q3;
+    T q3q3 = q3 * q3;   
 
     // Normalise accelerometer measurement
-    norm = sqrtf(ax * ax + ay * ay + az * az);
+    norm = scalarSqrt(ax * ax + ay * ay + az * az);
     if (norm == 0.0f) return; // handle NaN
     norm = 1.0f / norm;        // use reciprocal for division
     ax *= norm;
@@ -161,7 +255,7 @@ void MahonyQuaternionUpdate(float* sensor_data, float* eInt, float* q, float del
     az *= norm;
 
     // Normalise magnetometer measurement
-    norm = sqrtf(mx * mx + my * my + mz * mz);
+    norm = scalarSqrt(mx * mx + my * my + mz * mz);
     if (norm == 0.0f) return; // handle NaN
     norm = 1.0f / norm;        // use reciprocal for division
     mx *= norm;
@@ -171,7 +265,7 @@ void MahonyQuaternionUpdate(float* sensor_data, float* eInt, float* q, float del
     // Reference direction of Earth's magnetic field
     hx = 2.0f * mx * (0.5f - q2q2 - q3q3) + 2.0f * my * (q1q2 - q0q3) + 2.0f * mz * (q1q3 + q0q2);
     hy = 2.0f * mx * (q1q2 + q0q3) + 2.0f * my * (0.5f - q1q1 - q3q3) + 2.0f * mz * (q2q3 - q0q1);
-    bx = sqrtf((hx * hx) + (hy * hy));
+    bx = scalarSqrt((hx * hx) + (hy * hy));
     bz = 2.0f * mx * (q1q3 - q0q2) + 2.0f * my * (q2q3 + q0q1) + 2.0f * mz * (0.5f - q1q1 - q2q2);
 
     // Estimated direction of gravity and magnetic field
@@ -214,7 +308,77 @@ void MahonyQuaternionUpdate(float* sensor_data, float* eInt, float* q, float del
     q3 = pc + (q0 * gz + pa * gy - pb * gx) * (0.5f * deltat);
 
     // Normalise quaternion
-    norm = sqrtf(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+    norm = scalarSqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+    norm = 1.0f / norm;
+    q[0] = q0 * norm;
+    q[1] = q1 * norm;
+    q[2] = q2 * norm;
+    q[3] = q3 * norm;
+}
+
+// Accelerometer and gyro only (6-DOF) variant of MahonyQuaternionUpdate, feedback comes from gravity alone
+template <typename T>
+void MahonyImuUpdate(T* sensor_data, T* eInt, T* q, T deltat)
+{
+    T ax = sensor_data[0], 
+    ay = sensor_data[1], 
+    az = sensor_data[2], 
+    gx = sensor_data[3], 
+    gy = sensor_data[4], 
+    gz = sensor_data[5];
+    T q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];   // short name local variable for readability
+    T norm;
+    T vx, vy, vz;
+    T ex, ey, ez;
+    T pa, pb, pc;
+
+    // Normalise accelerometer measurement, without one gyro is integrated alone
+    norm = scalarSqrt(ax * ax + ay * ay + az * az);
+    if (!(norm == 0.0f)) {
+        norm = 1.0f / norm;        // use reciprocal for division
+        ax *= norm;
+        ay *= norm;
+        az *= norm;
+
+        // Estimated direction of gravity
+        vx = 2.0f * (q1 * q3 - q0 * q2);
+        vy = 2.0f * (q0 * q1 + q2 * q3);
+        vz = q0 * q0 - q1 * q1 - q2 * q2 + q3 * q3;
+
+        // Error is cross product between estimated direction and measured direction of gravity
+        ex = (ay * vz - az * vy);
+        ey = (az * vx - ax * vz);
+        ez = (ax * vy - ay * vx);
+        if (Ki > 0.0f)
+        {
+            eInt[0] += ex;      // accumulate integral error
+            eInt[1] += ey;
+            eInt[2] += ez;
+        }
+        else
+        {
+            eInt[0] = 0.0f;     // prevent integral wind up
+            eInt[1] = 0.0f;
+            eInt[2] = 0.0f;
+        }
+
+        // Apply feedback terms
+        gx = gx + Kp * ex + Ki * eInt[0];
+        gy = gy + Kp * ey + Ki * eInt[1];
+        gz = gz + Kp * ez + Ki * eInt[2];
+    }
+
+    // Integrate rate of change of quaternion
+    pa = q1;
+    pb = q2;
+    pc = q3;
+    q0 = q0 + (-q1 * gx - q2 * gy - q3 * gz) * (0.5f * deltat);
+    q1 = pa + (q0 * gx + pb * gz - pc * gy) * (0.5f * deltat);
+    q2 = pb + (q0 * gy - pa * gz + pc * gx) * (0.5f * deltat);
+    q3 = pc + (q0 * gz + pa * gy - pb * gx) * (0.5f * deltat);
+
+    // Normalise quaternion
+    norm = scalarSqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
     norm = 1.0f / norm;
     q[0] = q0 * norm;
     q[1] = q1 * norm;
@@ -0,0 +1,106 @@
+#ifndef FIXED_h
+#define FIXED_h
+
+#include <stdint.h>
+#include <math.h>
+
+// Signed fixed point number with FRAC fractional bits stored in int32_t.
+// All arithmetic saturates to the representable range instead of wrapping,
+// so filters degrade gracefully on overflow. Useful on parts without FPU.
+template <int FRAC>
+class Fixed {
+public:
+    static const int32_t MAX_RAW = INT32_MAX;
+    static const int32_t MIN_RAW = INT32_MIN;
+    static const int32_t ONE_RAW = (int32_t)1 << FRAC;
+
+    int32_t _raw;
+
+    constexpr Fixed() : _raw(0) {};
+    constexpr Fixed(int v) : _raw(saturate((int64_t)v << FRAC)) {};
+    constexpr Fixed(float v) : _raw(saturate((int64_t)(v * (float)ONE_RAW))) {};
+    constexpr Fixed(double v) : _raw(saturate((int64_t)(v * (double)ONE_RAW))) {};
+
+    static constexpr Fixed fromRaw(int32_t raw){
+        return Fixed(raw, 0);
+    }
+
+    static constexpr int32_t saturate(int64_t v){
+        return (v > MAX_RAW) ? MAX_RAW : ((v < MIN_RAW) ? MIN_RAW : (int32_t) v);
+    }
+
+    explicit operator float() const { return (float)_raw / (float)ONE_RAW; }
+    explicit operator double() const { return (double)_raw / (double)ONE_RAW; }
+
+    // Operators are friends so that mixed expressions like 2.0f * q convert either side
+    Fixed operator-() const { return fromRaw(saturate(-(int64_t)_raw)); }
+    friend Fixed operator+(Fixed a, Fixed b) { return fromRaw(saturate((int64_t)a._raw + b._raw)); }
+    friend Fixed operator-(Fixed a, Fixed b) { return fromRaw(saturate((int64_t)a._raw - b._raw)); }
+    friend Fixed operator*(Fixed a, Fixed b) { return fromRaw(saturate(((int64_t)a._raw * b._raw) >> FRAC)); }
+    friend Fixed operator/(Fixed a, Fixed b) {
+        if (b._raw == 0) return fromRaw(a._raw >= 0 ? MAX_RAW : MIN_RAW);
+        return fromRaw(saturate(((int64_t)a._raw << FRAC) / b._raw));
+    }
+
+    Fixed& operator+=(Fixed o) { return *this = *this + o; }
+    Fixed& operator-=(Fixed o) { return *this = *this - o; }
+    Fixed& operator*=(Fixed o) { return *this = *this * o; }
+    Fixed& operator/=(Fixed o) { return *this = *this / o; }
+
+    friend bool operator==(Fixed a, Fixed b) { return a._raw == b._raw; }
+    friend bool operator!=(Fixed a, Fixed b) { return a._raw != b._raw; }
+    friend bool operator<(Fixed a, Fixed b) { return a._raw < b._raw; }
+    friend bool operator>(Fixed a, Fixed b) { return a._raw > b._raw; }
+    friend bool operator<=(Fixed a, Fixed b) { return a._raw <= b._raw; }
+    friend bool operator>=(Fixed a, Fixed b) { return a._raw >= b._raw; }
+
+private:
+    constexpr Fixed(int32_t raw, int) : _raw(raw) {};
+};
+
+// Q15.16 covers unnormalised sensor values (up to +-32767) as well as normalised quaternions
+typedef Fixed<16> Q16;
+
+// Integer square root of a 64 bit value (bit by bit method, no division)
+inline uint32_t isqrt64(uint64_t v){
+    uint64_t result = 0;
+    uint64_t bit = (uint64_t)1 << 62;
+    while (bit > v) bit >>= 2;
+    while (bit != 0) {
+        if (v >= result + bit) {
+            v -= result + bit;
+            result = (result >> 1) + bit;
+        }
+        else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t) result;
+}
+
+// Square root overloads, so generic code can call scalarSqrt(x) for any supported scalar type
+inline float scalarSqrt(float v){
+    return sqrtf(v);
+}
+
+inline double scalarSqrt(double v){
+    return sqrt(v);
+}
+
+template <int FRAC>
+inline Fixed<FRAC> scalarSqrt(Fixed<FRAC> v){
+    if (v._raw <= 0) return Fixed<FRAC>();
+    return Fixed<FRAC>::fromRaw((int32_t) isqrt64((uint64_t)v._raw << FRAC));
+}
+
+// Cube root for floating point types
+inline float scalarCbrt(float v){
+    return cbrtf(v);
+}
+
+inline double scalarCbrt(double v){
+    return cbrt(v);
+}
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef FRAMING_h
+#define FRAMING_h
+
+#include <string.h>
+#include "transport.h"
+#include "utils.h"
+
+// Messages longer than one packet go as fragments. Fragment packet: cmd | FRAGMENT_FLAG, data_len, final_packet
+// (device to host only, set on the last fragment if the message ends the command), then uint8 transfer, uint16 index,
+// uint16 count and up to FRAGMENT_DATA bytes of message followed by its crc16(), so the CRC takes the last two bytes
+// of the last fragment(s).
+// Both sides send a window of fragments up to the next multiple of FRAGMENT_WINDOW and wait for FRAGMENT_ACK before
+// going on: uint8 cmd, transfer, uint16 next expected index, uint8 status (device to host acknowledgements carry
+// final_packet before them, host to device ones don't). A gap or CRC mismatch asks for resending from that index.
+// The device sends a window again from the last acknowledged fragment when no acknowledgement comes within
+// FRAGMENT_ACK_TIMEOUT and gives the message up after FRAGMENT_RETRIES windows without an answer.
+static const uint8_t FRAGMENT_FLAG = 0x80;
+static const uint8_t FRAGMENT_ACK = 0x7F;   // cmd code of acknowledgements, never a command
+static const uint8_t FRAGMENT_HEADER = 1 + 2 * sizeof(uint16_t);
+static const uint8_t FRAGMENT_DATA = 56;
+static const uint8_t FRAGMENT_WINDOW = 8;
+static const uint16_t FRAGMENT_ACK_TIMEOUT = 100;   // ms
+static const uint8_t FRAGMENT_RETRIES = 3;
+
+enum FragmentAck
+{
+    ACK_PROGRESS,   // window received, send on from index
+    ACK_DONE,       // message complete, CRC matches
+    ACK_RESEND,     // gap or CRC mismatch, send again from index
+    ACK_TOO_LONG    // message doesn't fit receive buffer, transfer dropped
+};
+
+inline uint16_t fragmentCount(uint16_t length){
+    return ((uint32_t) length + sizeof(uint16_t) + FRAGMENT_DATA - 1) / FRAGMENT_DATA;
+}
+
+// Reassembles host requests of up to SIZE - 2 bytes. The complete message is laid out like a single packet
+// request in _message (cmd, data_len saturated at 255, data), so commands take it the same way.
+template <uint16_t SIZE = 256>
+class FragmentReceiver {
+public:
+    uint8_t _message[SIZE + sizeof(uint16_t)];  // room for the CRC behind the data
+    uint16_t _length;   // message and CRC bytes received so far
+    uint16_t _next;     // expected fragment
+    uint16_t _count;
+    uint8_t _transfer;
+    bool _active;
+    bool _gap;          // fragments are out of order, resend was asked for
+    uint16_t _gapIndex; // last out of order fragment
+
+    FragmentReceiver():_length(0), _next(0), _count(0), _transfer(0), _active(false), _gap(false), _gapIndex(0) {};
+
+    // Takes one fragment packet, returns true once it completed a message
+    bool add(const uint8_t* packet, Transport* transport){
+        uint8_t cmd = packet[0] & ~FRAGMENT_FLAG;
+        uint8_t data_len = packet[1];
+        if (data_len < FRAGMENT_HEADER) return false;
+        uint8_t transfer = packet[2];
+        uint16_t index, count;
+        memcpy(&index, &packet[3], sizeof(index));
+        memcpy(&count, &packet[5], sizeof(count));
+
+        if ((transfer == _transfer) && !_active && _count && (_next == _count)) {
+            // Host repeats a window when the acknowledgement got lost (the queue drops packets), message is
+            // complete already and mustn't run twice
+            ack(transport, cmd, ACK_DONE);
+            return false;
+        }
+        if (index == 0) {
+            _active = true;
+            _transfer = transfer;
+            _count = count;
+            _next = 0;
+            _length = 0;
+            _message[0] = cmd;
+        } else if (!_active || (transfer != _transfer) || (index != _next)) {
+            // rest of a window after a gap is dropped, resend is asked for once per window the host sends
+            if (_active && (transfer == _transfer) && (!_gap || (index <= _gapIndex))) ack(transport, cmd, ACK_RESEND);
+            _gap = true;
+            _gapIndex = index;
+            return false;
+        }
+        _gap = false;
+
+        uint8_t n = data_len - FRAGMENT_HEADER;
+        if (_length + n > SIZE) {
+            _active = false;
+            ack(transport, cmd, ACK_TOO_LONG);
+            return false;
+        }
+        memcpy(&_message[2 + _length], &packet[2 + FRAGMENT_HEADER], n);
+        _length += n;
+        _next++;
+
+        if (_next < _count) {
+            if (_next % FRAGMENT_WINDOW == 0) ack(transport, cmd, ACK_PROGRESS);
+            return false;
+        }
+        _active = false;
+        uint16_t size = length();
+        uint16_t crc = 0;
+        if (_length >= sizeof(uint16_t)) memcpy(&crc, &_message[2 + size], sizeof(crc));
+        if ((_length < sizeof(uint16_t)) || (crc16(&_message[2], size) != crc)) {
+            _next = 0;
+            ack(transport, cmd, ACK_RESEND);
+            return false;
+        }
+        _message[1] = (size < 255) ? size : 255;
+        ack(transport, cmd, ACK_DONE);
+        return true;
+    }
+
+    // Message data length, data_len in _message[1] saturates
+    uint16_t length(){
+        return _length - sizeof(uint16_t);
+    }
+
+    void ack(Transport* transport, uint8_t cmd, FragmentAck status){
+        uint8_t packet[Transport::PACKET_SIZE] = {FRAGMENT_ACK, 5, 1, cmd, _transfer,
+            (uint8_t)(_next & 0xFF), (uint8_t)(_next >> 8), (uint8_t) status};
+        transport->send(packet, 0);
+    }
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef GYROBIAS_h
+#define GYROBIAS_h
+
+#include <stdint.h>
+#include <math.h>
+
+// Running gyro bias estimate for streaming. Bias is tracked only while the sensor rests: gyro rates and acceleration
+// stay close to their smoothed values, and rates are within REST_RATE of the current bias. Absolute gravity isn't
+// used, so uncorrected accelerometer bias doesn't matter. A few multiplications per sample, cheap at full rate.
+class GyroBiasEstimator {
+public:
+    static constexpr float REST_GYRO = 0.02f;        // rad/s, deviation from smoothed rates
+    static constexpr float REST_ACCEL = 0.3f;        // m/s^2, deviation from smoothed acceleration
+    static constexpr float REST_RATE = 0.1f;         // rad/s, slow steady rotation above that is never taken for bias
+    static constexpr float REST_TIME = 0.5f;         // s at rest before bias is tracked
+    static constexpr float SMOOTH_TIME_CONSTANT = 0.1f;
+    static constexpr float BIAS_TIME_CONSTANT = 2.0f;
+
+    float _bias[3];
+    float _gyro[3];     // smoothed rates
+    float _accel[3];    // smoothed acceleration
+    float _restTime;    // s the sensor has been at rest
+
+    GyroBiasEstimator(){
+        reset();
+    }
+
+    void reset(){
+        for (uint8_t i = 0; i < 3; i++){
+            _bias[i] = 0.0f;
+            _gyro[i] = 0.0f;
+            _accel[i] = 0.0f;
+        }
+        _restTime = 0.0f;
+    }
+
+    bool atRest(){
+        return _restTime >= REST_TIME;
+    }
+
+    // Updates estimate with sensor_data (ax, ay, az, gx, gy, gz, ...) and removes bias from its gyro rates.
+    // Returns true while the sensor is at rest.
+    bool update(float* sensor_data, float dt){
+        float smoothRate = dt / SMOOTH_TIME_CONSTANT;
+        if (smoothRate > 1.0f) smoothRate = 1.0f;
+        float accelDev = 0.0f, gyroDev = 0.0f, rate = 0.0f;
+        for (uint8_t i = 0; i < 3; i++){
+            float a = sensor_data[i] - _accel[i];
+            float g = sensor_data[3 + i] - _gyro[i];
+            float w = sensor_data[3 + i] - _bias[i];
+            _accel[i] += a * smoothRate;
+            _gyro[i] += g * smoothRate;
+            accelDev += a * a;
+            gyroDev += g * g;
+            rate += w * w;
+        }
+
+        bool rest = (gyroDev < REST_GYRO * REST_GYRO) && (accelDev < REST_ACCEL * REST_ACCEL) && (rate < REST_RATE * REST_RATE);
+        if (rest) _restTime += dt;
+        else _restTime = 0.0f;
+
+        if (atRest()) {
+            float biasRate = dt / BIAS_TIME_CONSTANT;
+            if (biasRate > 1.0f) biasRate = 1.0f;
+            for (uint8_t i = 0; i < 3; i++)
+                _bias[i] += (sensor_data[3 + i] - _bias[i]) * biasRate;
+        }
+
+        for (uint8_t i = 0; i < 3; i++)
+            sensor_data[3 + i] -= _bias[i];
+        return atRest();
+    }
+};
+
+#endif
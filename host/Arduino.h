@@ -0,0 +1,67 @@
+#ifndef Arduino_h
+#define Arduino_h
+
+// Just enough of the Teensy core to build the sketch and its headers on Linux, see Makefile.
+// Serial prints to stderr, time is CLOCK_MONOTONIC plus whatever delay() skipped, so setup() doesn't sleep.
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <type_traits>
+
+typedef uint8_t byte;
+#define F(s) (s)
+#define F_CPU 96000000
+enum { LOW, HIGH, RISING = 3, INPUT = 0, OUTPUT = 1, DEC = 10, HEX = 16 };
+
+unsigned long micros();
+unsigned long millis();
+void delay(unsigned long ms);
+inline void delayMicroseconds(unsigned long){}
+inline void pinMode(uint8_t, uint8_t){}
+inline void digitalWrite(uint8_t, uint8_t){}
+inline void digitalWriteFast(uint8_t, uint8_t){}
+inline void attachInterrupt(uint8_t, void (*)(), int){}
+inline void noInterrupts(){}
+inline void interrupts(){}
+inline void yield(){}
+
+class Print {
+public:
+    virtual ~Print(){}
+    virtual size_t write(const uint8_t* data, size_t n){ return fwrite(data, 1, n, stderr); }
+    size_t print(const char* s){ return write((const uint8_t*) s, strlen(s)); }
+    template <typename T> size_t print(T v, int format = DEC){
+        char s[32];
+        if (std::is_floating_point<T>::value) snprintf(s, sizeof(s), "%.*f", (format == DEC) ? 2 : format, (double) v);
+        else snprintf(s, sizeof(s), (format == HEX) ? "%llX" : "%lld", (long long) v);
+        return print((const char*) s);
+    }
+    size_t println(){ return print("\n"); }
+    template <typename T> size_t println(T v){ return print(v) + println(); }
+    template <typename T> size_t println(T v, int format){ return print(v, format) + println(); }
+};
+
+class Stream : public Print {
+public:
+    virtual int available(){ return 0; }
+    virtual int read(){ return -1; }
+    virtual int availableForWrite(){ return 64; }
+};
+
+class usb_serial_class : public Stream {
+public:
+    void begin(long){}
+};
+
+class usb_rawhid_class {
+public:
+    int send(const void*, uint16_t){ return 64; }
+    int recv(void*, uint16_t){ return 0; }
+};
+
+extern usb_serial_class Serial;
+extern usb_serial_class SerialUSB1;
+extern usb_rawhid_class RawHID;
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef EEPROM_h
+#define EEPROM_h
+
+// Host build: 2 KB in RAM, erased at start, like a fresh Teensy 3.2
+#include "Arduino.h"
+
+class EEPROMClass {
+public:
+    uint8_t _data[2048];
+
+    EEPROMClass(){ memset(_data, 0xFF, sizeof(_data)); }
+    uint16_t length(){ return sizeof(_data); }
+    uint8_t read(int address){ return _data[address]; }
+    void update(int address, uint8_t value){ _data[address] = value; }
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,2 @@
+// Sources include the driver as on a case insensitive file system
+#include "../mpu9250.h"
@@ -0,0 +1,26 @@
+#include <time.h>
+#include "Arduino.h"
+#include "SPI.h"
+#include "EEPROM.h"
+
+usb_serial_class Serial;
+usb_serial_class SerialUSB1;
+usb_rawhid_class RawHID;
+SPIClass SPI;
+EEPROMClass EEPROM;
+
+static unsigned long long skipped = 0;  // us delay() returned early for
+
+unsigned long micros(){
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (unsigned long)(t.tv_sec * 1000000ULL + t.tv_nsec / 1000 + skipped);
+}
+
+unsigned long millis(){
+    return micros() / 1000;
+}
+
+void delay(unsigned long ms){
+    skipped += ms * 1000ULL;
+}
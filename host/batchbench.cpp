@@ -0,0 +1,96 @@
+// Throughput of the batch filters (batchfilters.h) reprocessing many streams cut from recorded data (data/*.csv):
+// samples per second by lane type at one thread, then with the default lanes on 1, 2, 4 .. threads up to twice
+// the core count (runBatches() of batchrunner.h). Best of TIMING_PASSES runs.
+//   ./batchbench [streams] [file.csv]
+#include <algorithm>
+#include <chrono>
+#include "Arduino.h"
+#include "../batchrunner.h"
+#include "csv.h"
+
+static const uint16_t N = 16;
+static const uint32_t STEPS = 500;
+static const int TIMING_PASSES = 5;
+
+typedef BatchLog<N> Log;
+
+template <typename State, typename Update>
+static double samplesPerSecond(const std::vector<Log>& logs, uint32_t streams, Update update, unsigned threads){
+    double best = 0.0;
+    for (int pass = 0; pass < TIMING_PASSES; pass++) {
+        std::vector<State> states(logs.size());
+        for (State& state : states) state.reset();
+        auto start = std::chrono::steady_clock::now();
+        runBatches(&states[0], &logs[0], logs.size(), update, threads);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::max(best, streams * (double) STEPS / elapsed.count());
+    }
+    return best;
+}
+
+template <typename V>
+static void lanes(const std::vector<Log>& logs, uint32_t streams, const char* name){
+    double madgwick = samplesPerSecond<MadgwickBatch<N> >(logs, streams,
+        [](const float* data, MadgwickBatch<N>& state, const float* deltat, uint16_t count){
+            MadgwickBatchUpdate<N, float, V>(data, state, deltat, count);
+        }, 1);
+    double mahony = samplesPerSecond<MahonyBatch<N> >(logs, streams,
+        [](const float* data, MahonyBatch<N>& state, const float* deltat, uint16_t count){
+            MahonyBatchUpdate<N, float, V>(data, state, deltat, count);
+        }, 1);
+    printf("%-8s %6u %8u %14.3g %14.3g\n", name, Lanes<V>::WIDTH, 1, madgwick, mahony);
+}
+
+int main(int argc, char** argv){
+    uint32_t streams = (argc > 1) ? atoi(argv[1]) : 1024;
+    const char* path = (argc > 2) ? argv[2] : DEFAULT_CSV[1];
+    CsvRows rows;
+    if (!loadCsv(path, rows) || rows.empty()) {
+        fprintf(stderr, "Can't read %s\n", path);
+        return 1;
+    }
+
+    size_t batches = (streams + N - 1) / N;
+    std::vector<float> data(batches * STEPS * 9 * N);
+    std::vector<float> deltat(batches * STEPS * N);
+    std::vector<Log> logs(batches);
+    for (size_t b = 0; b < batches; b++) {
+        float* batchData = &data[b * STEPS * 9 * N];
+        float* batchDeltat = &deltat[b * STEPS * N];
+        for (uint32_t k = 0; k < STEPS; k++)
+            for (uint16_t i = 0; i < N; i++) {
+                const std::vector<float>& row = rows[(k + (b * N + i) * 97) % rows.size()];
+                for (uint8_t c = 0; c < 9; c++) batchData[(k * 9 + c) * N + i] = row[c];
+                batchDeltat[k * N + i] = 0.02f;
+            }
+        uint32_t left = streams - b * N;
+        logs[b] = Log{batchData, batchDeltat, STEPS, (uint16_t) std::min<uint32_t>(N, left)};
+    }
+
+    printf("%u streams of %u samples, %zu batches of %u\n", streams, STEPS, batches, N);
+    printf("%-8s %6s %8s %14s %14s\n", "lanes", "width", "threads", "Madgwick/s", "Mahony/s");
+    lanes<float>(logs, streams, "scalar");
+#if defined(__SSE2__)
+    lanes<SseFloat4>(logs, streams, "SSE");
+#endif
+#if defined(__AVX__)
+    lanes<AvxFloat8>(logs, streams, "AVX");
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+    lanes<NeonFloat4>(logs, streams, "NEON");
+#endif
+
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned threads = 1; threads <= 2 * cores; threads *= 2) {
+        double madgwick = samplesPerSecond<MadgwickBatch<N> >(logs, streams,
+            [](const float* data, MadgwickBatch<N>& state, const float* deltat, uint16_t count){
+                MadgwickBatchUpdate(data, state, deltat, count);
+            }, threads);
+        double mahony = samplesPerSecond<MahonyBatch<N> >(logs, streams,
+            [](const float* data, MahonyBatch<N>& state, const float* deltat, uint16_t count){
+                MahonyBatchUpdate(data, state, deltat, count);
+            }, threads);
+        printf("%-8s %6u %8u %14.3g %14.3g\n", "default", Lanes<BatchLanes<float>::Vector>::WIDTH, threads, madgwick, mahony);
+    }
+    return 0;
+}
@@ -0,0 +1,138 @@
+// Batch filters (batchfilters.h) on every lane type the build has (simdlanes.h) against the scalar filters of
+// filters.h: streams are cut from recorded data at different offsets, each with its own sample interval, one of
+// them has samples without accelerometer which must leave its state alone, and another one samples without
+// magnetometer which take the IMU update. runBatches() on several threads must give the same states as one.
+#include "Arduino.h"
+#include "../batchrunner.h"
+#include "csv.h"
+#include "check.h"
+
+static const uint16_t N = 16;
+static const uint16_t STREAMS = 13;     // leaves a tail for the scalar lanes of every vector width
+static const uint32_t STEPS = 1000;
+static const float TOLERANCE = 1e-4f;
+
+struct Streams {
+    std::vector<float> data;     // channel major per step, as the batch update takes it
+    std::vector<float> deltat;
+
+    Streams(const CsvRows& rows) : data(STEPS * 9 * N, 0.0f), deltat(STEPS * N, 0.0f) {
+        for (uint32_t k = 0; k < STEPS; k++)
+            for (uint16_t i = 0; i < STREAMS; i++) {
+                const std::vector<float>& row = rows[(k + i * 277) % rows.size()];
+                for (uint8_t c = 0; c < 9; c++) data[(k * 9 + c) * N + i] = row[c];
+                if ((i == 5) && (k % 10 == 3))
+                    for (uint8_t c = 0; c < 3; c++) data[(k * 9 + c) * N + i] = 0.0f;
+                if ((i == 9) && (k % 4 != 0))
+                    for (uint8_t c = 6; c < 9; c++) data[(k * 9 + c) * N + i] = 0.0f;
+                deltat[k * N + i] = 0.005f + 0.002f * i;
+            }
+    }
+
+    void sample(uint32_t k, uint16_t i, float* sensor_data) const {
+        for (uint8_t c = 0; c < 9; c++) sensor_data[c] = data[(k * 9 + c) * N + i];
+    }
+};
+
+static bool hasMag(const float* sensor_data){
+    return (sensor_data[6] != 0.0f) || (sensor_data[7] != 0.0f) || (sensor_data[8] != 0.0f);
+}
+
+template <typename V>
+static void testMadgwick(const Streams& streams, const char* name){
+    MadgwickBatch<N, float> batch;
+    batch.reset();
+    float q[STREAMS][4];
+    for (uint16_t i = 0; i < STREAMS; i++) {
+        q[i][0] = 1.0f;
+        q[i][1] = q[i][2] = q[i][3] = 0.0f;
+    }
+    float worst = 0.0f;
+    for (uint32_t k = 0; k < STEPS; k++) {
+        MadgwickBatchUpdate<N, float, V>(&streams.data[k * 9 * N], batch, &streams.deltat[k * N], STREAMS);
+        for (uint16_t i = 0; i < STREAMS; i++) {
+            float sensor_data[9];
+            streams.sample(k, i, sensor_data);
+            if (hasMag(sensor_data)) MadgwickQuaternionUpdate<float>(sensor_data, q[i], streams.deltat[k * N + i]);
+            else MadgwickImuUpdate<float>(sensor_data, q[i], streams.deltat[k * N + i]);
+            worst = fmaxf(worst, fabsf(batch.q0[i] - q[i][0]) + fabsf(batch.q1[i] - q[i][1]) +
+                fabsf(batch.q2[i] - q[i][2]) + fabsf(batch.q3[i] - q[i][3]));
+        }
+    }
+    if (worst > TOLERANCE) fprintf(stderr, "Madgwick %s: %g\n", name, worst);
+    CHECK(worst <= TOLERANCE);
+}
+
+template <typename V>
+static void testMahony(const Streams& streams, const char* name){
+    MahonyBatch<N, float> batch;
+    batch.reset();
+    float q[STREAMS][4], eInt[STREAMS][3];
+    for (uint16_t i = 0; i < STREAMS; i++) {
+        q[i][0] = 1.0f;
+        q[i][1] = q[i][2] = q[i][3] = 0.0f;
+        eInt[i][0] = eInt[i][1] = eInt[i][2] = 0.0f;
+    }
+    float worst = 0.0f;
+    for (uint32_t k = 0; k < STEPS; k++) {
+        MahonyBatchUpdate<N, float, V>(&streams.data[k * 9 * N], batch, &streams.deltat[k * N], STREAMS);
+        for (uint16_t i = 0; i < STREAMS; i++) {
+            float sensor_data[9];
+            streams.sample(k, i, sensor_data);
+            if (hasMag(sensor_data)) MahonyQuaternionUpdate<float>(sensor_data, eInt[i], q[i], streams.deltat[k * N + i]);
+            else MahonyImuUpdate<float>(sensor_data, eInt[i], q[i], streams.deltat[k * N + i]);
+            worst = fmaxf(worst, fabsf(batch.q0[i] - q[i][0]) + fabsf(batch.q1[i] - q[i][1]) +
+                fabsf(batch.q2[i] - q[i][2]) + fabsf(batch.q3[i] - q[i][3]));
+        }
+    }
+    if (worst > TOLERANCE) fprintf(stderr, "Mahony %s: %g\n", name, worst);
+    CHECK(worst <= TOLERANCE);
+}
+
+template <typename V>
+static void testLanes(const Streams& streams, const char* name){
+    testMadgwick<V>(streams, name);
+    testMahony<V>(streams, name);
+}
+
+static void testThreads(const Streams& streams){
+    const size_t BATCHES = 5;
+    std::vector<BatchLog<N> > logs(BATCHES, BatchLog<N>{&streams.data[0], &streams.deltat[0], STEPS, STREAMS});
+    logs[2].count = 7;
+    logs[4].steps = STEPS / 2;
+    std::vector<MadgwickBatch<N> > one(BATCHES), several(BATCHES);
+    for (size_t b = 0; b < BATCHES; b++) {
+        one[b].reset();
+        several[b].reset();
+    }
+    auto update = [](const float* data, MadgwickBatch<N>& state, const float* deltat, uint16_t count){
+        MadgwickBatchUpdate(data, state, deltat, count);
+    };
+    runBatches(&one[0], &logs[0], BATCHES, update, 1);
+    runBatches(&several[0], &logs[0], BATCHES, update, 3);
+    CHECK(memcmp(&one[0], &several[0], BATCHES * sizeof(one[0])) == 0);
+    CHECK_NEAR(one[2].q0[0], one[0].q0[0], TOLERANCE);    // scalar lanes instead of vector ones
+    CHECK(one[2].q0[8] == 1.0f);    // streams past count aren't touched
+    CHECK(one[4].q0[0] != one[0].q0[0]);
+}
+
+int main(){
+    CsvRows rows;
+    if (!loadCsv(DEFAULT_CSV[1], rows) || rows.empty()) {
+        fprintf(stderr, "Can't read %s\n", DEFAULT_CSV[1]);
+        return 1;
+    }
+    Streams streams(rows);
+    testLanes<float>(streams, "scalar");
+#if defined(__SSE2__)
+    testLanes<SseFloat4>(streams, "SSE");
+#endif
+#if defined(__AVX__)
+    testLanes<AvxFloat8>(streams, "AVX");
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+    testLanes<NeonFloat4>(streams, "NEON");
+#endif
+    testThreads(streams);
+    return checkResult("batchtest");
+}
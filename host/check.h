@@ -0,0 +1,22 @@
+#ifndef CHECK_h
+#define CHECK_h
+
+// Assertions of the host tests: a failed CHECK prints where and what, the test goes on and main() returns
+// checkResult(), non-zero if anything failed.
+#include <stdio.h>
+
+static int checkFailures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { checkFailures++; \
+    fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); } } while (0)
+
+#define CHECK_NEAR(a, b, tol) do { double _a = (a), _b = (b); if (!(fabs(_a - _b) <= (tol))) { checkFailures++; \
+    fprintf(stderr, "%s:%d: CHECK_NEAR(%s, %s) failed: %g vs %g\n", __FILE__, __LINE__, #a, #b, _a, _b); } } while (0)
+
+inline int checkResult(const char* name){
+    if (checkFailures) printf("%s: %d checks FAILED\n", name, checkFailures);
+    else printf("%s: OK\n", name);
+    return checkFailures ? 1 : 0;
+}
+
+#endif
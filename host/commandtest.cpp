@@ -0,0 +1,332 @@
+// Command layer with host packets through LoopbackTransport, dispatched like loop() of the sketch, against the
+// register file of fakebus.h: a register dump while the sensor streams in FIFO mode must neither pop FIFO bytes
+// nor clear interrupt flags, and the dump arrives whole as fragments. Sequence numbers and 16 bit sample times of
+// the packed stream let the host rebuild the timeline across packets the link dropped. Fragments the host lost are sent again
+// from its acknowledgement, and a frozen black box window is released only once the host acknowledged it.
+// Magnetometer calibration reads samples itself only while no stream does, once per poll period.
+#include <vector>
+#include "MPU9250.h"
+#include "../sensorarray.h"
+#include "../commands.h"
+#include "../commandpool.h"
+#include "../loopbacktransport.h"
+#include "fakebus.h"
+#include "check.h"
+
+typedef MPU9250 M;
+
+struct Device {
+    FakeBus bus;
+    MPU9250 sensor;
+    SensorArray sensors;
+    LoopbackTransport<64> link;
+    CommandPool<3, commandSize<StartSensorsCommand, ReadRegistersCommand, BlackBoxCommand,
+        CalibrateMagnetometerCommand>()> commands;
+    byte buffer[Transport::PACKET_SIZE];
+
+    Device() : sensor(&bus), commands(&link) {
+        sensors.add(&sensor);
+    }
+
+    // One pass of loop()
+    void loop(){
+        if (link.recv(buffer, 0) > 0) {
+            switch (BaseCommand::getCommandCode(buffer)) {
+                case CMD_START_SENSORS: commands.start<StartSensorsCommand>(&sensors, buffer); break;
+                case CMD_READ_REGS    : commands.start<ReadRegistersCommand>(&sensors, buffer); break;
+                case CMD_BLACKBOX     : commands.start<BlackBoxCommand>(&sensors, buffer); break;
+                case CMD_MAG_CALIB    : commands.start<CalibrateMagnetometerCommand>(&sensors, buffer); break;
+                default:
+                    if (buffer[0] == FRAGMENT_ACK) commands.ack(buffer);
+                    break;
+            }
+        }
+        commands.exec();
+    }
+};
+
+// Host side: stream samples are checked, fragments of a message collected and acknowledged like
+// FragmentReassembler of utils.py does. Fragments listed in drop are lost the first time they come.
+struct Host {
+    uint32_t samples = 0;
+    uint32_t badSamples = 0;
+    std::vector<uint8_t> message;
+    std::vector<uint16_t> drop;
+    uint16_t next = 0;
+    uint16_t resends = 0;
+    bool gap = false;
+    bool complete = false;
+    bool acks = true;
+
+    void ack(LoopbackTransport<64>& link, uint8_t cmd, uint8_t transfer, FragmentAck status){
+        if (!acks) return;
+        uint8_t packet[Transport::PACKET_SIZE] = {FRAGMENT_ACK, 5, cmd, transfer,
+            (uint8_t)(next & 0xFF), (uint8_t)(next >> 8), (uint8_t) status};
+        link.hostSend(packet);
+    }
+
+    void fragment(LoopbackTransport<64>& link, const uint8_t* packet){
+        uint8_t cmd = packet[0] & ~FRAGMENT_FLAG, transfer = packet[3];
+        uint16_t index, count;
+        memcpy(&index, &packet[4], sizeof(index));
+        memcpy(&count, &packet[6], sizeof(count));
+        for (size_t i = 0; i < drop.size(); i++)
+            if (drop[i] == index) {
+                drop.erase(drop.begin() + i);
+                return;
+            }
+        if (complete) {
+            ack(link, cmd, transfer, ACK_DONE);     // acknowledgement got lost
+            return;
+        }
+        if (index != next) {
+            if (!gap) {
+                resends++;
+                ack(link, cmd, transfer, ACK_RESEND);
+            }
+            gap = true;
+            return;
+        }
+        gap = false;
+        if (index == 0) message.clear();
+        message.insert(message.end(), &packet[3 + FRAGMENT_HEADER], &packet[3 + packet[1]]);
+        next++;
+        if (next < count) {
+            if (next % FRAGMENT_WINDOW == 0) ack(link, cmd, transfer, ACK_PROGRESS);
+            return;
+        }
+        uint16_t crc;
+        memcpy(&crc, &message[message.size() - sizeof(crc)], sizeof(crc));
+        CHECK(crc == crc16(&message[0], message.size() - sizeof(crc)));
+        message.resize(message.size() - sizeof(crc));
+        complete = true;
+        ack(link, cmd, transfer, ACK_DONE);
+    }
+
+    void receive(LoopbackTransport<64>& link){
+        uint8_t packet[Transport::PACKET_SIZE];
+        while (link.hostRecv(packet)) {
+            if (packet[0] == CMD_START_SENSORS) {
+                float sensor_data[StartSensorsCommand::SENSOR_DATA_SIZE];
+                memcpy(sensor_data, &packet[3], sizeof(sensor_data));
+                samples++;
+                if (fabsf(sensor_data[2] - M::G) > 0.01f) badSamples++;
+            } else if (packet[0] & FRAGMENT_FLAG) {
+                fragment(link, packet);
+            }
+        }
+    }
+};
+
+static void run(Device& device, Host& host, uint32_t us){
+    unsigned long start = micros();
+    while (micros() - start < us) {
+        device.loop();
+        host.receive(device.link);
+    }
+}
+
+static void testDumpWhileStreaming(){
+    Device device;
+    Host host;
+    device.sensor.setFifoMode(true);
+    const uint8_t start[Transport::PACKET_SIZE] = {CMD_START_SENSORS, 1, 1};
+    device.link.hostSend(start);
+    run(device, host, 20000);
+    CHECK(host.samples > 0);
+
+    // frames and a data ready flag waiting when the dump comes in
+    device.bus.setRealTime(false);
+    device.bus.advance(3000);
+    uint16_t fifoCount = device.bus.fifoCount();
+    CHECK(fifoCount > 0);
+    const uint8_t dump[Transport::PACKET_SIZE] = {CMD_READ_REGS, 0};
+    device.link.hostSend(dump);
+    device.link.recv(device.buffer, 0);
+    device.commands.start<ReadRegistersCommand>(&device.sensors, device.buffer);
+    CHECK(device.bus.fifoCount() == fifoCount);
+    CHECK(device.bus._regs[M::INT_STATUS] & 0x01);
+
+    device.bus.setRealTime(true);
+    run(device, host, 20000);
+    CHECK(host.complete);
+    CHECK(host.message.size() == 1 + M::REGISTER_MAP_SIZE);
+    CHECK(device.commands.activeCount() == 1);     // register dump ended with the acknowledgement
+    if (host.message.size() == 1 + M::REGISTER_MAP_SIZE) {
+        const uint8_t* regs = &host.message[1];
+        CHECK(regs[0x75] == 0x71);     // WHO_AM_I
+        CHECK(regs[M::FIFO_EN] == device.bus._regs[M::FIFO_EN]);
+        CHECK(regs[M::CONFIG] == device.bus._regs[M::CONFIG]);
+        CHECK(regs[M::INT_STATUS] == 0);
+        CHECK(regs[M::FIFO_R_W] == 0);
+    }
+    CHECK(host.badSamples == 0);
+    CHECK(device.bus._fifoOverflows == 0);
+    CHECK(device.sensor._fifoOverflows == 0);
+    CHECK(device.link._dropped == 0);
+}
+
+static void testPackedTimeline(){
+    FakeBus bus;
+    MPU9250 sensor(&bus);
+    sensor.setFifoMode(true);
+    SensorArray sensors;
+    sensors.add(&sensor);
+    LoopbackTransport<16> link;
+    byte request[Transport::PACKET_SIZE] = {CMD_START_SENSORS, 2, 1, StartSensorsCommand::STREAM_PACKED};
+    StartSensorsCommand command(&sensors, &link, request);
+    command.setup();
+
+    typedef StartSensorsCommand S;
+    const float interval = 1000000.0f / M::FIFO_DEFAULT_RATE;
+    uint32_t received = 0, lost = 0, missed = 0;
+    uint32_t first = 0, last = 0;
+    uint8_t lastSeq = 0;
+    unsigned long start = micros();
+    while (micros() - start < 300000) {
+        command.exec();
+        if ((micros() - start > 50000) && (micros() - start < 180000)) continue;   // host stalls, link drops
+        uint8_t packet[Transport::PACKET_SIZE];
+        while (link.hostRecv(packet)) {
+            if (packet[1] != S::PACKED_DATA_LEN) continue;     // header
+            // samples the lost packets carried, the 16 bit time wraps every 65 ms
+            uint8_t seq = packet[3] & S::PACKED_SEQ_MASK;
+            uint32_t missing = received ? ((seq - lastSeq - 1) & S::PACKED_SEQ_MASK) * S::PACKED_SAMPLES_PER_PACKET : 0;
+            lastSeq = seq;
+            missed += missing;
+            for (uint8_t i = 0; i < S::PACKED_SAMPLES_PER_PACKET; i++) {
+                uint16_t time16;
+                memcpy(&time16, &packet[4 + i * S::PACKED_SAMPLE_SIZE + 9 * sizeof(int16_t)], sizeof(time16));
+                uint32_t time_us = time16;
+                if (received == 0) first = time_us;
+                else {
+                    uint16_t delta16 = time16 - (uint16_t) last;
+                    long wraps = lrintf(((missing + 1) * interval - delta16) / 65536.0f);
+                    time_us = last + delta16 + 65536 * (uint32_t) ((wraps > 0) ? wraps : 0);
+                    CHECK(time_us > last);
+                    lost += lrintf((time_us - last) / interval) - 1;
+                    missing = 0;
+                }
+                last = time_us;
+                received++;
+            }
+        }
+    }
+    printf("packed stream: %u samples received, %u lost, %u packets dropped\n", received, lost, link._dropped);
+    uint32_t dropped = link._dropped * S::PACKED_SAMPLES_PER_PACKET;
+    CHECK(dropped * interval > 65536);    // gap wrapped the time
+    CHECK(missed == dropped);
+    // times of FIFO frames are spread over the read interval, a gap may round samples off
+    CHECK(lost + 2 >= dropped && lost <= dropped + 2);
+    CHECK_NEAR((last - first) / interval, received + dropped - 1, 1.0);
+}
+
+// Window of 64 recognizable samples frozen by a host trigger
+static void freeze(BlackBox& box){
+    box.arm(0, 0, 0);
+    for (int16_t n = 0; n < 64; n++) {
+        int16_t raw[M::RAW_DATA_SIZE] = {n, (int16_t)(n * 3), 0, 0, 0, 0, 0, 0, (int16_t) -n};
+        float sensor_data[M::RAW_DATA_SIZE] = {0};
+        box.add(raw, sensor_data, 0.001f);
+    }
+    box.trigger(BlackBox::CAUSE_HOST);
+}
+
+static void testBlackBoxUpload(){
+    Device device;
+    StaticBlackBox<64> box;
+    device.sensor._blackBox = &box;
+    freeze(box);
+    CHECK(box._state == BlackBox::FROZEN);
+
+    // fragments lost within a window are asked for again, the lost last one is sent again after the timeout
+    Host host;
+    host.drop = {3, 9, 10, 24};
+    const uint8_t status[Transport::PACKET_SIZE] = {CMD_BLACKBOX, 0};
+    device.link.hostSend(status);
+    run(device, host, FRAGMENT_ACK_TIMEOUT * 1000 + 50000);
+    const uint16_t samplesAt = BlackBoxCommand::STATUS_LEN + BlackBoxCommand::HEADER_LEN;
+    CHECK(host.complete);
+    CHECK(host.resends == 2);     // 3 and 9, the window of 9 lost 10 as well
+    CHECK(host.message.size() == samplesAt + 64 * sizeof(BlackBox::Sample));
+    if (host.message.size() == samplesAt + 64 * sizeof(BlackBox::Sample)) {
+        for (uint16_t n = 0; n < 64; n++) {
+            BlackBox::Sample sample;
+            memcpy(&sample, &host.message[samplesAt + n * sizeof(sample)], sizeof(sample));
+            CHECK(sample._raw[0] == n && sample._raw[1] == n * 3 && sample._raw[8] == -n);
+        }
+    }
+    CHECK(box._state == BlackBox::ARMED);
+    CHECK(device.link._dropped == 0);
+
+    // host that never acknowledges leaves the window frozen, the next request uploads it
+    freeze(box);
+    Host silent;
+    silent.acks = false;
+    device.link.hostSend(status);
+    run(device, silent, 50000);
+    CHECK(!silent.complete && (silent.next == FRAGMENT_WINDOW));
+    CHECK(box._state == BlackBox::FROZEN);
+    CHECK(device.commands.activeCount() == 1);
+    run(device, silent, (FRAGMENT_RETRIES + 1) * FRAGMENT_ACK_TIMEOUT * 1000 + 50000);
+    CHECK(device.commands.activeCount() == 0);
+    CHECK(box._state == BlackBox::FROZEN);
+
+    Host retry;
+    device.link.hostSend(status);
+    run(device, retry, 50000);
+    CHECK(retry.complete);
+    CHECK(retry.message == host.message);
+    CHECK(box._state == BlackBox::ARMED);
+}
+
+static void testMagCalibrationPolling(){
+    Device device;
+    Host host;
+    device.sensor.setOutputDataRate(1000);
+    const uint8_t calibrate[Transport::PACKET_SIZE] = {CMD_MAG_CALIB, 0};
+    device.link.hostSend(calibrate);
+    device.loop();
+    MagCalibrator& calibrator = device.sensor._magCalibrator;
+    CHECK(calibrator._active);
+    CHECK(device.bus.sampleRate() == 1000);
+
+    // one read per sample, the magnetometer part only when it brings a new magnetometer sample, which counts even
+    // though it equals the last one at rest
+    const uint32_t us = 120000;
+    uint32_t transfers = device.bus._transfers;
+    uint32_t samples = calibrator._samples;
+    run(device, host, us);
+    uint32_t reads = us / 1000, magReads = reads / device.bus._magPeriod;
+    transfers = device.bus._transfers - transfers;
+    samples = calibrator._samples - samples;
+    printf("calibration polling: %u samples, %u transfers\n", samples, transfers);
+    CHECK(transfers <= reads + magReads + 2);
+    CHECK(transfers >= reads / 2);
+    CHECK(samples + 2 >= magReads && samples <= magReads + 1);
+
+    // started stream stops calibration, started again it is fed by the stream, every FIFO frame once
+    device.sensor.setFifoMode(true);
+    const uint8_t start[Transport::PACKET_SIZE] = {CMD_START_SENSORS, 1, 1};
+    device.link.hostSend(start);
+    device.loop();
+    CHECK(device.sensor._streaming);
+    device.link.hostSend(calibrate);
+    device.loop();
+    CHECK(calibrator._active);
+    run(device, host, us);
+    CHECK(host.samples > 0);
+    printf("stream fed calibration: %u samples\n", calibrator._samples);
+    CHECK(calibrator._samples + 2 >= (int) magReads && calibrator._samples <= magReads + 1);
+    CHECK(host.badSamples == 0);
+    device.commands.releaseAll();
+    CHECK(!device.sensor._streaming);
+}
+
+int main(){
+    testDumpWhileStreaming();
+    testPackedTimeline();
+    testBlackBoxUpload();
+    testMagCalibrationPolling();
+    return checkResult("commandtest");
+}
@@ -0,0 +1,38 @@
+#ifndef CSV_h
+#define CSV_h
+
+// Recorded sensor data of data/*.csv as saved by the host tool, one sample per row:
+// ax, ay, az (m/s^2), gx, gy, gz (rad/s), hx, hy, hz (uT), t, q0..q3
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+typedef std::vector<std::vector<float> > CsvRows;
+
+static const char* const DEFAULT_CSV[] = {"../data/sensor_data_mag_calib.csv", "../data/sensor_data_mag_uncalib.csv"};
+
+inline bool loadCsv(const char* path, CsvRows& rows){
+    FILE* file = fopen(path, "r");
+    if (!file) return false;
+    char line[1024];
+    while (fgets(line, sizeof(line), file)) {
+        std::vector<float> row;
+        for (char* s = line; *s; ) {
+            char* end;
+            float v = strtof(s, &end);
+            if (end == s) break;
+            row.push_back(v);
+            s = (*end == ',') ? end + 1 : end;
+        }
+        if (row.size() >= 10) rows.push_back(row);
+    }
+    fclose(file);
+    return true;
+}
+
+// Magnetometer runs slower than the stream, a row repeating the previous field is a held sample
+inline bool magFresh(const CsvRows& rows, size_t i){
+    return (i == 0) || (rows[i][6] != rows[i - 1][6]) || (rows[i][7] != rows[i - 1][7]) || (rows[i][8] != rows[i - 1][8]);
+}
+
+#endif
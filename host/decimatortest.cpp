@@ -0,0 +1,103 @@
+// CIC decimator (decimator.h) of the stream output: gain measured with sines against |sin(pi f R) / (R sin(pi f))|^2
+// of the order 2 filter, in the pass band and around the first null, where tones that would fold next to DC land.
+// Tones at multiples of the output rate must vanish, DC must pass exactly at the largest factor with full scale
+// input, and factors the integer state can't take are rejected.
+#include "Arduino.h"
+#include "../decimator.h"
+#include "check.h"
+
+typedef CicDecimator<1> Decimator;
+
+static const uint16_t FACTOR = 8;
+static const uint16_t OUTPUTS = 64;         // per measurement, tones complete whole cycles in them
+static const float AMPLITUDE = 8000.0f;     // counts
+
+static double expectedGain(double f, uint16_t factor){
+    double h = sin(M_PI * f * factor) / (factor * sin(M_PI * f));
+    return h * h;
+}
+
+// Amplitude of the tone at f cycles per input sample in the output, which sees it at f * factor cycles per sample
+static double measureGain(double f, uint16_t factor){
+    Decimator decimator;
+    CHECK(decimator.setFactor(factor));
+    double c = 0.0, s = 0.0;
+    uint16_t settle = 2, outputs = 0;
+    for (uint32_t n = 0; outputs < settle + OUTPUTS; n++) {
+        int16_t in = (int16_t) lrint(AMPLITUDE * sin(2.0 * M_PI * f * n + 0.3));
+        int16_t out;
+        if (!decimator.add(&in, &out)) continue;
+        if (outputs >= settle) {
+            double phase = 2.0 * M_PI * f * factor * (outputs - settle);
+            c += out * cos(phase);
+            s += out * sin(phase);
+        }
+        outputs++;
+    }
+    return 2.0 * sqrt(c * c + s * s) / OUTPUTS / AMPLITUDE;
+}
+
+static void testResponse(){
+    // f * FACTOR * OUTPUTS whole cycles, away from DC and Nyquist of the output
+    const uint16_t passBand[] = {1, 3, 8, 16, 24, 31};
+    for (uint16_t p : passBand) {
+        double f = p / (double)(FACTOR * OUTPUTS);
+        double gain = measureGain(f, FACTOR), expected = expectedGain(f, FACTOR);
+        printf("f = %.4f fs: gain %.4f, expected %.4f\n", f, gain, expected);
+        CHECK_NEAR(gain, expected, 0.002);
+    }
+    // next to the first null, folds to p / OUTPUTS of the output rate
+    const uint16_t aliased[] = {1, 2, 4, 8};
+    for (uint16_t p : aliased) {
+        double f = (OUTPUTS + p) / (double)(FACTOR * OUTPUTS);
+        double gain = measureGain(f, FACTOR), expected = expectedGain(f, FACTOR);
+        printf("f = %.4f fs: gain %.5f, expected %.5f\n", f, gain, expected);
+        CHECK_NEAR(gain, expected, 0.0005);
+        CHECK(gain < 0.01 * p * p);
+    }
+}
+
+static void testNulls(){
+    for (uint16_t k = 1; k < FACTOR; k++) {
+        Decimator decimator;
+        decimator.setFactor(FACTOR);
+        int16_t worst = 0;
+        for (uint32_t n = 0; n < FACTOR * 100; n++) {
+            int16_t in = (int16_t) lrint(AMPLITUDE * cos(2.0 * M_PI * k * n / FACTOR));
+            int16_t out;
+            if (decimator.add(&in, &out) && (n >= 2 * FACTOR)) worst = (abs(out) > worst) ? abs(out) : worst;
+        }
+        CHECK(worst <= 1);
+    }
+}
+
+static void testFullScale(){
+    const int16_t levels[] = {32767, -32768};
+    for (int16_t level : levels) {
+        Decimator decimator;
+        CHECK(decimator.setFactor(Decimator::MAX_FACTOR));
+        int16_t out = 0;
+        uint16_t outputs = 0;
+        for (uint32_t n = 0; outputs < 10; n++) {
+            if (!decimator.add(&level, &out)) continue;
+            if (++outputs >= 2) CHECK(out == level);
+        }
+    }
+}
+
+static void testFactorRange(){
+    Decimator decimator;
+    CHECK(decimator.setFactor(4));
+    CHECK(!decimator.setFactor(0));
+    CHECK(!decimator.setFactor(Decimator::MAX_FACTOR + 1));
+    CHECK(decimator._factor == 4);
+    CHECK(Decimator::MAX_FACTOR == 255);
+}
+
+int main(){
+    testResponse();
+    testNulls();
+    testFullScale();
+    testFactorRange();
+    return checkResult("decimatortest");
+}
@@ -0,0 +1,104 @@
+// DMP setup against the register file of fakebus.h: the configuration setupDmp() writes is the one the driver state
+// says (scales of the raw data read alongside, stored configuration, register shadow), quaternions come through
+// FIFO, and setup() without DMP leaves it off again.
+#include "MPU9250.h"
+#include "../sensorarray.h"
+#include "../commands.h"
+#include "../loopbacktransport.h"
+#include "fakebus.h"
+#include "check.h"
+
+typedef MPU9250 M;
+
+static uint8_t image[3062];
+
+static void testSetup(){
+    FakeBus bus;
+    MPU9250 sensor(&bus);
+    sensor.setAlgorythm(M::DMP);
+    sensor.setDmpImage(image, sizeof(image));
+    sensor.setup();
+    CHECK(!sensor._dmpReady);
+    CHECK(sensor.setupDmp());
+    CHECK(sensor._dmpReady);
+    CHECK(memcmp(bus._dmpMem, image, M::DMP_D_0_22) == 0);    // configuration keys are written over the image
+
+    CHECK(bus._regs[M::SMPLRT_DIV] == 1000 / M::DMP_SAMPLE_RATE - 1);
+    CHECK((bus._regs[M::CONFIG] & 0x07) == 0x03);
+    CHECK(bus._regs[M::GYRO_CONFIG] == 0x18);
+    CHECK(sensor._gyroRes == M::DPS2000);
+    CHECK(sensor._gyroDLPF == M::BW_41Hz);
+    CHECK(sensor._sampleRateDiv == bus._regs[M::SMPLRT_DIV]);
+    CHECK_NEAR(sensor.outputDataRate(), M::DMP_SAMPLE_RATE, 0.01);
+    CHECK(sensor.verifyRegisters() == 0);
+
+    CalibrationRecord record;
+    sensor.captureCalibration(record);
+    CHECK(record.gyroRes == M::DPS2000);
+    CHECK(record.outputDataRate == M::DMP_SAMPLE_RATE);
+
+    // raw gyro read alongside DMP is scaled for the range DMP runs at
+    bus._gyro[0] = 16384;
+    bus.setRealTime(false);
+    bus.advance(10000);
+    float sensor_data[StartSensorsCommand::SENSOR_DATA_SIZE];
+    sensor.readData(&sensor_data[0]);
+    float rate = sqrtf(sensor_data[3] * sensor_data[3] + sensor_data[4] * sensor_data[4] + sensor_data[5] * sensor_data[5]);
+    CHECK_NEAR(rate / M::d2r, 16384 * 2000.0 / 32767.5, 1.0);
+
+    // quaternions through FIFO
+    while (sensor.readDmpQuaternions(&sensor_data[0], 4) > 0);
+    bus._dmpQuat[0] = 0;
+    bus._dmpQuat[2] = 1 << 30;
+    bus.advance(3 * 1000000 / M::DMP_FIFO_RATE);
+    float q[M::FIFO_BURST_FRAMES * 4];
+    CHECK(sensor.readDmpQuaternions(&q[0], M::FIFO_BURST_FRAMES) == 3);
+    CHECK_NEAR(q[8], 0.0, 1e-6);
+    CHECK_NEAR(q[10], 1.0, 1e-6);
+
+    // back to sample by sample reads
+    sensor.setAlgorythm(M::MADGWICK);
+    sensor.setup();
+    CHECK(!sensor._dmpReady);
+    CHECK(!(bus._regs[M::USER_CTRL] & (1 << M::DMP_EN)));
+    SensorArray array;
+    array.add(&sensor);
+    CHECK(array.isAsync(0));
+}
+
+// DMP selected through the stream command, quaternion packets carry the DMP estimate
+static void testStream(){
+    FakeBus bus;
+    MPU9250 sensor(&bus);
+    sensor.setAlgorythm(M::DMP);
+    sensor.setDmpImage(image, sizeof(image));
+    bus._dmpQuat[0] = 0;
+    bus._dmpQuat[3] = 1 << 30;
+    SensorArray array;
+    array.add(&sensor);
+    LoopbackTransport<> link;
+    byte request[Transport::PACKET_SIZE] = {CMD_START_SENSORS, 1, 1};
+    StartSensorsCommand command(&array, &link, request);
+    command.setup();
+    CHECK(sensor._dmpReady);
+    uint32_t packets = 0;
+    unsigned long start = micros();
+    while (micros() - start < 50000) {
+        command.exec();
+        uint8_t packet[Transport::PACKET_SIZE];
+        while (link.hostRecv(packet)) {
+            float sensor_data[StartSensorsCommand::SENSOR_DATA_SIZE];
+            memcpy(sensor_data, &packet[3], sizeof(sensor_data));
+            CHECK_NEAR(sensor_data[13], 1.0, 1e-6);
+            packets++;
+        }
+    }
+    CHECK(packets > 0);
+}
+
+int main(){
+    for (size_t i = 0; i < sizeof(image); i++) image[i] = i * 7 + (i >> 8);
+    testSetup();
+    testStream();
+    return checkResult("dmptest");
+}
@@ -0,0 +1,117 @@
+// Cost of one QuaternionEKF update next to Madgwick and Mahony, float as on the MCU, over recorded data
+// (data/*.csv). Predict and correct are timed separately as well. Reports ns per update and CPU cycles per update
+// where the kernel gives access to the cycle counter (perf events), best of TIMING_PASSES passes over the file.
+// On the Teensy the same updates are timed in cycles by the profiler, see CMD_TIMING.
+//   ./ekfbench [-r rate_hz] [file.csv ...]
+#include <algorithm>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "Arduino.h"
+#include "../filters.h"
+#include "../ekf.h"
+#include "../timing.h"
+#include "csv.h"
+
+static const int TIMING_PASSES = 20;
+
+// CPU cycles of this thread in user space, -1 if there is no counter
+class CycleCounter {
+public:
+    int _fd;
+
+    CycleCounter(){
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        _fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    ~CycleCounter(){
+        if (_fd >= 0) close(_fd);
+    }
+
+    int64_t read(){
+        uint64_t count;
+        if ((_fd < 0) || (::read(_fd, &count, sizeof(count)) != sizeof(count))) return -1;
+        return count;
+    }
+};
+
+enum Kernel { MADGWICK, MAHONY, EKF, EKF_PREDICT, EKF_CORRECT };
+static const char* const kernelNames[] = {"MADGWICK", "MAHONY", "EKF", "EKF predict", "EKF correct"};
+
+struct Cost {
+    uint64_t ns;
+    int64_t cycles;
+};
+
+static Cost run(const CsvRows& rows, Kernel kernel, float deltat, CycleCounter& counter){
+    float q[4] = {1.0f, 0.0f, 0.0f, 0.0f};
+    float eInt[3] = {0.0f, 0.0f, 0.0f};
+    QuaternionEKF<float> ekf;
+    std::vector<float> data(rows.size() * 9);
+    for (size_t n = 0; n < rows.size(); n++)
+        for (uint8_t i = 0; i < 9; i++) data[n * 9 + i] = rows[n][i];
+
+    Cost cost = {0, 0};
+    for (size_t n = 0; n < rows.size(); n++) {
+        float* sensor_data = &data[n * 9];
+        bool fresh = magFresh(rows, n);
+        if (kernel == EKF_CORRECT) ekf.predict(sensor_data[3], sensor_data[4], sensor_data[5], deltat);
+        int64_t cycles = counter.read();
+        uint32_t start = cycleCount();
+        switch (kernel) {
+            case MADGWICK:    MadgwickQuaternionUpdate(sensor_data, q, deltat, fresh); break;
+            case MAHONY:      MahonyQuaternionUpdate(sensor_data, eInt, q, deltat, fresh); break;
+            case EKF:         ekf.update(sensor_data, deltat, fresh); break;
+            case EKF_PREDICT: ekf.predict(sensor_data[3], sensor_data[4], sensor_data[5], deltat); break;
+            case EKF_CORRECT: ekf.correct(sensor_data, fresh); break;
+        }
+        cost.ns += cycleCount() - start;
+        cost.cycles = (cycles < 0) ? -1 : cost.cycles + counter.read() - cycles;
+        if (kernel == EKF_PREDICT) ekf.correct(sensor_data, fresh);
+    }
+    return cost;
+}
+
+int main(int argc, char** argv){
+    float rate = 50.0f;     // data/*.csv streams were recorded at ~50 Hz
+    std::vector<const char*> paths;
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-r") == 0) && (i + 1 < argc)) rate = atof(argv[++i]);
+        else paths.push_back(argv[i]);
+    }
+    if (paths.empty()) paths.assign(DEFAULT_CSV, DEFAULT_CSV + 2);
+
+    CycleCounter counter;
+    for (const char* path : paths) {
+        CsvRows rows;
+        if (!loadCsv(path, rows) || rows.empty()) {
+            fprintf(stderr, "Can't read %s\n", path);
+            return 1;
+        }
+        printf("%s: %zu samples at %.0f Hz\n", path, rows.size(), rate);
+        printf("%-12s %10s %14s %10s\n", "kernel", "ns/update", "cycles/update", "x MADGWICK");
+        double madgwick = 0.0;
+        for (Kernel kernel : {MADGWICK, MAHONY, EKF, EKF_PREDICT, EKF_CORRECT}) {
+            Cost best = run(rows, kernel, 1.0f / rate, counter);
+            for (int i = 1; i < TIMING_PASSES; i++) {
+                Cost cost = run(rows, kernel, 1.0f / rate, counter);
+                if (cost.ns < best.ns) best.ns = cost.ns;
+                if ((cost.cycles >= 0) && (cost.cycles < best.cycles)) best.cycles = cost.cycles;
+            }
+            double ns = (double) best.ns / rows.size();
+            if (kernel == MADGWICK) madgwick = ns;
+            printf("%-12s %10.1f ", kernelNames[kernel], ns);
+            if (best.cycles < 0) printf("%14s", "n/a");
+            else printf("%14.1f", (double) best.cycles / rows.size());
+            printf(" %10.2f\n", ns / madgwick);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,85 @@
+// Ellipsoid fit (ellipsoidfit.h) on the magnetometer samples of recorded data (data/*.csv): each recording is fitted
+// as is and again with soft iron scaling the axes by 1.1, 0.9, 1.0 plus a hard iron offset large enough to put the
+// origin outside the ellipsoid. Corrected distorted samples must lie on a sphere as well as the undistorted ones do,
+// and its radius must be the undistorted one times the geometric mean of the axis scales, as the fit keeps the
+// ellipsoid volume.
+#include "Arduino.h"
+#include "../ellipsoidfit.h"
+#include "csv.h"
+#include "check.h"
+
+static const float SCALE[3] = {1.1f, 0.9f, 1.0f};
+static const float OFFSET[3] = {40.0f, -50.0f, 20.0f};     // uT, more than the earth field
+
+struct Fitted {
+    float bias[3];
+    float softIron[3][3];
+
+    void correct(const float* m, float* out) const {
+        for (uint8_t i = 0; i < 3; i++)
+            out[i] = softIron[i][0] * (m[0] - bias[0]) + softIron[i][1] * (m[1] - bias[1]) + softIron[i][2] * (m[2] - bias[2]);
+    }
+};
+
+static void distort(const std::vector<float>& row, float* m){
+    for (uint8_t i = 0; i < 3; i++) m[i] = row[6 + i] * SCALE[i] + OFFSET[i];
+}
+
+static float norm(const float* v){
+    return sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+}
+
+static bool fit(const CsvRows& rows, bool distorted, Fitted& fitted){
+    EllipsoidFit<float> ellipsoid;
+    for (size_t i = 0; i < rows.size(); i++) {
+        if (!magFresh(rows, i)) continue;
+        float m[3] = {rows[i][6], rows[i][7], rows[i][8]};
+        if (distorted) distort(rows[i], m);
+        ellipsoid.addSample(m);
+    }
+    return ellipsoid.solve(fitted.bias, fitted.softIron);
+}
+
+// Samples of a recording made with calibration applied are on a sphere already, fit must keep its radius
+static void testRecording(const char* path, bool calibrated){
+    CsvRows rows;
+    CHECK(loadCsv(path, rows) && !rows.empty());
+    if (rows.empty()) return;
+
+    Fitted plain, distorted;
+    CHECK(fit(rows, false, plain));
+    CHECK(fit(rows, true, distorted));
+    const float volumeScale = cbrtf(SCALE[0] * SCALE[1] * SCALE[2]);
+
+    double sumRaw = 0.0, sumPlain = 0.0, sumDistorted = 0.0, squaresPlain = 0.0, squaresDistorted = 0.0;
+    size_t n = 0;
+    for (size_t i = 0; i < rows.size(); i++) {
+        if (!magFresh(rows, i)) continue;
+        float m[3] = {rows[i][6], rows[i][7], rows[i][8]};
+        float d[3], a[3], b[3];
+        distort(rows[i], d);
+        plain.correct(m, a);
+        distorted.correct(d, b);
+        sumRaw += norm(m);
+        sumPlain += norm(a);
+        sumDistorted += norm(b);
+        squaresPlain += norm(a) * norm(a);
+        squaresDistorted += norm(b) * norm(b);
+        n++;
+    }
+    double meanRaw = sumRaw / n, meanPlain = sumPlain / n, meanDistorted = sumDistorted / n;
+    double spreadPlain = sqrt(fmax(0.0, squaresPlain / n - meanPlain * meanPlain)) / meanPlain;
+    double spreadDistorted = sqrt(fmax(0.0, squaresDistorted / n - meanDistorted * meanDistorted)) / meanDistorted;
+    printf("%s: %zu samples, raw |m| %.2f uT, corrected %.2f uT spread %.2f%%, distorted %.2f uT spread %.2f%%\n",
+        path, n, meanRaw, meanPlain, 100.0 * spreadPlain, meanDistorted, 100.0 * spreadDistorted);
+    if (calibrated) CHECK_NEAR(meanPlain / meanRaw, 1.0, 0.02);
+    CHECK_NEAR(meanDistorted / meanPlain, volumeScale, 0.005);
+    CHECK(spreadDistorted < spreadPlain + 0.005);
+    for (uint8_t i = 0; i < 3; i++) CHECK_NEAR(distorted.bias[i], plain.bias[i] * SCALE[i] + OFFSET[i], 1.0);
+}
+
+int main(){
+    testRecording(DEFAULT_CSV[0], true);
+    testRecording(DEFAULT_CSV[1], false);
+    return checkResult("ellipsoidtest");
+}
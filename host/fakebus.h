@@ -0,0 +1,250 @@
+#ifndef FAKEBUS_h
+#define FAKEBUS_h
+
+#include <deque>
+#include "MPU9250.h"
+
+// MPU9250 register file for host tests, with the chip behaviour the driver depends on: defaults after H_RESET,
+// self clearing USER_CTRL bits, INT_STATUS cleared by reading it, samples at the rate SMPLRT_DIV, CONFIG and
+// GYRO_CONFIG give, a 512 byte FIFO popped through FIFO_R_W (burst reads stay on it), and an AK8963 behind the
+// I2C master SLV0. Samples are generated as micros() goes by, delay() included, or by advance() once realTime
+// is off. Sensor values are in chip axes and counts: _accel, _gyro (before XG_OFFSET_*), _temp, _mag.
+// DMP memory is written and read through BANK_SEL, MEM_START_ADDR and MEM_R_W. With DMP_EN the DMP pushes _dmpQuat
+// (Q30 w, x, y, z) as a low power quaternion packet at the FIFO rate set in its memory instead of sensor frames.
+class FakeBus final : public Bus {
+public:
+    typedef MPU9250 M;
+    static const uint16_t FIFO_SIZE = 512;
+
+    uint8_t _regs[128];
+    uint8_t _magRegs[AK8963::ASAZ + 1];
+    uint8_t _dmpMem[4096];
+    int32_t _dmpQuat[4] = {1 << 30, 0, 0, 0};
+    std::deque<uint8_t> _fifo;
+    int16_t _accel[3] = {0, 0, 16384};
+    int16_t _gyro[3] = {0, 0, 0};
+    int16_t _temp = 0;
+    int16_t _mag[3] = {100, 200, -300};
+    uint16_t _magPeriod = 10;       // samples per magnetometer update
+    uint32_t _samples;              // since reset
+    uint32_t _fifoOverflows;
+    bool _realTime = true;
+    unsigned long _clock;           // micros() samples were generated up to
+    uint32_t _due;                  // us of the next sample
+    uint32_t _reads[128];           // bus reads and writes starting at a register
+    uint32_t _writes[128];
+    uint32_t _transfers;
+    uint32_t _readBytes;            // of MPU9250 reads
+
+    FakeBus(){
+        reset();
+        for (uint8_t i = 0; i < 3; i++) _magRegs[AK8963::ASAX + i] = 128;
+        memset(_dmpMem, 0, sizeof(_dmpMem));
+        memset(_reads, 0, sizeof(_reads));
+        memset(_writes, 0, sizeof(_writes));
+        _transfers = 0;
+        _readBytes = 0;
+    }
+
+    void reset(){
+        memset(_regs, 0, sizeof(_regs));
+        _regs[M::PWR_MGMT_1] = 0x01;
+        _regs[0x75] = 0x71;     // WHO_AM_I
+        memset(_magRegs, 0, AK8963::ASAX);
+        _magRegs[AK8963::WIA] = 0x48;
+        _fifo.clear();
+        _samples = 0;
+        _fifoOverflows = 0;
+        _clock = micros();
+        _due = 0;
+    }
+
+    // Hz, what the gyro writes data registers and FIFO with
+    uint32_t sampleRate(){
+        if (_regs[M::GYRO_CONFIG] & 0x03) return 32000;   // FCHOICE_B, DLPF bypassed
+        uint8_t dlpf = _regs[M::CONFIG] & 0x07;
+        if ((dlpf == 0) || (dlpf == 7)) return 8000;
+        return 1000 / (1 + _regs[M::SMPLRT_DIV]);
+    }
+
+    void setRealTime(bool enable){
+        update();
+        _realTime = enable;
+    }
+
+    // Generates the samples of us microseconds
+    void advance(uint32_t us){
+        uint32_t period = 1000000 / sampleRate();
+        _due += us;
+        while (_due >= period) {
+            _due -= period;
+            sample();
+        }
+    }
+
+    void update(){
+        if (!_realTime) return;
+        unsigned long now = micros();
+        unsigned long elapsed = now - _clock;
+        _clock = now;
+        advance(elapsed < 1000000 ? elapsed : 1000000);
+    }
+
+    void sample(){
+        _samples++;
+        uint8_t fs = (_regs[M::GYRO_CONFIG] >> 3) & 0x03;
+        uint8_t* data = &_regs[M::ACCEL_OUT];
+        for (uint8_t i = 0; i < 3; i++){
+            int16_t offset = (int16_t)((_regs[M::XG_OFFSET_H + 2 * i] << 8) | _regs[M::XG_OFFSET_H + 2 * i + 1]);
+            int16_t gyro = _gyro[i] + ((offset * 4) >> fs);
+            data[2 * i] = _accel[i] >> 8;
+            data[2 * i + 1] = _accel[i] & 0xFF;
+            data[8 + 2 * i] = gyro >> 8;
+            data[8 + 2 * i + 1] = gyro & 0xFF;
+        }
+        data[6] = _temp >> 8;
+        data[7] = _temp & 0xFF;
+
+        if (_samples % _magPeriod == 0) {
+            _magRegs[AK8963::ST1] |= AK8963::ST1_DRDY;
+            memcpy(&_magRegs[AK8963::HXL], _mag, sizeof(_mag));
+            _magRegs[AK8963::ST2] = 0x10;
+        }
+        uint8_t slaveCount = 0;
+        if ((_regs[M::I2C_SLV0_CTRL] & M::I2C_SLV0_EN) && (_regs[M::I2C_SLV0_ADDR] & M::I2C_READ_FLAG)) {
+            slaveCount = _regs[M::I2C_SLV0_CTRL] & 0x0F;
+            slaveRead();
+        }
+        _regs[M::INT_STATUS] |= 0x01;   // RAW_DATA_RDY
+
+        if (!(_regs[M::USER_CTRL] & (1 << M::FIFO_MODE_EN))) return;
+        std::deque<uint8_t> frame;
+        uint8_t fifoEn = _regs[M::FIFO_EN];
+        if (_regs[M::USER_CTRL] & (1 << M::DMP_EN)) {
+            uint16_t rateDiv = (_dmpMem[M::DMP_D_0_22] << 8) | _dmpMem[M::DMP_D_0_22 + 1];
+            if (_samples % (rateDiv + 1)) return;
+            for (uint8_t i = 0; i < 4; i++)
+                for (int8_t shift = 24; shift >= 0; shift -= 8) frame.push_back((uint32_t) _dmpQuat[i] >> shift);
+            fifoEn = 0;
+        }
+        if (fifoEn & M::ACCEL_FIFO_EN) frame.insert(frame.end(), &data[0], &data[6]);
+        if (fifoEn & M::TEMP_FIFO_EN) frame.insert(frame.end(), &data[6], &data[8]);
+        for (uint8_t i = 0; i < 3; i++)
+            if (fifoEn & (0x40 >> i)) frame.insert(frame.end(), &data[8 + 2 * i], &data[10 + 2 * i]);
+        if (fifoEn & M::SLV0_FIFO_EN) frame.insert(frame.end(), &_regs[M::EXT_SENS_DATA_00], &_regs[M::EXT_SENS_DATA_00 + slaveCount]);
+        if (frame.empty()) return;
+        while (_fifo.size() + frame.size() > FIFO_SIZE) {
+            _fifo.pop_front();  // oldest bytes are overwritten, frame alignment is lost
+            if (!(_regs[M::INT_STATUS] & (1 << M::FIFO_OFLOW_INT))) _fifoOverflows++;
+            _regs[M::INT_STATUS] |= 1 << M::FIFO_OFLOW_INT;
+        }
+        _fifo.insert(_fifo.end(), frame.begin(), frame.end());
+    }
+
+    // SLV0 read into EXT_SENS_DATA, reading ST2 clears data ready like on the AK8963
+    void slaveRead(){
+        uint8_t reg = _regs[M::I2C_SLV0_REG];
+        uint8_t count = _regs[M::I2C_SLV0_CTRL] & 0x0F;
+        for (uint8_t i = 0; i < count; i++)
+            _regs[M::EXT_SENS_DATA_00 + i] = (reg + i < (int) sizeof(_magRegs)) ? _magRegs[reg + i] : 0;
+        if ((reg <= AK8963::ST2) && (reg + count > AK8963::ST2)) _magRegs[AK8963::ST1] &= ~AK8963::ST1_DRDY;
+    }
+
+    uint8_t readByte(uint8_t address, uint8_t subAddress, bool fast = false){
+        uint8_t data;
+        readBytes(address, subAddress, 1, &data, fast);
+        return data;
+    }
+
+    bool writeByte(uint8_t address, uint8_t subAddress, uint8_t data){
+        update();
+        _transfers++;
+        if (address != AK8963::I2C_ADDRESS) _writes[subAddress]++;
+        return write(address, subAddress, data);
+    }
+
+    // Burst is one transfer, no sample is taken between its bytes
+    bool writeBytes(uint8_t address, uint8_t subAddress, uint8_t count, const uint8_t* data){
+        update();
+        _transfers++;
+        if (address != AK8963::I2C_ADDRESS) _writes[subAddress]++;
+        bool res = true;
+        for (uint8_t i = 0; i < count; i++) {
+            res &= write(address, subAddress, data[i]);
+            if ((subAddress != M::FIFO_R_W) && (subAddress != M::MEM_R_W)) subAddress++;
+        }
+        return res;
+    }
+
+    bool write(uint8_t address, uint8_t subAddress, uint8_t data){
+        if (address == AK8963::I2C_ADDRESS) {     // I2C bypass
+            if (subAddress < sizeof(_magRegs)) _magRegs[subAddress] = data;
+            return true;
+        }
+        if ((subAddress == M::PWR_MGMT_1) && (data & (1 << M::H_RESET))) {
+            reset();
+            return true;
+        }
+        if (subAddress == M::USER_CTRL) {
+            if (data & (1 << M::FIFO_RST)) _fifo.clear();
+            data &= ~M::selfClearingBits(M::USER_CTRL);
+        }
+        if (subAddress == M::MEM_R_W) {
+            _dmpMem[dmpAddress()] = data;
+            dmpAddressNext();
+            return true;
+        }
+        if ((subAddress == M::FIFO_R_W) || (subAddress == M::INT_STATUS)) return true;
+        _regs[subAddress] = data;
+        if ((subAddress == M::I2C_SLV0_CTRL) && (data & M::I2C_SLV0_EN)) {
+            if (_regs[M::I2C_SLV0_ADDR] & M::I2C_READ_FLAG) slaveRead();
+            else if (_regs[M::I2C_SLV0_REG] < sizeof(_magRegs)) _magRegs[_regs[M::I2C_SLV0_REG]] = _regs[M::I2C_SLV0_DO];
+        }
+        return true;
+    }
+
+    void readBytes(uint8_t address, uint8_t subAddress, uint8_t count, uint8_t* dest, bool fast = false){
+        update();
+        _transfers++;
+        if (address == AK8963::I2C_ADDRESS) {
+            for (uint8_t i = 0; i < count; i++)
+                dest[i] = (subAddress + i < (int) sizeof(_magRegs)) ? _magRegs[subAddress + i] : 0;
+            return;
+        }
+        _reads[subAddress]++;
+        _readBytes += count;
+        uint8_t reg = subAddress;
+        for (uint8_t i = 0; i < count; i++){
+            if (reg == M::FIFO_R_W) {
+                dest[i] = _fifo.empty() ? 0xFF : _fifo.front();
+                if (!_fifo.empty()) _fifo.pop_front();
+                if (subAddress == M::FIFO_R_W) continue;    // FIFO bursts don't advance the address
+            }
+            else if (reg == M::MEM_R_W) {
+                dest[i] = _dmpMem[dmpAddress()];
+                dmpAddressNext();
+                if (subAddress == M::MEM_R_W) continue;
+            }
+            else if (reg == M::FIFO_COUNTH) dest[i] = (_fifo.size() >> 8) & 0x1F;
+            else if (reg == M::FIFO_COUNTH + 1) dest[i] = _fifo.size() & 0xFF;
+            else dest[i] = (reg < sizeof(_regs)) ? _regs[reg] : 0;
+            reg++;
+        }
+        if ((subAddress <= M::INT_STATUS) && (subAddress + count > M::INT_STATUS)) _regs[M::INT_STATUS] = 0;
+    }
+
+    uint16_t dmpAddress(){
+        return ((_regs[M::BANK_SEL] << 8) | _regs[M::MEM_START_ADDR]) % sizeof(_dmpMem);
+    }
+
+    // Memory address auto increments within the bank
+    void dmpAddressNext(){
+        _regs[M::MEM_START_ADDR]++;
+    }
+
+    uint16_t fifoCount(){
+        return _fifo.size();
+    }
+};
+
+#endif
@@ -0,0 +1,133 @@
+// FIFO mode against the register file of fakebus.h: setup() at default settings keeps the FIFO from overflowing,
+// readFifo() leaves a frame the chip is still writing for the next call instead of resyncing, overflow resyncs
+// to a frame boundary, and the stream of StartSensorsCommand carries every FIFO sample whole.
+#include "MPU9250.h"
+#include "../sensorarray.h"
+#include "../commands.h"
+#include "../loopbacktransport.h"
+#include "fakebus.h"
+#include "check.h"
+
+typedef MPU9250 M;
+
+static void testDefaultRate(){
+    FakeBus bus;
+    MPU9250 sensor(&bus);
+    sensor.setFifoMode(true);
+    sensor.setup();
+    CHECK(bus.sampleRate() <= 1000);
+    CHECK(bus.sampleRate() == M::FIFO_DEFAULT_RATE);
+    CHECK((bus._regs[M::GYRO_CONFIG] & 0x03) == 0);
+    CHECK(sensor._gyroDLPF >= M::BW_184Hz);
+
+    // rate asked for is kept, DLPF follows it
+    FakeBus bus2;
+    MPU9250 sensor2(&bus2);
+    sensor2.setFifoMode(true);
+    sensor2.setOutputDataRate(100);
+    sensor2.setGyroDLPF(M::BW_8800Hz);
+    sensor2.setup();
+    CHECK(bus2.sampleRate() == 100);
+    CHECK((bus2._regs[M::GYRO_CONFIG] & 0x03) == 0);
+}
+
+static void testPartialFrame(){
+    FakeBus bus;
+    MPU9250 sensor(&bus);
+    sensor.setFifoMode(true);
+    sensor.setup();
+    bus.setRealTime(false);
+    uint8_t frames[M::FIFO_BURST_FRAMES * M::FIFO_FRAME_SIZE];
+    while (sensor.readFifo(frames, M::FIFO_BURST_FRAMES) > 0);
+    CHECK(bus.fifoCount() == 0);
+    uint32_t overflows = sensor._fifoOverflows;
+
+    bus._accel[0] = 1234;
+    bus.advance(2000);      // 2 frames
+    bus.sample();           // third one, the chip is still writing its last 17 bytes
+    std::deque<uint8_t> rest(bus._fifo.end() - 17, bus._fifo.end());
+    bus._fifo.erase(bus._fifo.end() - 17, bus._fifo.end());
+    CHECK(sensor.readFifo(frames, M::FIFO_BURST_FRAMES) == 2);
+    CHECK(bus.fifoCount() == M::FIFO_FRAME_SIZE - 17);
+    CHECK(sensor._fifoOverflows == overflows);
+
+    bus._fifo.insert(bus._fifo.end(), rest.begin(), rest.end());
+    CHECK(sensor.readFifo(frames, M::FIFO_BURST_FRAMES) == 1);
+    int16_t raw[M::RAW_DATA_SIZE];
+    float sensor_data[StartSensorsCommand::SENSOR_DATA_SIZE];
+    sensor.parseData(frames, &raw[0], &sensor_data[0]);
+    CHECK(raw[0] == 1234);
+    CHECK(raw[2] == 16384);
+    CHECK(bus.fifoCount() == 0);
+    CHECK(sensor._fifoOverflows == overflows);
+}
+
+static void testOverflow(){
+    FakeBus bus;
+    MPU9250 sensor(&bus);
+    sensor.setFifoMode(true);
+    sensor.setup();
+    bus.setRealTime(false);
+    uint8_t frames[M::FIFO_BURST_FRAMES * M::FIFO_FRAME_SIZE];
+    bus.advance(100000);
+    CHECK(bus._fifoOverflows > 0);
+    uint32_t overflows = sensor._fifoOverflows;
+    CHECK(sensor.readFifo(frames, M::FIFO_BURST_FRAMES) == -1);
+    CHECK(sensor._fifoOverflows == overflows + 1);
+    CHECK(bus.fifoCount() == 0);
+
+    bus._accel[1] = -321;
+    bus.advance(3000);
+    CHECK(sensor.readFifo(frames, M::FIFO_BURST_FRAMES) == 3);
+    CHECK((int16_t)((frames[2 * M::FIFO_FRAME_SIZE + 2] << 8) | frames[2 * M::FIFO_FRAME_SIZE + 3]) == -321);
+}
+
+// Whole command path in real time: packets carry all SENSOR_DATA_SIZE values, sample times go up by about the
+// sample interval, and nothing overflows
+static void testStream(){
+    FakeBus bus;
+    MPU9250 sensor(&bus);
+    sensor.setFifoMode(true);
+    SensorArray array;
+    array.add(&sensor);
+    LoopbackTransport<> link;
+    byte request[Transport::PACKET_SIZE] = {CMD_START_SENSORS, 1, 1};
+    StartSensorsCommand command(&array, &link, request);
+    command.setup();
+    uint32_t samples = bus._samples;
+    uint32_t packets = 0;
+    uint32_t first = 0, last = 0;
+    unsigned long start = micros();
+    while (micros() - start < 50000) {
+        command.exec();
+        uint8_t packet[Transport::PACKET_SIZE];
+        while (link.hostRecv(packet)) {
+            CHECK(packet[0] == CMD_START_SENSORS);
+            CHECK(packet[1] == StartSensorsCommand::FLOAT_DATA_LEN);
+            float sensor_data[StartSensorsCommand::SENSOR_DATA_SIZE];
+            memcpy(sensor_data, &packet[3], sizeof(sensor_data));
+            CHECK_NEAR(sensor_data[2], M::G, 0.01);
+            uint32_t time_us;
+            memcpy(&time_us, &sensor_data[14], sizeof(time_us));
+            if (packets == 0) first = time_us;
+            else CHECK(time_us > last);
+            last = time_us;
+            CHECK(packet[3 + sizeof(sensor_data)] == 0);
+            packets++;
+        }
+    }
+    CHECK(link._dropped == 0);
+    CHECK(bus._fifoOverflows == 0);
+    CHECK(sensor._fifoOverflows == 0);
+    CHECK(packets > 1);
+    CHECK_NEAR((last - first) / (packets - 1.0), 1000000.0 / M::FIFO_DEFAULT_RATE, 100.0);
+    CHECK(packets + M::FIFO_SIZE / M::FIFO_FRAME_SIZE >= bus._samples - samples);
+}
+
+int main(){
+    testDefaultRate();
+    testPartialFrame();
+    testOverflow();
+    testStream();
+    return checkResult("fifotest");
+}
@@ -0,0 +1,89 @@
+// Madgwick and Mahony filters of filters.h instantiated for float, Q15.16 and Q7.24 fixed point (fixed.h), run over
+// recorded data (data/*.csv) next to the double instantiation. Reports ns per update and the angle between each
+// estimate and the double one: mean over the recording, maximum, and at the last sample.
+//   ./fixedbench [-r rate_hz] [file.csv ...]
+#include <algorithm>
+#include "Arduino.h"
+#include "../filters.h"
+#include "../timing.h"
+#include "csv.h"
+
+static const int TIMING_PASSES = 20;
+
+enum Filter { MADGWICK, MAHONY };
+
+// Runs rows through the filter once, quaternions after every update go to out (4 per row) if given.
+// Returns ns the updates took.
+template <typename T>
+static uint64_t run(const CsvRows& rows, Filter filter, float rate, std::vector<double>* out){
+    T q[4] = {T(1.0f), T(0.0f), T(0.0f), T(0.0f)};
+    T eInt[3] = {T(0.0f), T(0.0f), T(0.0f)};
+    T deltat = T(1.0f / rate);
+    std::vector<T> data(rows.size() * 9);
+    for (size_t n = 0; n < rows.size(); n++)
+        for (uint8_t i = 0; i < 9; i++) data[n * 9 + i] = T(rows[n][i]);
+
+    uint64_t total = 0;
+    for (size_t n = 0; n < rows.size(); n++) {
+        bool fresh = magFresh(rows, n);
+        uint32_t start = cycleCount();
+        if (filter == MADGWICK) MadgwickQuaternionUpdate<T>(&data[n * 9], q, deltat, fresh);
+        else MahonyQuaternionUpdate<T>(&data[n * 9], eInt, q, deltat, fresh);
+        total += cycleCount() - start;
+        if (out) for (uint8_t i = 0; i < 4; i++) out->push_back((double) q[i]);
+    }
+    return total;
+}
+
+static double angleDeg(const double* a, const double* b){
+    double dot = fabs(a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3]);
+    return 2.0 * acos(dot < 1.0 ? dot : 1.0) * 180.0 / M_PI;
+}
+
+template <typename T>
+static void bench(const char* name, const CsvRows& rows, Filter filter, float rate, const std::vector<double>& reference){
+    std::vector<double> q;
+    q.reserve(reference.size());
+    run<T>(rows, filter, rate, &q);
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < TIMING_PASSES; i++) best = std::min(best, run<T>(rows, filter, rate, nullptr));
+
+    double sum = 0.0, worst = 0.0, last = 0.0;
+    for (size_t n = 0; n < rows.size(); n++) {
+        last = angleDeg(&q[n * 4], &reference[n * 4]);
+        sum += last;
+        worst = std::max(worst, last);
+    }
+    printf("%-8s %-8s %10.1f %12.4f %12.4f %12.4f\n", (filter == MADGWICK) ? "MADGWICK" : "MAHONY", name,
+        (double) best / rows.size(), sum / rows.size(), worst, last);
+}
+
+int main(int argc, char** argv){
+    float rate = 50.0f;     // data/*.csv streams were recorded at ~50 Hz
+    std::vector<const char*> paths;
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-r") == 0) && (i + 1 < argc)) rate = atof(argv[++i]);
+        else paths.push_back(argv[i]);
+    }
+    if (paths.empty()) paths.assign(DEFAULT_CSV, DEFAULT_CSV + 2);
+
+    for (const char* path : paths) {
+        CsvRows rows;
+        if (!loadCsv(path, rows) || rows.empty()) {
+            fprintf(stderr, "Can't read %s\n", path);
+            return 1;
+        }
+        printf("%s: %zu samples at %.0f Hz\n", path, rows.size(), rate);
+        printf("%-8s %-8s %10s %12s %12s %12s\n", "filter", "scalar", "ns/update", "mean deg", "max deg", "last deg");
+        for (Filter filter : {MADGWICK, MAHONY}) {
+            std::vector<double> reference;
+            reference.reserve(rows.size() * 4);
+            run<double>(rows, filter, rate, &reference);
+            bench<double>("double", rows, filter, rate, reference);
+            bench<float>("float", rows, filter, rate, reference);
+            bench<Q16>("Q15.16", rows, filter, rate, reference);
+            bench<Fixed<24> >("Q7.24", rows, filter, rate, reference);
+        }
+    }
+    return 0;
+}
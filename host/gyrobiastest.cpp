@@ -0,0 +1,98 @@
+// Gyro bias tracking (gyrobias.h, MPU9250::trackGyroBias()) on recorded data (data/*.csv) played through the
+// register file of fakebus.h in FIFO mode, with a bias added after calibration. Recordings hardly rest, so each one
+// is played between REST_TIME s at rest, holding the first and last recorded acceleration. Offsets must go to XG_OFFSET_* in
+// one burst, and bias corrected rates must not jump when they do: frames taken before the write carry the old
+// offsets, so the software estimate has to keep its value until the first frame taken after it.
+#include <deque>
+#include "MPU9250.h"
+#include "fakebus.h"
+#include "csv.h"
+#include "check.h"
+
+typedef MPU9250 M;
+
+static const float BIAS[3] = {0.02f, -0.015f, 0.01f};     // rad/s
+static const uint16_t RATE = 50;                            // Hz, that of the recording
+static const uint8_t FRAMES_PER_READ = 8;
+static const uint32_t REST_TIME = 5;                        // s
+
+static int16_t counts(float v, float scale){
+    long c = lrintf(v / scale);
+    return (int16_t)(c > 32767 ? 32767 : (c < -32768 ? -32768 : c));
+}
+
+static void testRecording(const char* path){
+    CsvRows rows;
+    CHECK(loadCsv(path, rows) && !rows.empty());
+    if (rows.empty()) return;
+    CsvRows samples;
+    for (uint32_t k = 0; k < REST_TIME * RATE; k++) samples.push_back(rows.front());
+    samples.insert(samples.end(), rows.begin(), rows.end());
+    for (uint32_t k = 0; k < REST_TIME * RATE; k++) samples.push_back(rows.back());
+    for (size_t r = 0; r < samples.size(); r++)
+        if ((r < REST_TIME * RATE) || (r >= REST_TIME * RATE + rows.size()))
+            samples[r][3] = samples[r][4] = samples[r][5] = 0.0f;
+
+    FakeBus bus;
+    MPU9250 sensor(&bus);
+    sensor.setFifoMode(true);
+    sensor.setOutputDataRate(RATE);
+    sensor.setGyroRes(M::DPS2000);      // recorded rates go past 250 dps
+    sensor.setup();
+    bus.setRealTime(false);
+    uint8_t buffer[FRAMES_PER_READ * M::FIFO_FRAME_SIZE];
+    while (sensor.readFifo(buffer, FRAMES_PER_READ) > 0);
+    uint32_t burstWrites = bus._writes[M::XG_OFFSET_H];
+    uint32_t byteWrites = 0;
+    for (uint8_t i = 1; i < 6; i++) byteWrites += bus._writes[M::XG_OFFSET_H + i];
+
+    std::deque<float> truth;       // gyro x, y, z of every frame in FIFO, without the bias
+    float last[3] = {0.0f, 0.0f, 0.0f};
+    float worstJump = 0.0f;
+    uint32_t jumps = 0;
+    uint32_t frames = 0;
+    for (size_t r = 0; r < samples.size(); r++) {
+        for (uint8_t i = 0; i < 3; i++) {
+            bus._accel[i] = counts(samples[r][i], sensor._accelScale);
+            int16_t gyro = counts(samples[r][3 + i], sensor._gyroScale);
+            bus._gyro[i] = gyro + counts(BIAS[i], sensor._gyroScale);
+            truth.push_back(gyro * sensor._gyroScale);
+        }
+        bus.advance(1000000 / RATE);
+        if ((r + 1) % FRAMES_PER_READ) continue;
+
+        int n = sensor.readFifo(buffer, FRAMES_PER_READ);
+        CHECK(n == FRAMES_PER_READ);
+        for (int k = 0; k < n; k++) {
+            float sensor_data[M::RAW_DATA_SIZE];
+            sensor.parseData(&buffer[k * M::FIFO_FRAME_SIZE], sensor_data);
+            sensor.trackGyroBias(sensor_data, 1.0f / RATE);
+            for (uint8_t i = 0; i < 3; i++) {
+                float error = sensor_data[3 + i] - truth.front();
+                truth.pop_front();
+                // estimate itself moves by at most its rate towards the residual, offsets by whole counts
+                if (frames > 0) {
+                    float bound = 1.5f * sensor._gyroScale + fabsf(error) / (RATE * GyroBiasEstimator::BIAS_TIME_CONSTANT);
+                    if (fabsf(error - last[i]) > bound) jumps++;
+                    worstJump = fmaxf(worstJump, fabsf(error - last[i]));
+                }
+                last[i] = error;
+            }
+            frames++;
+        }
+    }
+
+    uint32_t commits = bus._writes[M::XG_OFFSET_H] - burstWrites;
+    for (uint8_t i = 1; i < 6; i++) byteWrites -= bus._writes[M::XG_OFFSET_H + i];
+    printf("%s: %u frames, %u offset updates, %u jumps, largest change %.5f rad/s, residual %.4f %.4f %.4f rad/s\n",
+        path, frames, commits, jumps, worstJump, last[0], last[1], last[2]);
+    CHECK(commits > 0);
+    CHECK(byteWrites == 0);
+    CHECK(jumps == 0);
+    CHECK(sensor._gyroOffsetLag == 0);
+}
+
+int main(){
+    for (const char* path : DEFAULT_CSV) testRecording(path);
+    return checkResult("gyrobiastest");
+}
@@ -0,0 +1,92 @@
+// What magnetometer samples arriving at 100 Hz save at a 1 kHz sample rate: bus bytes and transfers per sample read
+// through the register file of fakebus.h, against the whole 22 byte frame read every time, and ns per filter update
+// when only fresh magnetometer samples are fused (stale ones take the IMU update) against fusing every sample.
+// Recorded data (data/*.csv) is replayed with one fresh magnetometer sample in MAG_PERIOD, best of TIMING_PASSES.
+//   ./magbench [file.csv ...]
+#include <algorithm>
+#include "MPU9250.h"
+#include "../filters.h"
+#include "../ekf.h"
+#include "fakebus.h"
+#include "csv.h"
+
+typedef MPU9250 M;
+
+static const uint32_t SAMPLES = 10000;
+static const uint16_t RATE = 1000;
+static const uint16_t MAG_PERIOD = 10;
+static const int TIMING_PASSES = 20;
+
+static void benchBus(){
+    FakeBus bus;
+    bus._magPeriod = MAG_PERIOD;
+    MPU9250 sensor(&bus);
+    sensor.setOutputDataRate(RATE);
+    sensor.setup();
+    bus.setRealTime(false);
+    uint32_t bytes = bus._readBytes, transfers = bus._transfers, fresh = 0;
+    for (uint32_t n = 0; n < SAMPLES; n++) {
+        bus.advance(1000000 / RATE);
+        int16_t raw[M::RAW_DATA_SIZE];
+        float sensor_data[M::RAW_DATA_SIZE];
+        sensor.readData(&raw[0], &sensor_data[0]);
+        if (sensor._magFresh) fresh++;
+    }
+    printf("bus: %u samples, %u with fresh magnetometer data\n", SAMPLES, fresh);
+    printf("%-16s %14s %18s\n", "read", "bytes/sample", "transfers/sample");
+    printf("%-16s %14d %18d\n", "whole frame", M::FIFO_FRAME_SIZE, 1);
+    printf("%-16s %14.2f %18.2f\n", "ST1 first", (double)(bus._readBytes - bytes) / SAMPLES,
+        (double)(bus._transfers - transfers) / SAMPLES);
+}
+
+enum Kernel { MADGWICK, MAHONY, EKF };
+static const char* const kernelNames[] = {"MADGWICK", "MAHONY", "EKF"};
+
+// ns per update, stale magnetometer samples fused as well unless freshOnly
+static double run(const CsvRows& rows, Kernel kernel, bool freshOnly){
+    std::vector<float> data(rows.size() * 9);
+    for (size_t n = 0; n < rows.size(); n++)
+        for (uint8_t i = 0; i < 9; i++) data[n * 9 + i] = rows[n][i];
+    const float deltat = 1.0f / RATE;
+
+    uint64_t best = UINT64_MAX;
+    for (int pass = 0; pass < TIMING_PASSES; pass++) {
+        float q[4] = {1.0f, 0.0f, 0.0f, 0.0f};
+        float eInt[3] = {0.0f, 0.0f, 0.0f};
+        QuaternionEKF<float> ekf;
+        uint64_t total = 0;
+        for (size_t n = 0; n < rows.size(); n++) {
+            float* sensor_data = &data[n * 9];
+            bool fresh = !freshOnly || (n % MAG_PERIOD == 0);
+            uint32_t start = cycleCount();
+            switch (kernel) {
+                case MADGWICK: MadgwickQuaternionUpdate(sensor_data, q, deltat, fresh); break;
+                case MAHONY:   MahonyQuaternionUpdate(sensor_data, eInt, q, deltat, fresh); break;
+                case EKF:      ekf.update(sensor_data, deltat, fresh); break;
+            }
+            total += cycleCount() - start;
+        }
+        best = std::min(best, total);
+    }
+    return (double) best / rows.size();
+}
+
+int main(int argc, char** argv){
+    benchBus();
+
+    std::vector<const char*> paths;
+    for (int i = 1; i < argc; i++) paths.push_back(argv[i]);
+    if (paths.empty()) paths.assign(DEFAULT_CSV, DEFAULT_CSV + 2);
+    for (const char* path : paths) {
+        CsvRows rows;
+        if (!loadCsv(path, rows) || rows.empty()) {
+            fprintf(stderr, "Can't read %s\n", path);
+            return 1;
+        }
+        printf("%s: %zu samples, 1 in %u with fresh magnetometer data\n", path, rows.size(), MAG_PERIOD);
+        printf("%-10s %14s %14s\n", "filter", "ns all fused", "ns fresh only");
+        for (Kernel kernel : {MADGWICK, MAHONY, EKF})
+            printf("%-10s %14.1f %14.1f\n", kernelNames[kernel], run(rows, kernel, false), run(rows, kernel, true));
+    }
+    return 0;
+}
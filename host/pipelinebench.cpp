@@ -0,0 +1,94 @@
+// Per sample cost of MPU9250Pipeline (pipeline.h), bus, fusion and output fixed at compile time, next to
+// StartSensorsCommand driving MPU9250 through the virtual Bus, both on the register file of fakebus.h at 1 kHz with
+// the magnetometer at 100 Hz, Madgwick and float stream output decimated 10:1 through LoopbackTransport. The fake
+// bus only row is the cost of generating samples and draining packets which both include. Reports ns per sample,
+// best of TIMING_PASSES passes of SAMPLES samples.
+//   ./pipelinebench
+#include <algorithm>
+#include "MPU9250.h"
+#include "../sensorarray.h"
+#include "../commands.h"
+#include "../pipeline.h"
+#include "../loopbacktransport.h"
+#include "fakebus.h"
+
+static const uint32_t SAMPLES = 200000;
+static const uint16_t RATE = 1000;
+static const uint8_t DIVISOR = 10;
+static const int TIMING_PASSES = 7;
+
+typedef LoopbackTransport<16> Link;
+
+// Generates the next sample and takes the packets sent so far off the link
+static void next(FakeBus& bus, Link& link){
+    bus.advance(1000000 / RATE);
+    uint8_t packet[Transport::PACKET_SIZE];
+    while (link.hostRecv(packet));
+}
+
+static void prepare(FakeBus& bus){
+    bus._magPeriod = RATE / 100;
+    bus.setRealTime(false);
+}
+
+template <typename StepT>
+static double measure(FakeBus& bus, Link& link, StepT step, uint32_t& sent){
+    uint64_t best = UINT64_MAX;
+    for (int pass = 0; pass < TIMING_PASSES; pass++) {
+        uint32_t start = cycleCount();
+        for (uint32_t n = 0; n < SAMPLES; n++) {
+            next(bus, link);
+            step();
+        }
+        best = std::min(best, (uint64_t)(uint32_t)(cycleCount() - start));
+    }
+    sent = link._sent;
+    return (double) best / SAMPLES;
+}
+
+static void report(const char* name, double ns, uint32_t sent){
+    printf("%-28s %10.1f %14.2f\n", name, ns, sent / (double)(TIMING_PASSES * SAMPLES));
+}
+
+int main(){
+    printf("%u samples at %u Hz, Madgwick, float stream 1:%u\n", SAMPLES, RATE, DIVISOR);
+    printf("%-28s %10s %14s\n", "path", "ns/sample", "packets/sample");
+    uint32_t sent;
+
+    {
+        FakeBus bus;
+        Link link;
+        prepare(bus);
+        report("fake bus only", measure(bus, link, [](){}, sent), 0);
+    }
+    {
+        FakeBus bus;
+        MPU9250 sensor(&bus);
+        sensor.setAlgorythm(MPU9250::MADGWICK);
+        SensorArray sensors;
+        sensors.add(&sensor);
+        Link link;
+        byte request[Transport::PACKET_SIZE] = {CMD_START_SENSORS, 2, DIVISOR, StartSensorsCommand::STREAM_FLOAT};
+        StartSensorsCommand* command = new StartSensorsCommand(&sensors, &link, request);
+        sensor.setOutputDataRate(RATE);
+        command->setup();
+        prepare(bus);
+        link._sent = 0;
+        double ns = measure(bus, link, [command](){ command->exec(); }, sent);
+        report("StartSensorsCommand", ns, sent);
+        delete command;
+    }
+    {
+        typedef FloatStreamOutput<CMD_START_SENSORS> Output;
+        FakeBus bus;
+        Link link;
+        MPU9250Pipeline<FakeBus, MadgwickFusion, Output> pipeline(&bus, Output(&link, DIVISOR));
+        pipeline._sensor.setOutputDataRate(RATE);
+        pipeline.setup();
+        prepare(bus);
+        link._sent = 0;
+        double ns = measure(bus, link, [&pipeline](){ pipeline.step(); }, sent);
+        report("MPU9250Pipeline<FakeBus>", ns, sent);
+    }
+    return 0;
+}
@@ -0,0 +1,127 @@
+// Register shadow copies (regcache.h) of MPU9250 and AK8963 against the register file of fakebus.h: the copy
+// matches the chip after setup(), a bit update is one bus write without read back, H_RESET and self clearing bits
+// are followed, the verification at the end of setup() finds a register that didn't take the write, and the fuse
+// ROM is read once.
+#include "MPU9250.h"
+#include "fakebus.h"
+#include "check.h"
+
+typedef MPU9250 M;
+
+static uint32_t total(const uint32_t* counts){
+    uint32_t sum = 0;
+    for (uint8_t i = 0; i < 128; i++) sum += counts[i];
+    return sum;
+}
+
+static void testCoherent(){
+    FakeBus bus;
+    MPU9250 sensor(&bus);
+    sensor.setup();
+    CHECK(sensor.verifyRegisters() == 0);
+    CHECK(sensor.verifyAK8963Registers() == 0);
+    uint8_t cached = 0;
+    for (uint8_t address = 0; address < M::REGISTER_MAP_SIZE; address++) {
+        if (!sensor._regs.isValid(address)) continue;
+        cached++;
+        CHECK(M::isCacheable(address));
+        CHECK(sensor._regs.get(address) == bus._regs[address]);
+    }
+    CHECK(cached > 10);
+    CHECK(sensor._mag._regs.get(AK8963::CNTL1) == bus._magRegs[AK8963::CNTL1]);
+}
+
+static void testBitUpdate(){
+    FakeBus bus;
+    MPU9250 sensor(&bus);
+    sensor.setup();
+
+    // cached register: one write, no read
+    uint32_t reads = total(bus._reads);
+    uint32_t writes = total(bus._writes);
+    uint8_t config = bus._regs[M::CONFIG];
+    sensor.writeRegisterBit(M::CONFIG, 6);      // FIFO_MODE
+    CHECK(total(bus._reads) == reads);
+    CHECK(total(bus._writes) == writes + 1);
+    CHECK(bus._regs[M::CONFIG] == (config | 0x40));
+    sensor.writeRegisterBit(M::CONFIG, 6, false);
+    CHECK(bus._regs[M::CONFIG] == config);
+    CHECK(total(bus._reads) == reads);
+
+    // self clearing bits act on the chip but don't stay in the copy
+    sensor.writeRegisterBit(M::USER_CTRL, M::FIFO_RST);
+    CHECK(!(sensor._regs.get(M::USER_CTRL) & (1 << M::FIFO_RST)));
+    CHECK(sensor._regs.get(M::USER_CTRL) == bus._regs[M::USER_CTRL]);
+
+    // registers the chip changes itself are never cached
+    sensor.readRegister(M::INT_STATUS);
+    CHECK(!sensor._regs.isValid(M::INT_STATUS));
+    CHECK(!sensor._regs.isValid(M::FIFO_R_W));
+
+    // H_RESET drops the copy, the first update after it reads the default
+    sensor.hardReset();
+    CHECK(!sensor._regs.isValid(M::CONFIG));
+    CHECK(!sensor._regs.isValid(M::PWR_MGMT_1));
+    reads = total(bus._reads);
+    sensor.writeRegisterBit(M::PWR_MGMT_1, 3);
+    CHECK(total(bus._reads) == reads + 1);
+    CHECK(bus._regs[M::PWR_MGMT_1] == (0x01 | 0x08));
+    sensor.writeRegisterBit(M::PWR_MGMT_1, 3, false);
+    CHECK(total(bus._reads) == reads + 1);
+    CHECK(bus._regs[M::PWR_MGMT_1] == 0x01);
+}
+
+static void testVerify(){
+    FakeBus bus;
+    MPU9250 sensor(&bus);
+    sensor.setup();
+
+    // a write the chip didn't take is reported once, the copy takes the actual value
+    bus._regs[M::ACCEL_CONFIG] ^= 0x08;
+    bus._magRegs[AK8963::CNTL1] = AK8963::CNTL1_PWR_DOWN;
+    CHECK(sensor.verifyRegisters() == 1);
+    CHECK(sensor.verifyRegisters() == 0);
+    CHECK(sensor._regs.get(M::ACCEL_CONFIG) == bus._regs[M::ACCEL_CONFIG]);
+    CHECK(sensor.verifyAK8963Registers() == 1);
+    CHECK(sensor.verifyAK8963Registers() == 0);
+
+    // without verification setup() reads neither map back
+    uint32_t dumps = bus._reads[0];
+    uint32_t slaveReads = bus._reads[M::EXT_SENS_DATA_00];
+    sensor.setup();
+    uint32_t verifiedSlaveReads = bus._reads[M::EXT_SENS_DATA_00] - slaveReads;
+    CHECK(bus._reads[0] == dumps + 1);
+    sensor.setVerifyWrites(false);
+    dumps = bus._reads[0];
+    slaveReads = bus._reads[M::EXT_SENS_DATA_00];
+    sensor.setup();
+    CHECK(bus._reads[0] == dumps);
+    CHECK(bus._reads[M::EXT_SENS_DATA_00] - slaveReads == verifiedSlaveReads - 1);
+}
+
+// Fuse ROM: read through SLV0 on the first setup only, the mode switch isn't written again
+static void testFuseRom(){
+    FakeBus bus;
+    for (uint8_t i = 0; i < 3; i++) bus._magRegs[AK8963::ASAX + i] = 128 + 10 * i;
+    MPU9250 sensor(&bus);
+    sensor.setVerifyWrites(false);
+    sensor.setup();
+    uint32_t firstReads = bus._reads[M::EXT_SENS_DATA_00];
+    uint8_t asa[3];
+    CHECK(sensor._mag.readFuseCache(&asa[0]));
+    CHECK(asa[0] == 128 && asa[1] == 138 && asa[2] == 148);
+
+    bus._magRegs[AK8963::ASAX] = 0;
+    sensor.setup();
+    CHECK(bus._reads[M::EXT_SENS_DATA_00] - firstReads == firstReads - 1);
+    CHECK(sensor._mag.readFuseCache(&asa[0]));
+    CHECK(asa[0] == 128);
+}
+
+int main(){
+    testCoherent();
+    testBitUpdate();
+    testVerify();
+    testFuseRom();
+    return checkResult("regcachetest");
+}
@@ -0,0 +1,123 @@
+// Replays recorded sensor data (data/*.csv as saved by the host tool: ax, ay, az, gx, gy, gz, hx, hy, hz, t, q)
+// through StartSensorsCommand::updateFilter() with every algorythm which runs on the MCU, DMP runs on the chip.
+// Reports update rate and latency percentiles of one filter update, and drift: rotation per minute of the estimate
+// while the calmest sample of the recording (smallest rotation rate) is held for REST_SECONDS after it, so residual
+// gyro bias is all that moves it. SETTLE_SECONDS before that let the filter converge to the held orientation.
+//   ./replay [-r rate_hz] [file.csv ...]
+#include <algorithm>
+#include "MPU9250.h"
+#include "../sensorarray.h"
+#include "../commands.h"
+#include "../loopbacktransport.h"
+#include "csv.h"
+
+static const float REST_SECONDS = 60.0f;
+static const float SETTLE_SECONDS = 120.0f;
+
+class NullBus final : public Bus {
+public:
+    uint8_t readByte(uint8_t address, uint8_t subAddress, bool fast = false){ return 0; }
+    bool writeByte(uint8_t address, uint8_t subAddress, uint8_t data){ return true; }
+    void readBytes(uint8_t address, uint8_t subAddress, uint8_t count, uint8_t* dest, bool fast = false){
+        memset(dest, 0, count);
+    }
+};
+
+static float angleDeg(const float* a, const float* b){
+    float dot = fabsf(a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3]);
+    return 2.0f * acosf(dot < 1.0f ? dot : 1.0f) / MPU9250::d2r;
+}
+
+static const std::vector<float>& restSample(const CsvRows& rows){
+    size_t calmest = 0;
+    float calmestRate = INFINITY;
+    for (size_t i = 0; i < rows.size(); i++) {
+        float w = rows[i][3] * rows[i][3] + rows[i][4] * rows[i][4] + rows[i][5] * rows[i][5];
+        if (w < calmestRate) {
+            calmestRate = w;
+            calmest = i;
+        }
+    }
+    return rows[calmest];
+}
+
+static void replay(const CsvRows& rows, float rate, MPU9250::Algorythm algorythm){
+    NullBus bus;
+    MPU9250 sensor(&bus);
+    sensor.setAlgorythm(algorythm);
+    sensor.setTrackGyroBias(false);  // offsets it commits would never show up in recorded data
+    SensorArray array;
+    array.add(&sensor);
+    LoopbackTransport<> link;
+    byte request[Transport::PACKET_SIZE] = {CMD_START_SENSORS, 0};
+    StartSensorsCommand* command = new StartSensorsCommand(&array, &link, request);
+    StartSensorsCommand::SensorState& state = command->_states[0];
+    const float q0[4] = {0.39f, 0.0f, 0.0f, -0.92f};   // as StartSensorsCommand::setup()
+    for (uint8_t i = 0; i < 4; i++) state._q[i] = q0[i];
+    for (uint8_t i = 0; i < 3; i++) state._eInt[i] = 0.0f;
+    state._ekf.reset(state._q);
+
+    float dt = 1.0f / rate;
+    std::vector<uint32_t> latency;
+    latency.reserve(rows.size());
+    for (size_t n = 0; n < rows.size(); n++) {
+        const std::vector<float>& row = rows[n];
+        float sensor_data[StartSensorsCommand::SENSOR_DATA_SIZE];
+        for (uint8_t i = 0; i < 10; i++) sensor_data[i] = row[i];
+        sensor._magValid = (row[6] != 0.0f) || (row[7] != 0.0f) || (row[8] != 0.0f);
+        sensor._magFresh = magFresh(rows, n);
+        uint32_t start = cycleCount();
+        command->updateFilter(&sensor, state, sensor_data, dt);
+        latency.push_back(cycleCount() - start);
+    }
+
+    const std::vector<float>& rest = restSample(rows);
+    uint32_t settleSamples = SETTLE_SECONDS * rate;
+    uint32_t restSamples = settleSamples + REST_SECONDS * rate;
+    float settled[4] = {state._q[0], state._q[1], state._q[2], state._q[3]};
+    for (uint32_t n = 0; n < restSamples; n++) {
+        if (n == settleSamples)
+            for (uint8_t i = 0; i < 4; i++) settled[i] = state._q[i];
+        float sensor_data[StartSensorsCommand::SENSOR_DATA_SIZE];
+        for (uint8_t i = 0; i < 10; i++) sensor_data[i] = rest[i];
+        sensor._magValid = true;
+        sensor._magFresh = (n % 2) == 0;
+        command->updateFilter(&sensor, state, sensor_data, dt);
+    }
+    float drift = angleDeg(settled, state._q) * 60.0f / REST_SECONDS;
+    delete command;
+
+    uint64_t total = 0;
+    for (uint32_t ns : latency) total += ns;
+    std::sort(latency.begin(), latency.end());
+    size_t n = latency.size();
+    static const char* names[] = {"MADGWICK", "MAHONY", "DMP", "EKF", "NONE", "MADGWICK_IMU", "MAHONY_IMU"};
+    printf("%-14s %10.0f %8u %8u %8u ", names[algorythm], total ? n * 1e9 / total : 0.0,
+        latency[n / 2], latency[n * 9 / 10], latency[n * 99 / 100]);
+    if (algorythm == MPU9250::NONE) printf("%13s\n", "-");     // no estimate, quaternion stays zero
+    else printf("%13.2f\n", drift);
+}
+
+int main(int argc, char** argv){
+    float rate = 50.0f;     // data/*.csv streams were recorded at ~50 Hz
+    std::vector<const char*> paths;
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-r") == 0) && (i + 1 < argc)) rate = atof(argv[++i]);
+        else paths.push_back(argv[i]);
+    }
+    if (paths.empty()) paths.assign(DEFAULT_CSV, DEFAULT_CSV + 2);
+
+    const MPU9250::Algorythm algorythms[] = {MPU9250::MADGWICK, MPU9250::MAHONY, MPU9250::EKF,
+        MPU9250::MADGWICK_IMU, MPU9250::MAHONY_IMU, MPU9250::NONE};
+    for (const char* path : paths) {
+        CsvRows rows;
+        if (!loadCsv(path, rows) || rows.empty()) {
+            fprintf(stderr, "Can't read %s\n", path);
+            return 1;
+        }
+        printf("%s: %zu samples at %.0f Hz\n", path, rows.size(), rate);
+        printf("%-14s %10s %8s %8s %8s %13s\n", "algorythm", "updates/s", "p50 ns", "p90 ns", "p99 ns", "drift deg/min");
+        for (MPU9250::Algorythm algorythm : algorythms) replay(rows, rate, algorythm);
+    }
+    return 0;
+}
@@ -0,0 +1,9 @@
+// Whole sketch built for the host: setup() and a few hundred loop() iterations over the stub SPI port
+void isrService();  // prototype the Arduino builder would generate
+#include "../teensy32-MPU9250.ino"
+
+int main(){
+    setup();
+    for (int i = 0; i < 500; i++) loop();
+    return 0;
+}
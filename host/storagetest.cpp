@@ -0,0 +1,114 @@
+// Calibration store (calibstore.h) on FileStorage (filestorage.h): a record saved by a calibrated sensor loads back
+// unchanged and restores it without measuring again, while corrupted, truncated and erased slots are rejected.
+#include <unistd.h>
+#include "MPU9250.h"
+#include "../filestorage.h"
+#include "fakebus.h"
+#include "check.h"
+
+typedef MPU9250 M;
+
+static const char* const PATH = "storagetest.bin";
+static const uint8_t SLOT = 1;
+
+static void corrupt(long position){
+    FILE* file = fopen(PATH, "r+b");
+    CHECK(file != nullptr);
+    if (!file) return;
+    fseek(file, position, SEEK_SET);
+    int c = fgetc(file);
+    fseek(file, position, SEEK_SET);
+    fputc(c ^ 0x01, file);
+    fclose(file);
+}
+
+static void testRoundTrip(){
+    unlink(PATH);
+    FileStorage storage(PATH);
+    CalibrationStore store(&storage);
+
+    // sensor calibrated from scratch saves its record on setup()
+    FakeBus bus;
+    bus._gyro[0] = 40;
+    MPU9250 sensor(&bus);
+    CHECK(!sensor.attachStore(&store, SLOT));
+    sensor.setGyroRes(M::DPS500);
+    sensor.setOutputDataRate(200);
+    sensor.setup();
+    CalibrationRecord saved;
+    CHECK(store.load(SLOT, saved));
+    CalibrationRecord captured;
+    sensor.captureCalibration(captured);
+    captured.seal();
+    CHECK(memcmp(&saved, &captured, sizeof(saved)) == 0);
+    CHECK(saved.gyroRes == M::DPS500);
+    CHECK(saved.outputDataRate == 200);
+
+    // another sensor restores it and writes the offsets back instead of calibrating
+    FakeBus bus2;
+    MPU9250 restored(&bus2);
+    CHECK(restored.attachStore(&store, SLOT));
+    CHECK(restored._gyroRes == M::DPS500);
+    restored.setup();
+    CHECK(memcmp(&bus2._regs[M::XG_OFFSET_H], &bus._regs[M::XG_OFFSET_H], 6) == 0);
+    CHECK(bus2._regs[M::SMPLRT_DIV] == bus._regs[M::SMPLRT_DIV]);
+
+    // other slots are untouched
+    CalibrationRecord other;
+    CHECK(!store.load(0, other));
+    CHECK(!store.load(SLOT + 1, other));
+
+    // any flipped bit fails the CRC, saving again repairs the slot
+    corrupt(SLOT * CalibrationStore::SLOT_SIZE + offsetof(CalibrationRecord, magSoftIron) + 2);
+    CHECK(!store.load(SLOT, other));
+    CHECK(!restored.attachStore(&store, SLOT));
+    CHECK(restored.saveCalibration());
+    CHECK(store.load(SLOT, other));
+    corrupt(SLOT * CalibrationStore::SLOT_SIZE + offsetof(CalibrationRecord, crc));
+    CHECK(!store.load(SLOT, other));
+
+    // erased slot
+    CHECK(restored.saveCalibration());
+    CHECK(store.erase(SLOT));
+    CHECK(!store.load(SLOT, other));
+    unlink(PATH);
+}
+
+static void testShortFile(){
+    unlink(PATH);
+    FileStorage storage(PATH, 256);
+    CalibrationStore store(&storage);
+    CalibrationRecord record;
+    memset(&record, 0, sizeof(record));
+    CHECK(store.save(SLOT, record));
+    CHECK(store.load(SLOT, record));
+
+    // bytes past the end of a truncated file read as erased, the record is rejected
+    CHECK(truncate(PATH, SLOT * CalibrationStore::SLOT_SIZE + 20) == 0);
+    uint8_t data[sizeof(record)];
+    storage.read(SLOT * CalibrationStore::SLOT_SIZE, &data[0], sizeof(data));
+    CHECK(data[19] == 0 && data[20] == 0xFF && data[sizeof(data) - 1] == 0xFF);
+    CHECK(!store.load(SLOT, record));
+
+    // writing past the end pads the gap with erased bytes
+    CHECK(storage.write(240, &data[0], 4));
+    storage.read(SLOT * CalibrationStore::SLOT_SIZE + 20, &data[0], 8);
+    CHECK(data[0] == 0xFF && data[7] == 0xFF);
+
+    // outside the storage
+    CHECK(!storage.write(250, &data[0], 8));
+    CHECK(!store.save(2, record));
+    CHECK(!store.load(2, record));
+
+    // missing file
+    unlink(PATH);
+    storage.read(0, &data[0], 4);
+    CHECK(data[0] == 0xFF && data[3] == 0xFF);
+    CHECK(!store.load(SLOT, record));
+}
+
+int main(){
+    testRoundTrip();
+    testShortFile();
+    return checkResult("storagetest");
+}
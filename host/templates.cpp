@@ -0,0 +1,60 @@
+// Explicit instantiation of every template with the parameters it is meant for, so the ones the sketch doesn't use
+// are compiled (and -Wall checked) as well. Nothing to run.
+#include "Arduino.h"
+#include "../spibus.h"
+#include "../i2cbus.h"
+#include "../pipeline.h"
+#include "../batchrunner.h"
+#include "../ellipsoidfit.h"
+#include "../framing.h"
+#include "../loopbacktransport.h"
+#include "../serialtransport.h"
+#include "../txqueue.h"
+#include "../filestorage.h"
+
+template class MPU9250T<Bus>;
+template class MPU9250T<SPIBus>;
+template class MPU9250T<I2CBus>;
+
+template class MPU9250Pipeline<SPIBus, MadgwickFusion, FloatStreamOutput<0> >;
+template class MPU9250Pipeline<SPIBus, MahonyFusion, NullOutput>;
+template class MPU9250Pipeline<SPIBus, MadgwickImuFusion, NullOutput>;
+template class MPU9250Pipeline<SPIBus, MahonyImuFusion, NullOutput>;
+template class MPU9250Pipeline<I2CBus, EkfFusion, FloatStreamOutput<0, 1> >;
+template class MPU9250Pipeline<Bus, NoFusion, NullOutput>;
+
+#define INSTANTIATE_FILTERS(T) \
+    template void MadgwickQuaternionUpdate<T>(T*, T*, T, bool); \
+    template void MadgwickImuUpdate<T>(T*, T*, T); \
+    template void MahonyQuaternionUpdate<T>(T*, T*, T*, T, bool); \
+    template void MahonyImuUpdate<T>(T*, T*, T*, T);
+INSTANTIATE_FILTERS(float)
+INSTANTIATE_FILTERS(double)
+INSTANTIATE_FILTERS(Q16)
+
+template class QuaternionEKF<float>;
+template class QuaternionEKF<double>;
+template class EllipsoidFit<float>;
+template class EllipsoidFit<double>;
+template struct MadgwickBatch<16, float>;
+template struct MahonyBatch<16, float>;
+template void MadgwickBatchUpdate<16, float>(const float*, MadgwickBatch<16, float>&, const float*, uint16_t);
+template void MadgwickBatchUpdate<16, double>(const double*, MadgwickBatch<16, double>&, const double*, uint16_t);
+template void MahonyBatchUpdate<16, float>(const float*, MahonyBatch<16, float>&, const float*, uint16_t);
+template void MahonyBatchUpdate<16, double>(const double*, MahonyBatch<16, double>&, const double*, uint16_t);
+template class Fixed<16>;
+template class Fixed<24>;
+template class CicDecimator<MPU9250::RAW_DATA_SIZE>;
+template class CicDecimator<3, 4>;
+template class RegisterCache<MPU9250::REGISTER_MAP_SIZE>;
+template class TimestampRing<8>;
+template class StaticBlackBox<64>;
+template class FragmentReceiver<1024>;
+template class LoopbackTransport<16>;
+template class TxQueue<16>;
+template class Matrix<7, 7, double>;
+template class SymMatrix<7, double>;
+
+int main(){
+    return 0;
+}
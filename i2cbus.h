@@ -5,7 +5,7 @@
 #include "i2c_t3.h"  // I2C library
 #include "bus.h"
 
-class I2CBus : public Bus {
+class I2CBus final : public Bus {
 public:
     static const uint8_t I2C_SCL_PIN = 19;
     static const uint8_t I2C_SDA_PIN = 18;
@@ -39,18 +39,21 @@ public:
         return data;                      
     }
 
+    // Written values are verified by the chip drivers in one batch (see MPU9250::verifyRegisters), not per write
     bool writeByte(uint8_t address, uint8_t subAddress, uint8_t data)
     {
         _i2c.beginTransmission(address);  
         _i2c.write(subAddress);           
         _i2c.write(data);                 
-        _i2c.endTransmission();           
-        
-        delay(10); 
+        return _i2c.endTransmission() == 0;
+    }
 
-        // check if register was updated
-        uint8_t actual_val = readByte(address, subAddress);
-        return (actual_val == data);
+    bool writeBytes(uint8_t address, uint8_t subAddress, uint8_t count, const uint8_t* data)
+    {
+        _i2c.beginTransmission(address);
+        _i2c.write(subAddress); // starting register address, chip increments it for every byte
+        _i2c.write(data, count);
+        return _i2c.endTransmission() == 0;
     }
 
     void readBytes(uint8_t address, uint8_t subAddress, uint8_t count, uint8_t* dest, bool fast = false){
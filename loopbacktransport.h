@@ -0,0 +1,62 @@
+#ifndef LOOPBACKTransport_h
+#define LOOPBACKTransport_h
+
+#include <string.h>
+#include "transport.h"
+
+// In-process link: the device side is the Transport, the host side is hostSend()/hostRecv(). Runs the command
+// and streaming stack off-target, e.g. to measure its packet throughput. Each direction queues up to SLOTS - 1
+// packets, send() to a full queue fails like a timed out USB send, timeout is ignored.
+template <uint8_t SLOTS = 16>
+class LoopbackTransport : public Transport {
+public:
+    static_assert((SLOTS & (SLOTS - 1)) == 0, "queue size must be a power of two");
+
+    class Queue {
+    public:
+        uint8_t _packets[SLOTS][PACKET_SIZE];
+        uint8_t _head = 0;
+        uint8_t _tail = 0;
+
+        bool push(const uint8_t* packet){
+            uint8_t next = (_head + 1) & (SLOTS - 1);
+            if (next == _tail) return false;
+            memcpy(_packets[_head], packet, PACKET_SIZE);
+            _head = next;
+            return true;
+        }
+
+        bool pop(uint8_t* packet){
+            if (_tail == _head) return false;
+            memcpy(packet, _packets[_tail], PACKET_SIZE);
+            _tail = (_tail + 1) & (SLOTS - 1);
+            return true;
+        }
+    };
+
+    Queue _toHost;
+    Queue _toDevice;
+
+    int send(const uint8_t* packet, uint16_t){
+        if (!_toHost.push(packet)) {
+            _dropped++;
+            return 0;
+        }
+        _sent++;
+        return PACKET_SIZE;
+    }
+
+    int recv(uint8_t* packet, uint16_t){
+        return _toDevice.pop(packet) ? PACKET_SIZE : 0;
+    }
+
+    bool hostSend(const uint8_t* packet){
+        return _toDevice.push(packet);
+    }
+
+    bool hostRecv(uint8_t* packet){
+        return _toHost.pop(packet);
+    }
+};
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef MAGCALIB_h
+#define MAGCALIB_h
+
+#include "Arduino.h"
+#include "ellipsoidfit.h"
+
+// Hard/soft iron calibration collected incrementally from magnetometer samples as they arrive, so nothing blocks.
+// Directions of samples around the current center estimate are binned (8 octants x dominant axis) to track coverage.
+// Every sample also goes to a recursive ellipsoid fit, which gives a full soft iron matrix and usually settles
+// long before the sphere is covered well enough for per axis min/max. Min/max is the fallback when fit fails.
+class MagCalibrator {
+public:
+    static const uint8_t COVERAGE_BINS = 24;
+    static const uint8_t COVERAGE_DONE = 22;
+    static const uint16_t MIN_SAMPLES = 300;
+    static const uint16_t MAX_SAMPLES = 6000;   // ~60 s at 100 Hz, gives up waiting for full coverage
+    static const int16_t MIN_RADIUS = 50;       // counts, directions aren't binned until min/max spread is that wide
+    static const uint8_t FIT_COVERAGE = 16;
+    static const uint16_t FIT_MIN_SAMPLES = 200;
+    static constexpr float FIT_DONE_RESIDUAL = 0.01f;
+
+    EllipsoidFit<float> _fit;
+    bool _active;
+    uint16_t _samples;
+    uint32_t _coverage;         // bit per hit bin
+    int16_t _min[3];
+    int16_t _max[3];
+
+    MagCalibrator():_active(false) {
+        reset();
+    };
+
+    void start(){
+        reset();
+        _active = true;
+    }
+
+    void reset(){
+        _fit.reset();
+        _samples = 0;
+        _coverage = 0;
+        for (uint8_t i = 0; i < 3; i++){
+            _min[i] = 32767;
+            _max[i] = -32767;
+        }
+    }
+
+    void stop(){
+        _active = false;
+    }
+
+    // Raw counts of a new (data ready) and valid (not overflowed) sample and factory adjustment in uT per count.
+    // parseData() calls it once per magnetometer sample, so equal consecutive values are real samples.
+    void addSample(int16_t* mag, const float* magCalibration){
+        for (uint8_t i = 0; i < 3; i++){
+            if (mag[i] > _max[i]) _max[i] = mag[i];
+            if (mag[i] < _min[i]) _min[i] = mag[i];
+        }
+        _samples++;
+        _coverage |= ((uint32_t) 1) << bin(mag);
+
+        float field[3] = {mag[0] * magCalibration[0], mag[1] * magCalibration[1], mag[2] * magCalibration[2]};
+        _fit.addSample(&field[0]);
+    }
+
+    // Returns COVERAGE_BINS for samples which can't be binned yet, that bit is never counted
+    uint8_t bin(int16_t* mag){
+        float v[3];
+        uint8_t octant = 0, dominant = 0;
+        for (uint8_t i = 0; i < 3; i++){
+            int32_t radius = ((int32_t)_max[i] - _min[i]) / 2;
+            if (radius < MIN_RADIUS) return COVERAGE_BINS;
+            v[i] = (mag[i] - ((int32_t)_max[i] + _min[i]) / 2) / (float) radius;
+            if (v[i] < 0) octant |= (1 << i);
+            if (fabsf(v[i]) > fabsf(v[dominant])) dominant = i;
+        }
+        return octant * 3 + dominant;
+    }
+
+    uint8_t coverageCount(){
+        uint8_t count = 0;
+        for (uint8_t i = 0; i < COVERAGE_BINS; i++)
+            if (_coverage & (((uint32_t) 1) << i)) count++;
+        return count;
+    }
+
+    bool done(){
+        if (_samples >= MAX_SAMPLES) return true;
+        uint8_t coverage = coverageCount();
+        if ((_samples >= MIN_SAMPLES) && (coverage >= COVERAGE_DONE)) return true;
+        return (_samples >= FIT_MIN_SAMPLES) && (coverage >= FIT_COVERAGE) && (_fit._residual < FIT_DONE_RESIDUAL) && fitValid();
+    }
+
+    bool fitValid(){
+        float bias[3], softIron[3][3];
+        return _fit.solve(&bias[0], softIron);
+    }
+
+    // Bias in uT and soft iron matrix from ellipsoid fit, or per axis scale on the diagonal if fit failed.
+    // magCalibration is the factory sensitivity adjustment in uT per count. Returns true if ellipsoid fit was used.
+    bool finish(const float* magCalibration, float* bias, float softIron[3][3]){
+        stop();
+        if (_fit.solve(bias, softIron)) return true;
+
+        float scale[3];
+        finishMinMax(magCalibration, bias, &scale[0]);
+        for (uint8_t i = 0; i < 3; i++)
+            for (uint8_t j = 0; j < 3; j++)
+                softIron[i][j] = (i == j) ? scale[i] : 0.0f;
+        return false;
+    }
+
+    // Bias in uT and dimensionless per axis scale
+    void finishMinMax(const float* magCalibration, float* bias, float* scale){
+        int32_t int32_bias[3], int32_scale[3];
+        for (uint8_t i = 0; i < 3; i++){
+            int32_bias[i] = ((int32_t)_max[i] + _min[i]) / 2;   // hard iron correction in counts
+            int32_scale[i] = ((int32_t)_max[i] - _min[i]) / 2;  // soft iron: axis max chord length in counts
+            bias[i] = (float) int32_bias[i] * magCalibration[i];
+        }
+
+        float avg_rad = int32_scale[0] + int32_scale[1] + int32_scale[2];
+        avg_rad /= 3.0;
+
+        for (uint8_t i = 0; i < 3; i++)
+            scale[i] = avg_rad/((float)int32_scale[i]);
+    }
+};
+
+#endif
@@ -6,6 +6,7 @@ import numpy as np
 from matplotlib.backends.backend_wxagg import FigureCanvasWxAgg
 from struct import pack, unpack
 import os
+from utils import decodeFloatSample
 
 ###########################################################################
 ## Class MAG Dialog
@@ -96,18 +97,25 @@ class MagDialog ( wx.Dialog ):
         self.axes.axis('equal')
 
     def CMD_START_SENSORS_callback(self, hid, byte_response):
-        sensor_data = unpack('f' * 15, str(bytearray(byte_response)))  
-        self.data.append(sensor_data)
+        if byte_response[60] != 0: # last byte is sensor id, only first sensor is calibrated from here
+            return
+        values, time_us, sensor_id = decodeFloatSample(byte_response)
+        self.data.append(values + [time_us / 1000000.])
 
     def CMD_STOP_SENSORS_callback(self, hid, byte_response):
         hid.releaseCallback(self.CMD_START_SENSORS)
         print "Sensors stopped"
 
     def CMD_MAG_CALIB_callback(self, hid, byte_response):
-        result = unpack('f' * 6, str(bytearray(byte_response)))  
-        print "Calibration completed"
+        if len(byte_response) == 20: # progress: samples, covered bins, total bins, coverage mask, min[3], max[3]
+            progress = unpack('<HBBI6h', str(bytearray(byte_response)))
+            print "Calibrating: %s samples, coverage %s/%s"%(progress[0], progress[1], progress[2])
+            return
+        result = unpack('f' * 12, str(bytearray(byte_response[:48])))  
+        print "Calibration completed (%s)"%('ellipsoid fit' if byte_response[49] else 'min/max')
         print ("Bias: ", result[0:3])
-        print ("Scale: ", result[3:])
+        print ("Soft iron: ", result[3:6], result[6:9], result[9:12])
+        print ("Coverage: ", byte_response[48])
 
     def __del__( self ):
         pass
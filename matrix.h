@@ -0,0 +1,120 @@
+#ifndef MATRIX_h
+#define MATRIX_h
+
+#include <stdint.h>
+
+// Fixed size matrix with compile time dimensions. No heap, loops have constant
+// bounds so the compiler can unroll them for small sizes.
+template <uint8_t ROWS, uint8_t COLS, typename T = float>
+class Matrix {
+public:
+    T _data[ROWS][COLS];
+
+    static Matrix zeros(){
+        Matrix m;
+        for (uint8_t r = 0; r < ROWS; r++)
+            for (uint8_t c = 0; c < COLS; c++)
+                m._data[r][c] = 0.0f;
+        return m;
+    }
+
+    static Matrix identity(){
+        Matrix m = zeros();
+        for (uint8_t i = 0; i < ROWS && i < COLS; i++)
+            m._data[i][i] = 1.0f;
+        return m;
+    }
+
+    T& operator()(uint8_t r, uint8_t c){
+        return _data[r][c];
+    }
+
+    const T& operator()(uint8_t r, uint8_t c) const {
+        return _data[r][c];
+    }
+
+    template <uint8_t K>
+    Matrix<ROWS, K, T> operator*(const Matrix<COLS, K, T>& o) const {
+        Matrix<ROWS, K, T> result;
+        for (uint8_t r = 0; r < ROWS; r++)
+            for (uint8_t c = 0; c < K; c++){
+                T sum = 0.0f;
+                for (uint8_t i = 0; i < COLS; i++)
+                    sum += _data[r][i] * o._data[i][c];
+                result._data[r][c] = sum;
+            }
+        return result;
+    }
+
+    Matrix operator+(const Matrix& o) const {
+        Matrix result;
+        for (uint8_t r = 0; r < ROWS; r++)
+            for (uint8_t c = 0; c < COLS; c++)
+                result._data[r][c] = _data[r][c] + o._data[r][c];
+        return result;
+    }
+
+    Matrix operator-(const Matrix& o) const {
+        Matrix result;
+        for (uint8_t r = 0; r < ROWS; r++)
+            for (uint8_t c = 0; c < COLS; c++)
+                result._data[r][c] = _data[r][c] - o._data[r][c];
+        return result;
+    }
+
+    Matrix<COLS, ROWS, T> transposed() const {
+        Matrix<COLS, ROWS, T> result;
+        for (uint8_t r = 0; r < ROWS; r++)
+            for (uint8_t c = 0; c < COLS; c++)
+                result._data[c][r] = _data[r][c];
+        return result;
+    }
+};
+
+// Symmetric N x N matrix, only lower triangle is stored: N*(N+1)/2 elements.
+// Used for covariances, which are symmetric by construction.
+template <uint8_t N, typename T = float>
+class SymMatrix {
+public:
+    static const uint16_t SIZE = (uint16_t)N * (N + 1) / 2;
+    T _data[SIZE];
+
+    static uint16_t index(uint8_t r, uint8_t c){
+        return (r >= c) ? (uint16_t)r * (r + 1) / 2 + c : (uint16_t)c * (c + 1) / 2 + r;
+    }
+
+    T& operator()(uint8_t r, uint8_t c){
+        return _data[index(r, c)];
+    }
+
+    const T& operator()(uint8_t r, uint8_t c) const {
+        return _data[index(r, c)];
+    }
+
+    void setDiagonal(T v){
+        for (uint16_t i = 0; i < SIZE; i++) _data[i] = 0.0f;
+        for (uint8_t i = 0; i < N; i++) (*this)(i, i) = v;
+    }
+
+    Matrix<N, N, T> toMatrix() const {
+        Matrix<N, N, T> result;
+        for (uint8_t r = 0; r < N; r++)
+            for (uint8_t c = 0; c < N; c++)
+                result._data[r][c] = (*this)(r, c);
+        return result;
+    }
+
+    // this = J * this * J^T, only lower triangle of the result is computed
+    void transform(const Matrix<N, N, T>& J){
+        Matrix<N, N, T> JP = J * toMatrix();
+        for (uint8_t r = 0; r < N; r++)
+            for (uint8_t c = 0; c <= r; c++){
+                T sum = 0.0f;
+                for (uint8_t i = 0; i < N; i++)
+                    sum += JP._data[r][i] * J._data[c][i];
+                (*this)(r, c) = sum;
+            }
+    }
+};
+
+#endif
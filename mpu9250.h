@@ -4,9 +4,20 @@
 #include "Arduino.h"
 #include "bus.h"
 #include "ak8963.h"
+#include "blackbox.h"
+#include "calibstore.h"
+#include "gyrobias.h"
+#include "magcalib.h"
+#include "regcache.h"
+#include "profiler.h"
+#include "timing.h"
 #include "utils.h"
 
-class MPU9250 {
+// BusT is the bus the driver talks through. MPU9250 (typedef at the end) goes through virtual Bus calls, so any bus
+// can be picked at runtime, that is what SensorArray and the commands use. With a final bus class, e.g.
+// MPU9250T<SPIBus>, register access compiles to direct calls, see pipeline.h.
+template <typename BusT = Bus>
+class MPU9250T {
 public:
 
     enum Algorythm
@@ -15,7 +26,9 @@ public:
         MAHONY,
         DMP,
         EKF,
-        NONE
+        NONE,
+        MADGWICK_IMU,   // accel and gyro only, for installations which don't need heading
+        MAHONY_IMU
     };
 
     enum GyroRes
@@ -78,6 +91,10 @@ public:
     static const uint8_t ZMOT_THR       = 0x21;  // Zero-motion detection threshold bits [7:0]
     static const uint8_t ZRMOT_DUR      = 0x22;  // Duration counter threshold for zero motion interrupt generation, 16 Hz rate, LSB = 64 ms
     static const uint8_t FIFO_EN        = 0x23;
+    static const uint8_t TEMP_FIFO_EN   = 0x80;  // BIT[7] Write TEMP_OUT to the FIFO at the sample rate
+    static const uint8_t GYRO_FIFO_EN   = 0x70;  // BIT[6:4] Write GYRO_XOUT, GYRO_YOUT, GYRO_ZOUT to the FIFO
+    static const uint8_t ACCEL_FIFO_EN  = 0x08;  // BIT[3] Write ACCEL_XOUT, ACCEL_YOUT, ACCEL_ZOUT to the FIFO
+    static const uint8_t SLV0_FIFO_EN   = 0x01;  // BIT[0] Write EXT_SENS_DATA registers associated to SLV_0 to the FIFO
     static const uint8_t I2C_MST_CTRL   = 0x24; 
     static const uint8_t I2C_MST_CLK    = 0x0D;  // BIT[3:0]= 0x0D - 400 kHz I2C
     static const uint8_t WAIT_FOR_ES    = 6;     // BIT[6] Delays the data ready interrupt until external sensor data is loaded.
@@ -98,9 +115,18 @@ public:
     static const uint8_t INT_ENABLE     = 0x38;
     static const uint8_t RAW_RDY_EN     = 0;     // BIT[0] Enable Raw Sensor Data Ready interrupt to propagate to interrupt pin.
 
+    static const uint8_t INT_STATUS     = 0x3A;
+    static const uint8_t FIFO_OFLOW_INT = 4;     // BIT[4] FIFO overflow interrupt occurred
+
     static const uint8_t ACCEL_OUT      = 0x3B;
 
     static const uint8_t USER_CTRL      = 0x6A; 
+    static const uint8_t SIG_COND_RST   = 0;
+    static const uint8_t I2C_MST_RST    = 1;
+    static const uint8_t FIFO_RST       = 2;
+    static const uint8_t DMP_RST        = 3;
+    static const uint8_t FIFO_MODE_EN   = 6;
+    static const uint8_t DMP_EN         = 7;
     static const uint8_t I2C_IF_DIS     = 4;
     static const uint8_t I2C_MST_EN     = 5;
 
@@ -108,22 +134,71 @@ public:
     static const uint8_t H_RESET        = 7;
     static const uint8_t PWR_MGMT_2     = 0x6C;
 
+    // DMP memory is accessed through a bank register, start address within bank and auto-incremented data port
+    static const uint8_t BANK_SEL       = 0x6D;
+    static const uint8_t MEM_START_ADDR = 0x6E;
+    static const uint8_t MEM_R_W        = 0x6F;
+    static const uint8_t PRGM_START_H   = 0x70;  // DMP program start address, followed by PRGM_START_L
+    static const uint16_t DMP_BANK_SIZE     = 256;
+    static const uint8_t DMP_CHUNK_SIZE     = 16;
+    static const uint16_t DMP_START_ADDRESS = 0x0400;
+    static const uint16_t DMP_CFG_LP_QUAT   = 2712;      // DMP memory keys, as in InvenSense Motion Driver 6.12
+    static const uint16_t DMP_D_0_22        = 22 + 512;  // FIFO output rate divider
+    static const uint16_t DMP_SAMPLE_RATE   = 200;
+    static const uint16_t DMP_FIFO_RATE     = 200;
+    static const uint8_t DMP_PACKET_SIZE    = 16;        // low power quaternion: w, x, y, z as int32 Q30
+
     static const uint8_t FIFO_COUNTH    = 0x72;
     static const uint8_t FIFO_R_W       = 0x74;
+    static const uint16_t FIFO_SIZE     = 512;
+    // Sample frame, same layout as ACCEL_OUT burst: accel(6) + temp(2) + gyro(6) + SLV0 AK8963 ST1(1) + mag(6) + ST2(1)
+    static const uint8_t FIFO_FRAME_SIZE   = 22;
+    static const uint8_t FIFO_BURST_FRAMES = 11;  // bus transfers are limited to 255 bytes
+    static const uint16_t FIFO_DEFAULT_RATE = 1000; // Hz, FIFO holds 23 frames, ~23 ms of samples
+    static const uint8_t FRAME_ST1         = 14;  // frame offsets of magnetometer part
+    static const uint8_t FRAME_MAG         = 15;
+    static const uint8_t FRAME_ST2         = 21;
+    // Magnetometer updates at 100 Hz only, so sample reads stop at ST1 and the rest is fetched when it is set
+    static const uint8_t SAMPLE_READ_SIZE  = FRAME_MAG;
+    static const uint8_t RAW_DATA_SIZE  = 10;
     static const uint8_t XA_OFFSET_H    = 0x77;
     static const uint8_t XA_OFFSET_L    = 0x78;
     static const uint8_t YA_OFFSET_H    = 0x7A;
     static const uint8_t YA_OFFSET_L    = 0x7B;
     static const uint8_t ZA_OFFSET_H    = 0x7D;
     static const uint8_t ZA_OFFSET_L    = 0x7E;
+    static const uint8_t REGISTER_MAP_SIZE = 0x7F;
 
     static constexpr float G = 9.807f;
     static constexpr float d2r = 3.14159265359f/180.0f;
     static constexpr float tempScale = 333.87f;
     static constexpr float tempOffset = 21.0f;
+    static constexpr float gyroOffsetStep = 4.0f / 131.072f * d2r;  // XG_OFFSET_* LSB in rad/s, same for any range
+    static constexpr float gyroOffsetCommitTime = 1.0f;             // s at rest between offset register updates
 
-    bool _interrupt = false;
+    TimestampRing<8> _stamps;   // data ready times captured by setInterrupt() in ISR
+    uint32_t _sampleStamp = 0;  // data ready time of the sample readInterrupt() let through, in ticks
+    SampleClock _sampleClock;   // filter dt and interval statistics from sample timestamps
     bool _interrupts_enabled = false;
+    bool _fifoMode = false;
+    bool _streaming = false;    // a stream command reads samples, others mustn't read them in between
+    uint32_t _fifoOverflows = 0;
+    volatile bool _dataReady = false;
+    bool _readPending = false;
+    uint32_t _readStart = 0;            // ticks when background read was requested
+    volatile uint32_t _readDone = 0;    // ticks when it completed
+    uint8_t _asyncBuff[FIFO_FRAME_SIZE];
+    bool _magFresh = false;     // last parsed frame brought new magnetometer sample
+    bool _magValid = false;     // held magnetometer sample is usable, false after overflow and until the first one
+    uint32_t _magOverflows = 0;
+    int16_t _magRaw[3] = {0, 0, 0};         // last magnetometer sample, held between updates
+    float _magField[3] = {0.0f, 0.0f, 0.0f};  // and its corrected value
+    const uint8_t* _dmpImage = nullptr;
+    uint16_t _dmpImageSize = 0;
+    bool _dmpReady = false;
+    bool _verifyWrites = true;
+    bool _initialized = false;  // setup() was run at least once
+    RegisterCache<REGISTER_MAP_SIZE> _regs;  // shadow of configuration registers, see writeRegister()
     Algorythm  _algorythm ;
     GyroRes  _gyroRes     ;
     AccelRes _accelRes    ;
@@ -140,9 +215,25 @@ public:
     uint8_t _accelDLPFRegConfig;
     uint8_t _accelDLPFFCHOISEConfig;
 
-    Bus* _bus;
+    uint16_t _outputDataRate = 0;   // Hz, 0 = rate given by DLPF setting
+    uint8_t _sampleRateDiv = 0;
+
+    BusT* _bus;
     AK8963 _mag;
-    MPU9250 (Bus* bus) : _bus(bus), _mag(_bus) {
+    MagCalibrator _magCalibrator;  // fed by parseData() while active
+    GyroBiasEstimator _gyroBias;   // residual bias left after calibrate(), tracked while streaming
+    bool _trackGyroBias = true;
+    float _gyroOffsetWait = 0;
+    float _gyroOffsetMoved[3];      // rad/s written to XG_OFFSET_* which is still removed in software
+    uint16_t _gyroOffsetLag = 0;    // samples until the first one taken with the new offsets, 0 = none pending
+    uint8_t _fifoBacklog = 0;       // frames readFifo() returned which haven't been through trackGyroBias() yet
+    CalibrationStore* _store = nullptr;
+    uint8_t _storeSlot = 0;
+    bool _calibrated = false;   // gyro offsets are known, setup() restores them instead of running calibrate()
+    uint8_t _gyroOffsets[6];    // XG_OFFSET_H .. ZG_OFFSET_L
+    float _accelBias[3] = {0, 0, 0};
+    BlackBox* _blackBox = nullptr;  // records streamed samples while armed, see BlackBoxCommand
+    MPU9250T (BusT* bus) : _bus(bus), _mag(_bus) {
         _bus->begin();
 
         setAlgorythm(MADGWICK   );
@@ -209,22 +300,63 @@ public:
         } 
     }
 
+    // Output data rate in Hz (4..1000), 0 keeps the rate the DLPF settings give (gyro up to 32 kHz, accel 4 kHz).
+    // SMPLRT_DIV divides the 1 kHz internal rate, which needs both DLPFs enabled. Bandwidths wider than half
+    // the rate are narrowed to the widest one below it, so the chip doesn't alias while decimating.
+    void setOutputDataRate(uint16_t hz){
+        _sampleRateDiv = 0;
+        if (hz > 1000) hz = 1000;
+        _outputDataRate = hz;
+        if (hz == 0) return;
+        uint16_t div = (1000 + hz / 2) / hz;
+        if (div > 256) div = 256;
+        _sampleRateDiv = div - 1;
+
+        float nyquist = 500.0f / div;
+        static const float gyroBandwidth[] = {184, 92, 41, 20, 10, 5};          // BW_184Hz .. BW_5Hz
+        static const float accelBandwidth[] = {218, 99, 44, 21, 10.2f, 5.05f};  // BW_218Hz .. BW_5_05Hz
+        uint8_t gyro = BW_184Hz;
+        while ((gyro < BW_5Hz) && (gyroBandwidth[gyro - BW_184Hz] >= nyquist)) gyro++;
+        if (_gyroDLPF < gyro) setGyroDLPF((GyroDLPF) gyro);
+        uint8_t accel = BW_218Hz;
+        while ((accel < BW_5_05Hz) && (accelBandwidth[accel - BW_218Hz] >= nyquist)) accel++;
+        if (_accelDLPF < accel) setAccelDLPF((AccelDLPF) accel);
+    }
+
+    // Hz, 0 if not set
+    float outputDataRate(){
+        return _outputDataRate ? 1000.0f / (1 + _sampleRateDiv) : 0.0f;
+    }
+
+    // Called from data ready ISR
     void setInterrupt(){
-        _interrupt = true;
+        _stamps.push(cycleCount());
+    }
+
+    // Takes all pending data ready timestamps, stamp gets the newest one, or now when there are none.
+    // Returns number of data ready events taken.
+    uint8_t takeTimestamp(uint32_t& stamp){
+        uint8_t count = 0;
+        uint32_t pending;
+        while (_stamps.pop(pending)){
+            stamp = pending;
+            count++;
+        }
+        if (count == 0) stamp = cycleCount();
+        return count;
     }
 
+    // Without interrupts every poll is a sample, timestamped when it is polled
     bool readInterrupt(){
+        uint8_t count = takeTimestamp(_sampleStamp);
         if (!_interrupts_enabled) return true;
-        bool result = false;
-        cli();
-        result = _interrupt;
-        _interrupt = false;
-        sei();
-        return result;
+        if (count == 0) return false;
+        _sampleClock._jitter._missed += count - 1; // data registers only hold the newest sample
+        return true;
     }
 
     void toBypassMode() {
-        writeRegisterBit(PWR_MGMT_1, H_RESET);      // Power reset
+        hardReset();                                // Power reset
         writeRegister(INT_PIN_CFG, 0x02);           // Enable I2C bypass, disable FSYNC
         writeRegisterBit(USER_CTRL, I2C_MST_EN, 0); // Disable I2C Master Mode
     }
@@ -233,25 +365,56 @@ public:
         _interrupts_enabled = enable;
     }
 
+    // In FIFO mode samples are collected by the chip at the sample rate and drained in bursts by readFifo().
+    // Needs the DLPFs enabled and SMPLRT_DIV in use, the 8/32 kHz gyro rates overflow the FIFO almost instantly,
+    // so setup() applies the output data rate, FIFO_DEFAULT_RATE if none was set.
+    void setFifoMode(bool enable){
+        _fifoMode = enable;
+    }
+
+    void setTrackGyroBias(bool enable){
+        _trackGyroBias = enable;
+    }
+
+    // Register writes are checked by one batched read back at the end of setup() instead of one read per write
+    void setVerifyWrites(bool enable){
+        _verifyWrites = enable;
+    }
+
+    // With calibration restored from store, gyro offsets are written back instead of being measured again
     void setup() {
-        writeRegisterBit(PWR_MGMT_1, H_RESET);
-        float  gyroBias[3], accelBias[3];
-        calibrate(&gyroBias[0], &accelBias[0]);
-
-        Serial.print("Gyro Bias: [\t");
-        Serial.print(gyroBias[0]);
-        Serial.print(",\t");
-        Serial.print(gyroBias[1]);
-        Serial.print(",\t");
-        Serial.print(gyroBias[2]);
-        Serial.println("]");
-        Serial.print("Accel Bias: [\t");
-        Serial.print(accelBias[0]);
-        Serial.print(",\t");
-        Serial.print(accelBias[1]);
-        Serial.print(",\t");
-        Serial.print(accelBias[2]);
-        Serial.println("]");
+        _dmpReady = false;  // hard reset stops DMP, setupDmp() starts it again
+        hardReset();
+        _magValid = false;
+        _magOverflows = 0;
+        if (_calibrated) {
+            for (uint8_t i = 0; i < sizeof(_gyroOffsets); i++)
+                writeRegister(XG_OFFSET_H + i, _gyroOffsets[i], 0);
+        } else {
+            float  gyroBias[3];
+            calibrate(&gyroBias[0], &_accelBias[0]);
+            for (uint8_t i = 0; i < sizeof(_gyroOffsets); i++)
+                _gyroOffsets[i] = cachedRegister(XG_OFFSET_H + i);
+            _calibrated = true;
+
+            Serial.print("Gyro Bias: [\t");
+            Serial.print(gyroBias[0]);
+            Serial.print(",\t");
+            Serial.print(gyroBias[1]);
+            Serial.print(",\t");
+            Serial.print(gyroBias[2]);
+            Serial.println("]");
+            Serial.print("Accel Bias: [\t");
+            Serial.print(_accelBias[0]);
+            Serial.print(",\t");
+            Serial.print(_accelBias[1]);
+            Serial.print(",\t");
+            Serial.print(_accelBias[2]);
+            Serial.println("]");
+        }
+        _gyroBias.reset();
+        _gyroOffsetWait = 0;
+        _gyroOffsetLag = 0;
 
         writeRegister(PWR_MGMT_1, 0x01); // Auto selects the best available clock source – PLL if ready, else use the Internal oscillator
 
@@ -263,6 +426,8 @@ public:
         AK8963Setup();
         delay(20);
 
+        if (_fifoMode) setOutputDataRate(_outputDataRate ? _outputDataRate : FIFO_DEFAULT_RATE);
+        writeRegister(SMPLRT_DIV, _sampleRateDiv);
         writeRegister(CONFIG, _gyroDLPFRegConfig);
         writeRegister(GYRO_CONFIG, _gyroRegConfig|_gyroDLPFFCHOISEConfig);
         writeRegister(ACCEL_CONFIG, _accelRegConfig);
@@ -274,6 +439,287 @@ public:
             writeRegisterBit(INT_PIN_CFG, 5);   // INT pin level held until interrupt status is cleared        
             writeRegisterBit(INT_ENABLE, 0);    // RAW_RDY_EN
         }
+
+        if (_verifyWrites) verifyRegisters();
+
+        if (_fifoMode) {
+            enableFifo();
+        }
+        _initialized = true;
+        saveCalibration();
+    }
+
+    /********************************************************************
+    Calibration store
+    *********************************************************************/
+    // Loads calibration and configuration kept in slot, next setup() then skips calibrate().
+    // Returns false if slot holds no valid record, sensor is calibrated from scratch as before.
+    bool attachStore(CalibrationStore* store, uint8_t slot){
+        _store = store;
+        _storeSlot = slot;
+        CalibrationRecord record;
+        if (!_store->load(_storeSlot, record)) {
+            Serial.print(F("No stored calibration for sensor "));
+            Serial.println(slot);
+            return false;
+        }
+        restoreCalibration(record);
+        return true;
+    }
+
+    void restoreCalibration(const CalibrationRecord& record){
+        setAlgorythm((Algorythm) record.algorythm);
+        setGyroRes  ((GyroRes  ) record.gyroRes);
+        setAccelRes ((AccelRes ) record.accelRes);
+        setGyroDLPF ((GyroDLPF ) record.gyroDLPF);
+        setAccelDLPF((AccelDLPF) record.accelDLPF);
+        setFifoMode(record.fifoMode);
+        setOutputDataRate(record.outputDataRate);
+        for (uint8_t i = 0; i < 3; i++) _accelBias[i] = record.accelBias[i];
+        for (uint8_t i = 0; i < sizeof(_gyroOffsets); i++) _gyroOffsets[i] = record.gyroOffset[i];
+        _calibrated = true;
+
+        uint8_t asa[3] = {record.magAsa[0], record.magAsa[1], record.magAsa[2]};
+        _mag.writeFuseCache(&asa[0]);
+        _mag.setFactoryCalibration(&asa[0]);
+        _mag.setCorrection(record.magBias, record.magSoftIron);
+    }
+
+    void captureCalibration(CalibrationRecord& record){
+        for (uint8_t i = 0; i < 3; i++){
+            record.accelBias[i] = _accelBias[i];
+            record.magBias[i] = _mag._magBias[i];
+            for (uint8_t j = 0; j < 3; j++) record.magSoftIron[i][j] = _mag._magSoftIron[i][j];
+        }
+        for (uint8_t i = 0; i < sizeof(_gyroOffsets); i++) record.gyroOffset[i] = _gyroOffsets[i];
+        _mag.readFuseCache(&record.magAsa[0]);
+        record.algorythm = _algorythm;
+        record.gyroRes   = _gyroRes;
+        record.accelRes  = _accelRes;
+        record.gyroDLPF  = _gyroDLPF;
+        record.accelDLPF = _accelDLPF;
+        record.fifoMode  = _fifoMode;
+        record.outputDataRate = _outputDataRate;
+    }
+
+    // Storage skips bytes which didn't change, so saving an unchanged record costs no EEPROM wear.
+    // Nothing is saved before the sensor was calibrated and its fuse ROM read at least once.
+    bool saveCalibration(){
+        if (!_store || !_calibrated) return false;
+        uint8_t asa[3];
+        if (!_mag.readFuseCache(&asa[0])) return false;
+        CalibrationRecord record;
+        captureCalibration(record);
+        return _store->save(_storeSlot, record);
+    }
+
+    // Next setup() measures gyro offsets again
+    void forgetCalibration(){
+        _calibrated = false;
+    }
+
+    void enableFifo(){
+        writeRegister(FIFO_EN, 0x00);               // Stop writing samples while resetting
+        writeRegisterBit(USER_CTRL, FIFO_RST);      // Reset FIFO
+        writeRegister(FIFO_EN, TEMP_FIFO_EN | GYRO_FIFO_EN | ACCEL_FIFO_EN | SLV0_FIFO_EN);
+        writeRegisterBit(USER_CTRL, FIFO_MODE_EN);  // Enable FIFO
+    }
+
+    // Drops FIFO contents so that the next read starts on a frame boundary again
+    void resyncFifo(){
+        _fifoOverflows++;
+        writeRegisterBit(USER_CTRL, FIFO_RST, true, 0);
+    }
+
+    // Reads up to max_frames complete frames into dest using one burst read.
+    // Returns number of frames read or -1 if FIFO overflowed and was resynced, so samples were lost.
+    // The chip may be writing a frame while the count is read, so a remainder is left for the next call. Whole
+    // frames are all that is ever popped, alignment is only lost by an overflow.
+    int readFifo(uint8_t* dest, uint8_t max_frames, uint8_t frame_size = FIFO_FRAME_SIZE){
+        uint8_t data[2];
+        if (readRegister(INT_STATUS) & (1 << FIFO_OFLOW_INT)) {
+            resyncFifo();
+            return -1;
+        }
+        readRegisters(FIFO_COUNTH, 2, &data[0]);
+        uint16_t fifo_count = (((uint16_t)data[0] & 0x1F) << 8) | data[1];
+        uint16_t frames = fifo_count / frame_size;
+        if (frames > max_frames) frames = max_frames;
+        if (frames > 0) {
+            readRegisters(FIFO_R_W, frames * frame_size, dest, true);
+        }
+        if (frame_size == FIFO_FRAME_SIZE) _fifoBacklog = frames;
+        return frames;
+    }
+
+    // Called for every streamed sample, removes estimated residual bias from gyro rates of sensor_data.
+    // Once the sensor has been at rest for a while, whole register steps of the estimate are moved to XG_OFFSET_*,
+    // so raw data gets corrected as well and the stream goes on uninterrupted.
+    void trackGyroBias(float* sensor_data, float dt){
+        if (_fifoBacklog > 0) _fifoBacklog--;
+        if (!_trackGyroBias) return;
+        if ((_gyroOffsetLag > 0) && (--_gyroOffsetLag == 0)) {
+            for (uint8_t i = 0; i < 3; i++)
+                _gyroBias._bias[i] -= _gyroOffsetMoved[i];
+        }
+        if (!_gyroBias.update(sensor_data, dt)) {
+            _gyroOffsetWait = 0;
+            return;
+        }
+        _gyroOffsetWait += dt;
+        if ((_gyroOffsetWait < gyroOffsetCommitTime) || (_gyroOffsetLag > 0)) return;
+        _gyroOffsetWait = 0;
+        adjustGyroOffsets();
+    }
+
+    // Scales a sample other than the one just read, e.g. decimated output, including its magnetometer values.
+    // Unlike scaleData() it leaves _magField alone, which stale samples keep taking their magnetometer values from.
+    void scaleOutput(int16_t* raw, float* sensor_data){
+        scaleData(raw, sensor_data, false);
+        if (_magValid) _mag.correct(&raw[6], &sensor_data[6]);
+        removeGyroBias(sensor_data);
+    }
+
+    // Bias tracked by trackGyroBias() for samples which didn't go through it, e.g. decimated output
+    void removeGyroBias(float* sensor_data){
+        if (!_trackGyroBias) return;
+        for (uint8_t i = 0; i < 3; i++)
+            sensor_data[3 + i] -= _gyroBias._bias[i];
+    }
+
+    // Moves whole register steps of the tracked bias to the gyro offset registers, all axes in one burst so no
+    // sample is taken with half of a new offset. Samples already taken still carry the old offsets: those left in
+    // FIFO and in the burst being processed, or the one in the data registers. The software estimate keeps its
+    // value for them and drops the moved part with the first sample taken after the write (see trackGyroBias()).
+    void adjustGyroOffsets(){
+        uint8_t offsets[sizeof(_gyroOffsets)];
+        bool changed = false;
+        for (uint8_t i = 0; i < 3; i++){
+            int16_t current = (int16_t)(((uint16_t)_gyroOffsets[2 * i] << 8) | _gyroOffsets[2 * i + 1]);
+            int32_t offset = current - lrintf(_gyroBias._bias[i] / gyroOffsetStep);
+            if (offset > 32767) offset = 32767;
+            if (offset < -32768) offset = -32768;
+            offsets[2 * i] = (offset >> 8) & 0xFF;
+            offsets[2 * i + 1] = offset & 0xFF;
+            _gyroOffsetMoved[i] = (current - offset) * gyroOffsetStep;
+            changed |= (offset != current);
+        }
+        if (!changed) return;
+        writeRegisters(XG_OFFSET_H, sizeof(offsets), &offsets[0]);
+        memcpy(_gyroOffsets, offsets, sizeof(offsets));
+
+        uint16_t lag = 1;
+        if (_fifoMode && !_dmpReady) {
+            uint8_t data[2];
+            readRegisters(FIFO_COUNTH, 2, &data[0]);    // after the write, so it counts every frame taken before
+            lag += _fifoBacklog + ((((uint16_t)data[0] & 0x1F) << 8) | data[1]) / FIFO_FRAME_SIZE;
+        }
+        _gyroOffsetLag = lag;
+    }
+
+    /********************************************************************
+    DMP
+    *********************************************************************/
+    // DMP firmware image is InvenSense property and is not distributed with this sketch
+    void setDmpImage(const uint8_t* image, uint16_t size){
+        _dmpImage = image;
+        _dmpImageSize = size;
+    }
+
+    // Writes data to DMP memory in chunks which never cross a bank boundary, optionally reading each chunk back
+    bool writeDmpMemory(uint16_t address, uint16_t length, const uint8_t* data, bool verify = true){
+        uint8_t check[DMP_CHUNK_SIZE];
+        uint16_t i = 0;
+        while (i < length) {
+            uint16_t chunk = DMP_BANK_SIZE - ((address + i) & 0xFF);
+            if (chunk > DMP_CHUNK_SIZE) chunk = DMP_CHUNK_SIZE;
+            if (chunk > length - i) chunk = length - i;
+
+            setDmpMemoryAddress(address + i);
+            for (uint16_t j = 0; j < chunk; j++){
+                writeRegister(MEM_R_W, data[i + j], 0);
+            }
+            if (verify) {
+                setDmpMemoryAddress(address + i);
+                readRegisters(MEM_R_W, chunk, &check[0]);
+                if (memcmp(&check[0], &data[i], chunk) != 0) return false;
+            }
+            i += chunk;
+        }
+        return true;
+    }
+
+    void readDmpMemory(uint16_t address, uint16_t length, uint8_t* dest){
+        uint16_t i = 0;
+        while (i < length) {
+            uint16_t chunk = DMP_BANK_SIZE - ((address + i) & 0xFF);
+            if (chunk > length - i) chunk = length - i;
+            setDmpMemoryAddress(address + i);
+            readRegisters(MEM_R_W, chunk, &dest[i]);
+            i += chunk;
+        }
+    }
+
+    void setDmpMemoryAddress(uint16_t address){
+        writeRegister(BANK_SEL, address >> 8, 0);
+        writeRegister(MEM_START_ADDR, address & 0xFF, 0);
+    }
+
+    // Loads and verifies DMP image, then sets program start address
+    bool loadDmp(){
+        if (!_dmpImage) return false;
+        if (!writeDmpMemory(0, _dmpImageSize, _dmpImage)) return false;
+        writeRegister(PRGM_START_H, DMP_START_ADDRESS >> 8);
+        writeRegister(PRGM_START_H + 1, DMP_START_ADDRESS & 0xFF);
+        return true;
+    }
+
+    // Configures DMP to push low power quaternions to FIFO. Must be called after setup().
+    bool setupDmp(){
+        _dmpReady = false;
+        if (!loadDmp()) {
+            Serial.println(F("WARNING: DMP image is not set or failed verification."));
+            return false;
+        }
+
+        // DMP image expects 200 Hz sample rate, 41 Hz gyro bandwidth and 2000 dps gyro range. Set through the
+        // setters so that scales of the raw data read alongside and the stored configuration follow.
+        setGyroRes(DPS2000);
+        setOutputDataRate(DMP_SAMPLE_RATE);
+        setGyroDLPF(BW_41Hz);
+        writeRegister(SMPLRT_DIV, _sampleRateDiv);
+        writeRegister(CONFIG, _gyroDLPFRegConfig);
+        writeRegister(GYRO_CONFIG, _gyroRegConfig|_gyroDLPFFCHOISEConfig);
+        writeRegister(ACCEL_CONFIG2, _accelDLPFRegConfig|_accelDLPFFCHOISEConfig);
+
+        const uint8_t lpQuatEnable[4] = {0xC0, 0xC2, 0xC4, 0xC6};
+        uint16_t rateDiv = DMP_SAMPLE_RATE / DMP_FIFO_RATE - 1;
+        const uint8_t fifoRate[2] = {(uint8_t)(rateDiv >> 8), (uint8_t)(rateDiv & 0xFF)};
+        if (!writeDmpMemory(DMP_CFG_LP_QUAT, sizeof(lpQuatEnable), &lpQuatEnable[0])) return false;
+        if (!writeDmpMemory(DMP_D_0_22, sizeof(fifoRate), &fifoRate[0])) return false;
+
+        writeRegister(FIFO_EN, 0x00);               // Sensors don't write FIFO, DMP does
+        writeRegisterBit(USER_CTRL, FIFO_RST);
+        writeRegisterBit(USER_CTRL, DMP_RST);
+        writeRegisterBit(USER_CTRL, FIFO_MODE_EN);
+        writeRegisterBit(USER_CTRL, DMP_EN);
+        _dmpReady = true;
+        return true;
+    }
+
+    // Reads up to max_count quaternions (w, x, y, z) computed by DMP. Same return values as readFifo()
+    int readDmpQuaternions(float* q, uint8_t max_count){
+        uint8_t data[FIFO_BURST_FRAMES * DMP_PACKET_SIZE];
+        if (max_count > FIFO_BURST_FRAMES) max_count = FIFO_BURST_FRAMES;
+        int count = readFifo(&data[0], max_count, DMP_PACKET_SIZE);
+        for (int i = 0; i < count; i++){
+            for (int j = 0; j < 4; j++){
+                uint8_t* v = &data[i * DMP_PACKET_SIZE + j * 4];
+                int32_t q30 = ((int32_t)v[0] << 24) | ((int32_t)v[1] << 16) | ((int32_t)v[2] << 8) | v[3];
+                q[i * 4 + j] = (float)q30 / 1073741824.0f;
+            }
+        }
+        return count;
     }
 
     // Function which accumulates gyro and accelerometer data after device initialization. It calculates the average
@@ -285,7 +731,7 @@ public:
         int32_t gyro_bias[3]  = {0, 0, 0}, accel_bias[3] = {0, 0, 0};
 
         // reset device
-        writeRegisterBit(PWR_MGMT_1, H_RESET); // Write a one to bit 7 reset bit; toggle reset device
+        hardReset(); // Write a one to bit 7 reset bit; toggle reset device
         delay(20);
 
         // get stable time source; Auto select clock source to be PLL gyroscope reference if ready 
@@ -456,30 +902,102 @@ public:
     }
 
 
-    void readData(float* sensor_data){
-        uint8_t buff[21];
+    void readData(int16_t* raw, float* sensor_data){
+        uint8_t buff[FIFO_FRAME_SIZE];
         // grab the data from the MPU9250
-        readRegisters(ACCEL_OUT, sizeof(buff), &buff[0], true); 
-        int16_t accel[3];
-        // combine into 16 bit values
-        to16bit(&buff[0], &accel[0], 3);
+        readRegisters(ACCEL_OUT, SAMPLE_READ_SIZE, &buff[0], true); 
+        readMagData(&buff[0]);
+        parseData(&buff[0], raw, sensor_data);
+    }
 
-        int16_t gyro[3];
-        to16bit(&buff[8], &gyro[0], 3);
+    // Completes frame with magnetometer data and ST2 if ST1 says there is a new sample. SLV0 reads ST2 on every
+    // sample cycle, which clears DRDY, so it is set in exactly one frame per magnetometer update.
+    void readMagData(uint8_t* buff){
+        if (buff[FRAME_ST1] & AK8963::ST1_DRDY)
+            readRegisters(EXT_SENS_DATA_00 + 1, FIFO_FRAME_SIZE - FRAME_MAG, &buff[FRAME_MAG], true);
+    }
 
-        int16_t mag[3];
-        if( !(buff[20] & 0x08) ) { // check for overflow
-            to16bit(&buff[14], &mag[0], 3, true);
+    void readData(float* sensor_data){
+        int16_t raw[RAW_DATA_SIZE];
+        readData(&raw[0], sensor_data);
+    }
+
+    // Starts reading next sample in background. Sample is available through fetchData() once transfer completes,
+    // so the previous sample can be processed while this one is being clocked in.
+    bool requestData(){
+        if (_readPending) return false;
+        _readPending = true;
+        _readStart = cycleCount();
+        if (!_bus->readBytesAsync(MPU9250_I2C_ADDRESS, ACCEL_OUT, SAMPLE_READ_SIZE, &_asyncBuff[0], &MPU9250T::onDataRead, this)){
+            _readPending = false;
+            return false;
         }
-        else{
-            Serial.println(F("WARNING: Magnetometer overflow."));
-            mag[0] = 0;  
-            mag[2] = 0;
-            mag[1] = 0;
+        return true;
+    }
+
+    bool fetchData(int16_t* raw, float* sensor_data){
+        if (!_dataReady) return false;
+        PROFILE_ADD(STAGE_BUS_READ, _readDone - _readStart);
+        readMagData(&_asyncBuff[0]);
+        parseData(&_asyncBuff[0], raw, sensor_data);
+        _dataReady = false;
+        _readPending = false;
+        return true;
+    }
+
+    static void onDataRead(void* context){
+        ((MPU9250T*) context)->_readDone = cycleCount();
+        ((MPU9250T*) context)->_dataReady = true;
+    }
+
+    // Converts one raw frame (ACCEL_OUT burst or FIFO frame) to 16 bit values and to scaled sensor data.
+    // raw gets RAW_DATA_SIZE values: ax, ay, az, gx, gy, gz, hx, hy, hz (magnetometer axes), t.
+    // Magnetometer part of the frame is only looked at when ST1 flags new data, otherwise the last sample is held.
+    void parseData(uint8_t* buff, int16_t* raw, float* sensor_data){
+        PROFILE_SCOPE(STAGE_PARSE);
+        int16_t* accel = &raw[0];
+        // combine into 16 bit values
+        to16bit(&buff[0], accel, 3);
+
+        int16_t* gyro = &raw[3];
+        to16bit(&buff[8], gyro, 3);
+
+        _magFresh = buff[FRAME_ST1] & AK8963::ST1_DRDY;
+        if (_magFresh) {
+            _magValid = !(buff[FRAME_ST2] & 0x08); // check for overflow
+            if (_magValid) {
+                to16bit(&buff[FRAME_MAG], &_magRaw[0], 3, true);
+                if (_magCalibrator._active) _magCalibrator.addSample(_magRaw, _mag._magCalibration);
+            }
+            else{
+                // fusion falls back to accel and gyro until next valid sample, see StartSensorsCommand::updateFilter()
+                if (_magOverflows++ == 0) Serial.println(F("WARNING: Magnetometer overflow."));
+                _magRaw[0] = 0;  
+                _magRaw[2] = 0;
+                _magRaw[1] = 0;
+            }
         }
+        raw[6] = _magRaw[0];
+        raw[7] = _magRaw[1];
+        raw[8] = _magRaw[2];
 
-        int16_t temperature;
-        to16bit(&buff[6], &temperature);
+        to16bit(&buff[6], &raw[9]);
+
+        scaleData(raw, sensor_data, _magFresh);
+    }
+
+    void parseData(uint8_t* buff, float* sensor_data){
+        int16_t raw[RAW_DATA_SIZE];
+        parseData(buff, &raw[0], sensor_data);
+    }
+
+    // Magnetometer correction is only computed for fresh samples, stale ones get the last corrected value.
+    // Invalid magnetometer sample is passed on as zero field.
+    void scaleData(int16_t* raw, float* sensor_data, bool magFresh = true){
+        int16_t* accel = &raw[0];
+        int16_t* gyro = &raw[3];
+        int16_t* mag = &raw[6];
+        int16_t temperature = raw[9];
 
         // accel
         sensor_data[0] = ((float) accel[0]) * _accelScale; 
@@ -492,9 +1010,13 @@ public:
         sensor_data[5] = ((float) gyro[2]) * _gyroScale;
 
         // magnet
-        sensor_data[6] = (((float) mag[1])  * _mag._magCalibration[1] - _mag._magBias[1]) * _mag._magScale[1]; 
-        sensor_data[7] = (((float) mag[0])  * _mag._magCalibration[0] - _mag._magBias[0]) * _mag._magScale[0];
-        sensor_data[8] = -(((float) mag[2]) * _mag._magCalibration[2] - _mag._magBias[2]) * _mag._magScale[2];
+        if (magFresh) {
+            if (_magValid) _mag.correct(mag, &_magField[0]);
+            else _magField[0] = _magField[1] = _magField[2] = 0.0f;
+        }
+        sensor_data[6] = _magField[0];
+        sensor_data[7] = _magField[1];
+        sensor_data[8] = _magField[2];
 
         // temperature
         sensor_data[9] = (( ((float) temperature) - tempOffset )/tempScale) + tempOffset; 
@@ -504,19 +1026,104 @@ public:
     /********************************************************************
     UTILS
     *********************************************************************/
-    void writeRegisterBit(uint8_t address, byte n, bool v = true, uint8_t delay_ms = 10){
-        byte settings = readRegister(address);
+    // Current value comes from the shadow copy, so only the first update of a register after reset reads the bus
+    void writeRegisterBit(uint8_t address, byte n, bool v = true, uint8_t delay_ms = 1){
+        byte settings = cachedRegister(address);
         setNthBit(&settings, n, v);
         writeRegister(address, settings, delay_ms);
     }
 
+    // Burst write of count consecutive registers, see Bus::writeBytes()
+    bool writeRegisters(uint8_t address, uint8_t count, const uint8_t* data, uint8_t delay_ms = 0){
+        bool res = _bus->writeBytes(MPU9250_I2C_ADDRESS, address, count, data);
+        for (uint8_t i = 0; i < count; i++) cacheRegister(address + i, data[i]);
+        delay(delay_ms);
+        return res;
+    }
+
     bool writeRegister(uint8_t address, uint8_t data, uint8_t delay_ms = 1){
         bool res = _bus->writeByte(MPU9250_I2C_ADDRESS, address, data);
+        cacheRegister(address, data);
         delay(delay_ms);
         return res;
     }
 
+    // Resets every register to its default, shadow copy is dropped as well
+    void hardReset(){
+        writeRegister(PWR_MGMT_1, 1 << H_RESET, 10);
+    }
+
+    // Status, data, FIFO and DMP memory port registers are changed by the chip itself
+    static bool isCacheable(uint8_t address){
+        if (address >= REGISTER_MAP_SIZE) return false;
+        if ((address >= INT_STATUS) && (address <= EXT_SENS_DATA_00 + 23)) return false;
+        if ((address == MEM_START_ADDR) || (address == MEM_R_W)) return false;
+        if ((address >= FIFO_COUNTH) && (address <= FIFO_R_W)) return false;
+        return address != 0x36; // I2C_MST_STATUS
+    }
+
+    // Bits which clear themselves once the chip acts on them, they never stay set in the shadow copy
+    static uint8_t selfClearingBits(uint8_t address){
+        if (address == USER_CTRL) return (1 << SIG_COND_RST) | (1 << I2C_MST_RST) | (1 << FIFO_RST) | (1 << DMP_RST);
+        return 0;
+    }
+
+    void cacheRegister(uint8_t address, uint8_t data){
+        if ((address == PWR_MGMT_1) && (data & (1 << H_RESET))) {
+            _regs.invalidate();
+            return;
+        }
+        if (isCacheable(address)) _regs.set(address, data & ~selfClearingBits(address));
+    }
+
+    byte cachedRegister(uint8_t address){
+        if (_regs.isValid(address)) return _regs.get(address);
+        byte data = readRegister(address);
+        if (isCacheable(address)) _regs.set(address, data);
+        return data;
+    }
+
+    // Registers a read changes the chip with: INT_STATUS clears the interrupt flags (a data ready or FIFO
+    // overflow the driver waits for would be lost), FIFO_R_W pops a FIFO byte and breaks frame alignment
+    static bool readHasSideEffects(uint8_t address){
+        return (address == INT_STATUS) || (address == FIFO_R_W);
+    }
+
+    // Reads the whole register map into dest in bursts around the registers with read side effects, which read
+    // as 0, so it is safe while sensors stream
+    void dumpRegisters(uint8_t* dest){
+        uint8_t start = 0;
+        for (uint8_t address = 0; address <= REGISTER_MAP_SIZE; address++){
+            if ((address < REGISTER_MAP_SIZE) && !readHasSideEffects(address)) continue;
+            if (address > start) readRegisters(start, address - start, &dest[start]);
+            if (address < REGISTER_MAP_SIZE) dest[address] = 0;
+            start = address + 1;
+        }
+    }
+
+    // Reads register map back (see dumpRegisters()) and compares it with the shadow copy.
+    // Returns number of registers which don't hold the written value.
+    uint8_t verifyRegisters(){
+        uint8_t actual[REGISTER_MAP_SIZE];
+        dumpRegisters(&actual[0]);
+        uint8_t mismatches = 0;
+        for (uint8_t address = 0; address < REGISTER_MAP_SIZE; address++){
+            if (!_regs.isValid(address) || readHasSideEffects(address)) continue;
+            if (actual[address] == _regs.get(address)) continue;
+            mismatches++;
+            Serial.print(F("WARNING: Register write failed: "));
+            Serial.print(address, HEX);
+            Serial.print(F(" expected "));
+            Serial.print(_regs.get(address), HEX);
+            Serial.print(F(" actual "));
+            Serial.println(actual[address], HEX);
+            _regs.set(address, actual[address]);
+        }
+        return mismatches;
+    }
+
     void readRegisters(uint8_t address, uint8_t count, uint8_t* dest, bool fast = false){
+        PROFILE_SCOPE(STAGE_BUS_READ);
         _bus->readBytes(MPU9250_I2C_ADDRESS, address, count, dest, fast);
     }
 
@@ -528,24 +1135,15 @@ public:
     // Magnetometer AK8963 registers Read\Write using mpu I2C Master features
     // We'll use these when there is no ability to communicate directly by i2c
     //************************************************************************ 
-    bool writeAK8963Register(uint8_t address, uint8_t data){
+    // Written value is checked later by verifyAK8963Registers() rather than read back right away
+    void writeAK8963Register(uint8_t address, uint8_t data){
         uint8_t count = 1;
-        uint8_t buff[1];
 
         writeRegister(I2C_SLV0_ADDR, AK8963::I2C_ADDRESS); // set slave 0 to the AK8963 and set for write
         writeRegister(I2C_SLV0_REG, address);              // set the register to the desired AK8963 sub address
         writeRegister(I2C_SLV0_DO,data);                   // store the data for write
-        writeRegister(I2C_SLV0_CTRL, I2C_SLV0_EN | count);  // enable I2C and send 1 byte
-
-        // read the register and confirm
-        readAK8963Registers(address, sizeof(buff), &buff[0]);
-
-        if(buff[0] == data) {
-            return true;
-        }
-        else{
-            return false;
-        }
+        writeRegister(I2C_SLV0_CTRL, I2C_SLV0_EN | count);  // enable I2C and send 1 byte, goes out within the write delay
+        _mag.cacheRegister(address, data);
     }
 
     void readAK8963Registers(uint8_t address, uint8_t count, uint8_t* dest){
@@ -556,69 +1154,38 @@ public:
         readRegisters(EXT_SENS_DATA_00,count,dest);         // read the bytes off the MPU9250 EXT_SENS_DATA registers
     }
 
+    // Compares AK8963 control registers with its shadow copy using one read. Returns number of mismatches.
+    uint8_t verifyAK8963Registers(){
+        uint8_t actual[AK8963::I2CDIS - AK8963::CNTL1 + 1];
+        readAK8963Registers(AK8963::CNTL1, sizeof(actual), &actual[0]);
+        return _mag.verifyRegisters(AK8963::CNTL1, sizeof(actual), &actual[0]);
+    }
+
     void AK8963Setup(){
         writeAK8963Register(AK8963::CNTL1, AK8963::CNTL1_PWR_DOWN); // Power down magnetometer  
-        writeAK8963Register(AK8963::CNTL1, AK8963::CNTL1_FUSE); // Enter Fuse ROM access mode
 
-        // Extract the factory calibration for each magnetometer axis
+        // Extract the factory calibration for each magnetometer axis, fuse ROM never changes so it is read once
         uint8_t rawData[3];  
-        readAK8963Registers(AK8963::ASAX, 3, rawData);  // Read the x-, y-, and z-axis calibration values
-        float magnetometerResolution = 4912.0f / 32760.0f; // micro Tesla
-        _mag._magCalibration[0] = ((float)(rawData[0] - 128)/256. + 1.) * magnetometerResolution; 
-        _mag._magCalibration[1] = ((float)(rawData[1] - 128)/256. + 1.) * magnetometerResolution;  
-        _mag._magCalibration[2] = ((float)(rawData[2] - 128)/256. + 1.) * magnetometerResolution; 
+        if (!_mag.readFuseCache(&rawData[0])) {
+            writeAK8963Register(AK8963::CNTL1, AK8963::CNTL1_FUSE); // Enter Fuse ROM access mode
+            readAK8963Registers(AK8963::ASAX, 3, rawData);  // Read the x-, y-, and z-axis calibration values
+            _mag.writeFuseCache(&rawData[0]);
+            writeAK8963Register(AK8963::CNTL1, AK8963::CNTL1_PWR_DOWN); // Power down magnetometer  
+            delay(100);
+        }
+        _mag.setFactoryCalibration(&rawData[0]);
 
-        writeAK8963Register(AK8963::CNTL1, AK8963::CNTL1_PWR_DOWN); // Power down magnetometer  
-        delay(100);
         writeAK8963Register(AK8963::CNTL1, AK8963::CNTL1_CONT_MEAS_2); // Set mode to 16 bit resolution at 100Hz continuous reading
+        if (_verifyWrites) verifyAK8963Registers();
         
         // By this read we setup auto slave reading and actually read for the first time.
-        uint8_t buff[7];
-        readAK8963Registers(AK8963::HXL, 7, buff);
-    }
-
-    void AK8963calibrate(float* bias, float* scale){
-        uint16_t ii = 0, sample_count = 1500; // at 100 Hz ODR, new mag data is available every 10 ms
-        int32_t int32_bias[3] = {0, 0, 0}, int32_scale[3] = {0, 0, 0};
-        int16_t mag_max[3] = {-32767, -32767, -32767}, mag_min[3] = {32767, 32767, 32767}, mag_temp[3] = {0, 0, 0};
-        delay(4000);
-
-        // shoot for ~fifteen seconds of mag data
-        for(ii = 0; ii < sample_count; ii++) {
-            uint8_t buffer[7];
-            readAK8963Registers(AK8963::HXL, 7, buffer);  
-            to16bit(&buffer[0], mag_temp, 3, true);
-            if (!_mag.isOverflow(buffer[6])){  // Read the mag data   
-                for (int jj = 0; jj < 3; jj++) {
-                    if(mag_temp[jj] > mag_max[jj]) mag_max[jj] = mag_temp[jj];
-                    if(mag_temp[jj] < mag_min[jj]) mag_min[jj] = mag_temp[jj];
-                }
-            }
-            delay(12);  // at 100 Hz ODR, new mag data is available every 10 ms
-        }
-
-        // Get hard iron correction
-        int32_bias[0]  = (mag_max[0] + mag_min[0])/2;  // get average x mag bias in counts
-        int32_bias[1]  = (mag_max[1] + mag_min[1])/2;  // get average y mag bias in counts
-        int32_bias[2]  = (mag_max[2] + mag_min[2])/2;  // get average z mag bias in counts
-
-        bias[0] = (float) int32_bias[0] * _mag._magCalibration[0];  // save mag biases in uT for main program
-        bias[1] = (float) int32_bias[1] * _mag._magCalibration[1];   
-        bias[2] = (float) int32_bias[2] * _mag._magCalibration[2];  
-
-        // Get soft iron correction estimate
-        int32_scale[0]  = (mag_max[0] - mag_min[0])/2;  // get average x axis max chord length in counts
-        int32_scale[1]  = (mag_max[1] - mag_min[1])/2;  // get average y axis max chord length in counts
-        int32_scale[2]  = (mag_max[2] - mag_min[2])/2;  // get average z axis max chord length in counts
-
-        float avg_rad = int32_scale[0] + int32_scale[1] + int32_scale[2];
-        avg_rad /= 3.0;
-
-        scale[0] = avg_rad/((float)int32_scale[0]);
-        scale[1] = avg_rad/((float)int32_scale[1]);
-        scale[2] = avg_rad/((float)int32_scale[2]);
+        // Status registers are read along, so data ready is known without fetching the data itself, see readMagData().
+        uint8_t buff[FIFO_FRAME_SIZE - FRAME_ST1];
+        readAK8963Registers(AK8963::ST1, sizeof(buff), buff);
     }
 
 };
 
+typedef MPU9250T<Bus> MPU9250;
+
 #endif
\ No newline at end of file
@@ -0,0 +1,196 @@
+#ifndef PIPELINE_h
+#define PIPELINE_h
+
+#include "mpu9250.h"
+#include "filters.h"
+#include "ekf.h"
+#include "decimator.h"
+#include "transport.h"
+
+// Single sensor sample pipeline fixed at compile time: bus, fusion and output are template parameters, so the per
+// sample path (interrupt, transfer, parse, bias tracking, filter, output) has no virtual calls and no algorythm
+// switch, and the compiler is free to inline across stages. For dedicated builds with a known setup, e.g.
+//   MPU9250Pipeline<SPIBus, MadgwickFusion, FloatStreamOutput<CMD_START_SENSORS> > pipeline(&spibus,
+//       FloatStreamOutput<CMD_START_SENSORS>(&transport));
+// The command driven firmware keeps MPU9250 and StartSensorsCommand, which choose bus and filter at runtime.
+//
+// FusionT has _q, reset(q) and update(sensor_data, dt, magValid, magFresh).
+// OutputT has write(sensor, raw, sensor_data, q, dt), sensor_data may be overwritten.
+
+class MadgwickFusion {
+public:
+    float _q[4];
+
+    void reset(const float* q){
+        for (uint8_t i = 0; i < 4; i++) _q[i] = q[i];
+    }
+
+    void update(float* sensor_data, float dt, bool magValid, bool magFresh){
+        if (magValid) MadgwickQuaternionUpdate(sensor_data, _q, dt, magFresh);
+        else MadgwickImuUpdate(sensor_data, _q, dt);
+    }
+};
+
+class MahonyFusion {
+public:
+    float _q[4];
+    float _eInt[3];
+
+    void reset(const float* q){
+        for (uint8_t i = 0; i < 4; i++) _q[i] = q[i];
+        for (uint8_t i = 0; i < 3; i++) _eInt[i] = 0.0f;
+    }
+
+    void update(float* sensor_data, float dt, bool magValid, bool magFresh){
+        if (magValid) MahonyQuaternionUpdate(sensor_data, _eInt, _q, dt, magFresh);
+        else MahonyImuUpdate(sensor_data, _eInt, _q, dt);
+    }
+};
+
+class MadgwickImuFusion {
+public:
+    float _q[4];
+
+    void reset(const float* q){
+        for (uint8_t i = 0; i < 4; i++) _q[i] = q[i];
+    }
+
+    void update(float* sensor_data, float dt, bool, bool){
+        MadgwickImuUpdate(sensor_data, _q, dt);
+    }
+};
+
+class MahonyImuFusion {
+public:
+    float _q[4];
+    float _eInt[3];
+
+    void reset(const float* q){
+        for (uint8_t i = 0; i < 4; i++) _q[i] = q[i];
+        for (uint8_t i = 0; i < 3; i++) _eInt[i] = 0.0f;
+    }
+
+    void update(float* sensor_data, float dt, bool, bool){
+        MahonyImuUpdate(sensor_data, _eInt, _q, dt);
+    }
+};
+
+class EkfFusion {
+public:
+    float _q[4];
+    QuaternionEKF<float> _ekf;
+
+    void reset(const float* q){
+        for (uint8_t i = 0; i < 4; i++) _q[i] = q[i];
+        _ekf.reset(_q);
+    }
+
+    void update(float* sensor_data, float dt, bool magValid, bool magFresh){
+        _ekf.update(sensor_data, dt, magValid && magFresh);
+        _ekf.getQuaternion(_q);
+    }
+};
+
+// Raw data only, quaternion stays zero like with MPU9250::NONE
+class NoFusion {
+public:
+    float _q[4] = {0, 0, 0, 0};
+
+    void reset(const float*){
+    }
+
+    void update(float*, float, bool, bool){
+    }
+};
+
+class NullOutput {
+public:
+    template <typename SensorT>
+    void write(SensorT&, const int16_t*, float*, const float*, float){
+    }
+};
+
+// Same packets as StartSensorsCommand in STREAM_FLOAT format: ax .. t, q, uint32 sample time in us and sensor id,
+// after the same decimator, so host tools read both alike.
+template <uint8_t CMD, uint8_t ID = 0>
+class FloatStreamOutput {
+public:
+    static const uint8_t FLOAT_DATA_LEN = 15 * sizeof(float) + 1;
+
+    Transport* _transport;
+    CicDecimator<MPU9250::RAW_DATA_SIZE> _decimator;
+    uint32_t _sendFailures = 0;
+    uint8_t _packet[Transport::PACKET_SIZE];
+
+    // A factor the decimator rejects leaves it at 1, setFactor() tells
+    FloatStreamOutput(Transport* transport, uint16_t factor = 1):_transport(transport) {
+        setFactor(factor);
+    }
+
+    bool setFactor(uint16_t factor){
+        return _decimator.setFactor(factor);
+    }
+
+    template <typename SensorT>
+    void write(SensorT& sensor, const int16_t* raw, float* sensor_data, const float* q, float dt){
+        int16_t decimated[MPU9250::RAW_DATA_SIZE];
+        if (!_decimator.add(raw, &decimated[0])) return;
+        float values[15];
+        if (_decimator._factor > 1) sensor.scaleOutput(&decimated[0], values);
+        else memcpy(values, sensor_data, 10 * sizeof(float));
+        for (uint8_t i = 0; i < 4; i++) values[10 + i] = q[i];
+        uint32_t time_us = sensor._sampleClock.timeMicros();
+        memcpy(&values[14], &time_us, sizeof(time_us));
+
+        _packet[0] = CMD;
+        _packet[1] = FLOAT_DATA_LEN;
+        _packet[2] = 0;
+        memcpy(&_packet[3], &values[0], sizeof(values));
+        _packet[3 + sizeof(values)] = ID;
+        memset(&_packet[4 + sizeof(values)], 0, Transport::PACKET_SIZE - 4 - sizeof(values));
+        if (_transport->send(_packet, 0) <= 0) _sendFailures++;  // never waits for the host, see txqueue.h
+    }
+};
+
+template <typename BusT, typename FusionT, typename OutputT>
+class MPU9250Pipeline {
+public:
+    MPU9250T<BusT> _sensor;
+    FusionT _fusion;
+    OutputT _output;
+
+    MPU9250Pipeline(BusT* bus, const OutputT& output = OutputT()):_sensor(bus), _output(output) {};
+
+    void setup(){
+        const float q[4] = {1.0f, 0.0f, 0.0f, 0.0f};
+        _sensor.setup();
+        _fusion.reset(q);
+        _sensor._sampleClock.start();
+    }
+
+    // Call from loop(), returns true if a sample went through. Same order as StartSensorsCommand::exec(): the next
+    // transfer is started before the finished sample is fused, so both overlap on DMA capable buses.
+    bool step(){
+        int16_t raw[MPU9250::RAW_DATA_SIZE];
+        float sensor_data[MPU9250::RAW_DATA_SIZE];
+        bool ready = _sensor.fetchData(&raw[0], &sensor_data[0]);
+        uint32_t stamp = _sensor._sampleStamp;
+
+        if (!_sensor._readPending && !_sensor._bus->busy() && _sensor.readInterrupt()) _sensor.requestData();
+
+        if (ready) process(raw, sensor_data, _sensor._sampleClock.update(stamp));
+        return ready;
+    }
+
+    void process(int16_t* raw, float* sensor_data, float dt){
+        if (_sensor._blackBox) _sensor._blackBox->add(raw, sensor_data, dt);
+        {
+            PROFILE_SCOPE(STAGE_FILTER);
+            _sensor.trackGyroBias(sensor_data, dt);
+            _fusion.update(sensor_data, dt, _sensor._magValid, _sensor._magFresh);
+        }
+        _output.write(_sensor, raw, sensor_data, _fusion._q, dt);
+    }
+};
+
+#endif
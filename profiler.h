@@ -0,0 +1,103 @@
+#ifndef PROFILER_h
+#define PROFILER_h
+
+#include "timing.h"
+
+// Per stage cycle counts of the sample pipeline, read out by StatsCommand. A scope costs two cycle counter
+// reads and a few adds, define ENABLE_PROFILING 0 before including to compile it out.
+#ifndef ENABLE_PROFILING
+#define ENABLE_PROFILING 1
+#endif
+
+enum ProfileStage
+{
+    STAGE_BUS_READ,     // synchronous register reads, and request to completion of background sample reads
+    STAGE_PARSE,        // raw frame to 16 bit values and scaled sensor data
+    STAGE_FILTER,       // gyro bias tracking and orientation filter update
+    STAGE_SEND,         // USB packet send
+    STAGE_RECEIVE,      // USB command poll
+    STAGE_LOOP,         // whole loop() iteration
+    STAGE_COUNT
+};
+
+// Histogram bin i counts durations of 2^(i + HIST_SHIFT) .. 2^(i + HIST_SHIFT + 1) - 1 ticks, first and last bins
+// take everything below and above.
+class StageStats {
+public:
+    static const uint8_t HIST_BINS = 20;
+    static const uint8_t HIST_SHIFT = 4;
+
+    uint32_t _count;
+    uint64_t _total;
+    uint32_t _min;
+    uint32_t _max;
+    uint16_t _hist[HIST_BINS];  // saturating
+
+    StageStats(){
+        reset();
+    }
+
+    void reset(){
+        _count = 0;
+        _total = 0;
+        _min = 0xFFFFFFFF;
+        _max = 0;
+        for (uint8_t i = 0; i < HIST_BINS; i++) _hist[i] = 0;
+    }
+
+    void add(uint32_t ticks){
+        _count++;
+        _total += ticks;
+        if (ticks < _min) _min = ticks;
+        if (ticks > _max) _max = ticks;
+        int bin = (ticks ? 31 - __builtin_clz(ticks) : 0) - HIST_SHIFT;
+        if (bin < 0) bin = 0;
+        if (bin >= HIST_BINS) bin = HIST_BINS - 1;
+        if (_hist[bin] != 0xFFFF) _hist[bin]++;
+    }
+
+    uint32_t mean() const {
+        return _count ? (uint32_t)(_total / _count) : 0;
+    }
+};
+
+class Profiler {
+public:
+    StageStats _stages[STAGE_COUNT];
+
+    void add(ProfileStage stage, uint32_t ticks){
+        _stages[stage].add(ticks);
+    }
+
+    void reset(){
+        for (uint8_t i = 0; i < STAGE_COUNT; i++) _stages[i].reset();
+    }
+};
+
+inline Profiler& profiler(){
+    static Profiler instance;
+    return instance;
+}
+
+// Adds time from construction to destruction to stage
+class ProfileScope {
+public:
+    ProfileStage _stage;
+    uint32_t _start;
+
+    ProfileScope(ProfileStage stage):_stage(stage), _start(cycleCount()) {};
+
+    ~ProfileScope(){
+        profiler().add(_stage, cycleCount() - _start);
+    }
+};
+
+#if ENABLE_PROFILING
+#define PROFILE_SCOPE(stage) ProfileScope _profileScope(stage)
+#define PROFILE_ADD(stage, ticks) profiler().add(stage, ticks)
+#else
+#define PROFILE_SCOPE(stage)
+#define PROFILE_ADD(stage, ticks)
+#endif
+
+#endif
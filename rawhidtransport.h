@@ -0,0 +1,22 @@
+#ifndef RAWHIDTransport_h
+#define RAWHIDTransport_h
+
+#include "Arduino.h"
+#include "transport.h"
+
+// USB Raw HID (USB type "Raw HID"). One packet per 64 byte report, polled by the host once per ms.
+class RawHIDTransport : public Transport {
+public:
+    int send(const uint8_t* packet, uint16_t timeout){
+        int n = RawHID.send(packet, timeout);
+        if (n > 0) _sent++;
+        else _dropped++;
+        return n;
+    }
+
+    int recv(uint8_t* packet, uint16_t timeout){
+        return RawHID.recv(packet, timeout);
+    }
+};
+
+#endif
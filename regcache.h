@@ -0,0 +1,43 @@
+#ifndef REGCACHE_h
+#define REGCACHE_h
+
+#include <stdint.h>
+
+// Shadow copy of a chip register map. Kept coherent by the driver on every write, so bit updates
+// don't need a read back first. Registers the chip changes on its own must never be stored here.
+template <uint8_t SIZE>
+class RegisterCache {
+public:
+    uint8_t _values[SIZE];
+    uint8_t _valid[(SIZE + 7) / 8];
+
+    RegisterCache(){
+        invalidate();
+    }
+
+    bool isValid(uint8_t address) const {
+        return (address < SIZE) && (_valid[address >> 3] & (1 << (address & 0x07)));
+    }
+
+    uint8_t get(uint8_t address) const {
+        return _values[address];
+    }
+
+    void set(uint8_t address, uint8_t value){
+        if (address >= SIZE) return;
+        _values[address] = value;
+        _valid[address >> 3] |= (1 << (address & 0x07));
+    }
+
+    void invalidate(uint8_t address){
+        if (address >= SIZE) return;
+        _valid[address >> 3] &= ~(1 << (address & 0x07));
+    }
+
+    // Whole map is unknown again, e.g. after chip reset
+    void invalidate(){
+        for (uint8_t i = 0; i < sizeof(_valid); i++) _valid[i] = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef SENSORARRAY_h
+#define SENSORARRAY_h
+
+#include "MPU9250.h"
+
+// Several MPU9250 chips sharing one bus, each keeps its own configuration and calibration.
+// Sensor id is the index the chip was added with.
+class SensorArray {
+public:
+    static const uint8_t MAX_SENSORS = 4;
+
+    MPU9250* _sensors[MAX_SENSORS];
+    uint8_t _count;
+    uint8_t _next;  // round robin position of the scheduler
+
+    SensorArray():_count(0), _next(0) {};
+
+    bool add(MPU9250* mpu9250){
+        if (_count >= MAX_SENSORS) return false;
+        _sensors[_count++] = mpu9250;
+        return true;
+    }
+
+    // Each sensor keeps its calibration in the slot of its id
+    void attachStore(CalibrationStore* store){
+        for (uint8_t id = 0; id < _count; id++)
+            _sensors[id]->attachStore(store, id);
+    }
+
+    uint8_t count(){
+        return _count;
+    }
+
+    MPU9250* get(uint8_t id){
+        return (id < _count) ? _sensors[id] : nullptr;
+    }
+
+    // Sensors in FIFO or DMP mode are drained by their own bursts, the rest are read sample by sample in background
+    bool isAsync(uint8_t id){
+        return !_sensors[id]->_fifoMode && !_sensors[id]->_dmpReady;
+    }
+
+    bool readPending(){
+        for (uint8_t id = 0; id < _count; id++)
+            if (_sensors[id]->_readPending) return true;
+        return false;
+    }
+
+    // Takes completed background read, returns id of the sensor it belongs to or -1 if nothing is ready yet
+    int fetchData(int16_t* raw, float* sensor_data){
+        for (uint8_t id = 0; id < _count; id++)
+            if (_sensors[id]->fetchData(raw, sensor_data)) return id;
+        return -1;
+    }
+
+    // Starts background read for the next sensor with data ready. Chips share the bus, so only one
+    // transfer is in flight at a time. Ready sensors are served in round robin order, so a latched
+    // data ready interrupt waits at most count()-1 transfers, which is far below the sample period.
+    int schedule(){
+        if (readPending()) return -1;
+        for (uint8_t i = 0; i < _count; i++){
+            uint8_t id = (_next + i) % _count;
+            if (!isAsync(id)) continue;
+            if (_sensors[id]->_bus->busy()) return -1; // don't consume interrupt while bus is taken
+            if (!_sensors[id]->readInterrupt()) continue;
+            _next = (id + 1) % _count;
+            return _sensors[id]->requestData() ? id : -1;
+        }
+        return -1;
+    }
+};
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef SERIALTransport_h
+#define SERIALTransport_h
+
+#include "Arduino.h"
+#include "transport.h"
+
+// Packets back to back over a byte stream, e.g. USB CDC serial which moves bulk data many times faster than
+// Raw HID reports. Messages printed to the same port would break packet boundaries, so with USB type
+// "Dual Serial" give it the second port (SerialUSB1) and keep Serial for messages.
+// Stream has no framing of its own: a partial packet which isn't completed within RESYNC_TIMEOUT is dropped,
+// so both sides get back in step after a host reconnects in the middle of a packet.
+class SerialTransport : public Transport {
+public:
+    static const uint8_t RESYNC_TIMEOUT = 50; // ms
+
+    Stream* _port;
+    uint8_t _rx[PACKET_SIZE];
+    uint8_t _rxCount;
+    unsigned long _rxLast;  // millis() of the last received byte
+
+    SerialTransport(Stream* port):_port(port), _rxCount(0), _rxLast(0) {};
+
+    int send(const uint8_t* packet, uint16_t timeout){
+        unsigned long start = millis();
+        while (_port->availableForWrite() < PACKET_SIZE)
+            if (millis() - start >= timeout) {
+                _dropped++;
+                return 0;
+            }
+        if (_port->write(packet, PACKET_SIZE) != PACKET_SIZE) {
+            _dropped++;
+            return 0;
+        }
+        _sent++;
+        return PACKET_SIZE;
+    }
+
+    int recv(uint8_t* packet, uint16_t timeout){
+        unsigned long start = millis();
+        do {
+            if (_rxCount && (millis() - _rxLast > RESYNC_TIMEOUT)) _rxCount = 0;
+            while ((_rxCount < PACKET_SIZE) && (_port->available() > 0)) {
+                _rx[_rxCount++] = _port->read();
+                _rxLast = millis();
+            }
+            if (_rxCount == PACKET_SIZE) {
+                memcpy(packet, _rx, PACKET_SIZE);
+                _rxCount = 0;
+                return PACKET_SIZE;
+            }
+        } while (millis() - start < timeout);
+        return 0;
+    }
+};
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef SIMDLANES_h
+#define SIMDLANES_h
+
+#include <math.h>
+#include "fixed.h"
+
+// Lane types the batch filters (batchfilters.h) are written against, so one kernel body runs one stream per lane
+// on plain scalars or several on SIMD registers. A lane type has arithmetic operators, != giving a mask, & of
+// masks, laneSelect(mask, a, b) and scalarSqrt(); Lanes<V> loads and stores WIDTH consecutive scalars.
+// Vector types exist for what the compiler targets: SSE (4 floats), AVX (8 floats, -mavx or -mavx2) and NEON on
+// AArch64 (4 floats). Division and square root are exact, so lanes match the scalar filters up to rounding.
+// BatchLanes<T>::Vector is the widest one available for scalar type T, T itself on the MCU.
+template <typename V>
+struct Lanes {
+    static const uint8_t WIDTH = 1;
+    static V load(const V* p){ return *p; }
+    static void store(V* p, V v){ *p = v; }
+};
+
+template <typename T>
+inline T laneSelect(bool mask, T a, T b){
+    return mask ? a : b;
+}
+
+template <typename T>
+struct BatchLanes {
+    typedef T Vector;
+};
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+
+struct SseMask4 {
+    __m128 _v;
+    friend SseMask4 operator&(SseMask4 a, SseMask4 b){ return {_mm_and_ps(a._v, b._v)}; }
+};
+
+struct SseFloat4 {
+    __m128 _v;
+    SseFloat4(){}
+    SseFloat4(__m128 v) : _v(v) {}
+    SseFloat4(float v) : _v(_mm_set1_ps(v)) {}
+    friend SseFloat4 operator+(SseFloat4 a, SseFloat4 b){ return _mm_add_ps(a._v, b._v); }
+    friend SseFloat4 operator-(SseFloat4 a, SseFloat4 b){ return _mm_sub_ps(a._v, b._v); }
+    friend SseFloat4 operator*(SseFloat4 a, SseFloat4 b){ return _mm_mul_ps(a._v, b._v); }
+    friend SseFloat4 operator/(SseFloat4 a, SseFloat4 b){ return _mm_div_ps(a._v, b._v); }
+    SseFloat4 operator-() const { return _mm_xor_ps(_v, _mm_set1_ps(-0.0f)); }
+    SseFloat4& operator+=(SseFloat4 o){ return *this = *this + o; }
+    SseFloat4& operator-=(SseFloat4 o){ return *this = *this - o; }
+    SseFloat4& operator*=(SseFloat4 o){ return *this = *this * o; }
+    friend SseMask4 operator!=(SseFloat4 a, SseFloat4 b){ return {_mm_cmpneq_ps(a._v, b._v)}; }
+};
+
+inline SseFloat4 laneSelect(SseMask4 mask, SseFloat4 a, SseFloat4 b){
+    return _mm_or_ps(_mm_and_ps(mask._v, a._v), _mm_andnot_ps(mask._v, b._v));
+}
+
+inline SseFloat4 scalarSqrt(SseFloat4 v){
+    return _mm_sqrt_ps(v._v);
+}
+
+template <>
+struct Lanes<SseFloat4> {
+    static const uint8_t WIDTH = 4;
+    static SseFloat4 load(const float* p){ return _mm_loadu_ps(p); }
+    static void store(float* p, SseFloat4 v){ _mm_storeu_ps(p, v._v); }
+};
+#endif
+
+#if defined(__AVX__)
+struct AvxMask8 {
+    __m256 _v;
+    friend AvxMask8 operator&(AvxMask8 a, AvxMask8 b){ return {_mm256_and_ps(a._v, b._v)}; }
+};
+
+struct AvxFloat8 {
+    __m256 _v;
+    AvxFloat8(){}
+    AvxFloat8(__m256 v) : _v(v) {}
+    AvxFloat8(float v) : _v(_mm256_set1_ps(v)) {}
+    friend AvxFloat8 operator+(AvxFloat8 a, AvxFloat8 b){ return _mm256_add_ps(a._v, b._v); }
+    friend AvxFloat8 operator-(AvxFloat8 a, AvxFloat8 b){ return _mm256_sub_ps(a._v, b._v); }
+    friend AvxFloat8 operator*(AvxFloat8 a, AvxFloat8 b){ return _mm256_mul_ps(a._v, b._v); }
+    friend AvxFloat8 operator/(AvxFloat8 a, AvxFloat8 b){ return _mm256_div_ps(a._v, b._v); }
+    AvxFloat8 operator-() const { return _mm256_xor_ps(_v, _mm256_set1_ps(-0.0f)); }
+    AvxFloat8& operator+=(AvxFloat8 o){ return *this = *this + o; }
+    AvxFloat8& operator-=(AvxFloat8 o){ return *this = *this - o; }
+    AvxFloat8& operator*=(AvxFloat8 o){ return *this = *this * o; }
+    friend AvxMask8 operator!=(AvxFloat8 a, AvxFloat8 b){ return {_mm256_cmp_ps(a._v, b._v, _CMP_NEQ_UQ)}; }
+};
+
+inline AvxFloat8 laneSelect(AvxMask8 mask, AvxFloat8 a, AvxFloat8 b){
+    return _mm256_blendv_ps(b._v, a._v, mask._v);
+}
+
+inline AvxFloat8 scalarSqrt(AvxFloat8 v){
+    return _mm256_sqrt_ps(v._v);
+}
+
+template <>
+struct Lanes<AvxFloat8> {
+    static const uint8_t WIDTH = 8;
+    static AvxFloat8 load(const float* p){ return _mm256_loadu_ps(p); }
+    static void store(float* p, AvxFloat8 v){ _mm256_storeu_ps(p, v._v); }
+};
+
+template <>
+struct BatchLanes<float> {
+    typedef AvxFloat8 Vector;
+};
+#elif defined(__SSE2__)
+template <>
+struct BatchLanes<float> {
+    typedef SseFloat4 Vector;
+};
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+
+struct NeonMask4 {
+    uint32x4_t _v;
+    friend NeonMask4 operator&(NeonMask4 a, NeonMask4 b){ return {vandq_u32(a._v, b._v)}; }
+};
+
+struct NeonFloat4 {
+    float32x4_t _v;
+    NeonFloat4(){}
+    NeonFloat4(float32x4_t v) : _v(v) {}
+    NeonFloat4(float v) : _v(vdupq_n_f32(v)) {}
+    friend NeonFloat4 operator+(NeonFloat4 a, NeonFloat4 b){ return vaddq_f32(a._v, b._v); }
+    friend NeonFloat4 operator-(NeonFloat4 a, NeonFloat4 b){ return vsubq_f32(a._v, b._v); }
+    friend NeonFloat4 operator*(NeonFloat4 a, NeonFloat4 b){ return vmulq_f32(a._v, b._v); }
+    friend NeonFloat4 operator/(NeonFloat4 a, NeonFloat4 b){ return vdivq_f32(a._v, b._v); }
+    NeonFloat4 operator-() const { return vnegq_f32(_v); }
+    NeonFloat4& operator+=(NeonFloat4 o){ return *this = *this + o; }
+    NeonFloat4& operator-=(NeonFloat4 o){ return *this = *this - o; }
+    NeonFloat4& operator*=(NeonFloat4 o){ return *this = *this * o; }
+    friend NeonMask4 operator!=(NeonFloat4 a, NeonFloat4 b){ return {vmvnq_u32(vceqq_f32(a._v, b._v))}; }
+};
+
+inline NeonFloat4 laneSelect(NeonMask4 mask, NeonFloat4 a, NeonFloat4 b){
+    return vbslq_f32(mask._v, a._v, b._v);
+}
+
+inline NeonFloat4 scalarSqrt(NeonFloat4 v){
+    return vsqrtq_f32(v._v);
+}
+
+template <>
+struct Lanes<NeonFloat4> {
+    static const uint8_t WIDTH = 4;
+    static NeonFloat4 load(const float* p){ return vld1q_f32(p); }
+    static void store(float* p, NeonFloat4 v){ vst1q_f32(p, v._v); }
+};
+
+template <>
+struct BatchLanes<float> {
+    typedef NeonFloat4 Vector;
+};
+#endif
+
+#endif
@@ -5,7 +5,7 @@
 #include "SPI.h"  // I2C library
 #include "bus.h"
 
-class SPIBus : public Bus {
+class SPIBus final : public Bus {
 public:
     static const uint8_t SPI_CS_PIN = 15;
     static const uint8_t SPI_CLCK_PIN = 13;
@@ -20,12 +20,21 @@ public:
     uint8_t _clckPin;
     uint8_t _dinPin;
     uint8_t _doutPin;
+    EventResponder _event;
+    BusCallback _callback;
+    void* _context;
 
     SPIBus() : SPIBus(SPI_CS_PIN, SPI_CLCK_PIN, SPI_DIN_PIN, SPI_DOUT_PIN) {
     };
 
+    // Another chip on the same SPI port, only chip select differs
+    SPIBus(uint8_t csPin) : SPIBus(csPin, SPI_CLCK_PIN, SPI_DIN_PIN, SPI_DOUT_PIN) {
+    };
+
     SPIBus(uint8_t csPin, uint8_t clckPin, uint8_t dinPin, uint8_t doutPin) : _spi(&SPI), 
-        _csPin(csPin), _clckPin(clckPin), _dinPin(dinPin), _doutPin(doutPin) {
+        _csPin(csPin), _clckPin(clckPin), _dinPin(dinPin), _doutPin(doutPin), _callback(nullptr), _context(nullptr) {
+        _event.setContext(this);
+        _event.attachImmediate(&SPIBus::onTransferDone);
         pinMode(_csPin, INPUT);
         digitalWrite(_csPin, LOW);
         pinMode(_clckPin, INPUT);
@@ -64,6 +73,7 @@ public:
 
     bool writeByte(uint8_t address, uint8_t subAddress, uint8_t data)
     {
+        while (portBusy()); // wait for DMA read to complete
         _spi->beginTransaction(SPISettings(SPI_LS_CLOCK, MSBFIRST, SPI_MODE3)); // begin the transaction
         digitalWriteFast(_csPin,LOW); // select the MPU9250 chip
         _spi->transfer(subAddress); // write the register address
@@ -73,18 +83,25 @@ public:
         return true;
     }
 
-    void readBytes(uint8_t address, uint8_t subAddress, uint8_t count, uint8_t* dest, bool fast = false){
-        _spi->beginTransaction(SPISettings(fast ? SPI_HS_CLOCK : SPI_LS_CLOCK, MSBFIRST, SPI_MODE3));   
+    bool writeBytes(uint8_t address, uint8_t subAddress, uint8_t count, const uint8_t* data)
+    {
+        while (portBusy()); // wait for DMA read to complete
+        _spi->beginTransaction(SPISettings(SPI_LS_CLOCK, MSBFIRST, SPI_MODE3));
         digitalWriteFast(_csPin,LOW); // select the MPU9250 chip
-
-        _spi->transfer(subAddress | SPI_READ); // specify the starting register address
-
+        _spi->transfer(subAddress); // starting register address, chip increments it for every byte
+        for(uint8_t i = 0; i < count; i++){
+            _spi->transfer(data[i]);
+        }
         digitalWriteFast(_csPin,HIGH); // deselect the MPU9250 chip
-        delayMicroseconds(1);
-        digitalWriteFast(_csPin,LOW); // select the MPU9250 chip
-
-        _spi->transfer(subAddress | SPI_READ); // specify the starting register address
+        _spi->endTransaction();
+        return true;
+    }
 
+    void readBytes(uint8_t address, uint8_t subAddress, uint8_t count, uint8_t* dest, bool fast = false){
+        while (portBusy()); // wait for DMA read to complete
+        _spi->beginTransaction(SPISettings(fast ? SPI_HS_CLOCK : SPI_LS_CLOCK, MSBFIRST, SPI_MODE3));   
+        digitalWriteFast(_csPin,LOW); // select the MPU9250 chip
+        _spi->transfer(subAddress | SPI_READ); // specify the starting register address, data follows in the same frame
         for(uint8_t i = 0; i < count; i++){
             dest[i] = _spi->transfer(0x00); // read the data
         }
@@ -92,6 +109,40 @@ public:
         digitalWriteFast(_csPin,HIGH); // deselect the MPU9250 chip
         _spi->endTransaction(); // end the transaction
     };
+
+    // Only register address goes out synchronously, data bytes are clocked in by DMA straight into dest.
+    // Async reads are always high speed, so they must be used for sensor data registers only.
+    bool readBytesAsync(uint8_t address, uint8_t subAddress, uint8_t count, uint8_t* dest, BusCallback callback, void* context = nullptr){
+        if (portBusy()) return false;
+        portBusy() = true;
+        _callback = callback;
+        _context = context;
+        _spi->beginTransaction(SPISettings(SPI_HS_CLOCK, MSBFIRST, SPI_MODE3));
+        digitalWriteFast(_csPin,LOW); // select the MPU9250 chip
+        _spi->transfer(subAddress | SPI_READ); // specify the starting register address
+        _spi->transfer(nullptr, dest, count, _event); // tx of nullptr sends zeros
+        return true;
+    }
+
+    bool busy(){
+        return portBusy();
+    }
+
+    // All SPIBus instances drive the same SPI port, so DMA state is shared: a read for one chip
+    // must not start while another chip's transfer is in flight
+    static volatile bool& portBusy(){
+        static volatile bool busy = false;
+        return busy;
+    }
+
+    // Called from DMA interrupt
+    static void onTransferDone(EventResponderRef event){
+        SPIBus* bus = (SPIBus*) event.getContext();
+        digitalWriteFast(bus->_csPin,HIGH); // deselect the MPU9250 chip
+        bus->_spi->endTransaction();
+        portBusy() = false;
+        if (bus->_callback) bus->_callback(bus->_context);
+    }
 };
 
 #endif
\ No newline at end of file
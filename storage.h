@@ -0,0 +1,17 @@
+#ifndef STORAGE_h
+#define STORAGE_h
+
+#include <stdint.h>
+
+// Byte addressed non-volatile memory. Erased bytes read as 0xFF, like EEPROM.
+class Storage {
+public:
+    virtual uint16_t size() = 0;
+
+    virtual void read(uint16_t address, uint8_t* dest, uint16_t count) = 0;
+
+    // Returns false if data doesn't fit or couldn't be written
+    virtual bool write(uint16_t address, const uint8_t* data, uint16_t count) = 0;
+};
+
+#endif
@@ -1,8 +1,16 @@
 #include "MPU9250.h"
 #include "i2cbus.h"
 #include "spibus.h"
+#include "sensorarray.h"
+#include "eepromstorage.h"
+#include "calibstore.h"
+#include "blackbox.h"
+#include "rawhidtransport.h"
+//#include "serialtransport.h"
+#include "txqueue.h"
+#include "framing.h"
 #include "commands.h"
-#include <memory>
+#include "commandpool.h"
 
 #define PIN_INTERRUPT 22
 #define ENABLE_INTERRUPTS 0
@@ -11,12 +19,37 @@
 SPIBus spibus;
 //I2CBus i2cbus;
 MPU9250 mpu9250(&spibus);
-byte buffer[64];
-std::shared_ptr<BaseCommand> pCommand;
+// More chips share SPI port with their own chip select pins, e.g.:
+//SPIBus spibus2(PIN_CS2);
+//MPU9250 mpu9250_2(&spibus2);
+SensorArray sensors;
+EEPROMStorage eeprom;
+CalibrationStore calibrationStore(&eeprom);
+// Last 1.6 s of full rate samples for shock captures, half of Teensy 3.2 RAM
+StaticBlackBox<1600> blackBox;
+RawHIDTransport rawhid;
+Transport& transport = rawhid;
+// Bulk stream over USB serial instead, USB type "Dual Serial" keeps Serial for messages:
+//SerialTransport serial(&SerialUSB1);
+//Transport& transport = serial;
+// Responses and stream packets are queued, so the loop never waits for the host
+TxQueue<16> txQueue(&transport, TxQueue<16>::DROP_OLDEST);
+byte buffer[Transport::PACKET_SIZE];
+FragmentReceiver<256> requests;  // requests longer than a packet
+// Streaming, a register read and one more command can be active at once
+CommandPool<3, commandSize<StartSensorsCommand, GenericStopCommand, CalibrateMagnetometerCommand,
+    ReadRegistersCommand, SetupCommand, TimingStatsCommand, StatsCommand, LinkStatsCommand, BlackBoxCommand,
+    CalibrationCommand>()> commands(&txQueue);
 
 void setup() {
     Serial.begin(115200);
+    enableCycleCounter();   // sample timestamps
+    sensors.add(&mpu9250);
+    //sensors.add(&mpu9250_2);
+    sensors.attachStore(&calibrationStore);   // warm start: stored offsets replace calibration in setup()
+    mpu9250._blackBox = &blackBox;
     mpu9250.switchInterrupts(ENABLE_INTERRUPTS);
+    // mpu9250.setDmpImage(dmp_image, sizeof(dmp_image)); // InvenSense DMP firmware is required for DMP algorythm
     if (ENABLE_INTERRUPTS) {
         pinMode(PIN_INTERRUPT, INPUT);
         attachInterrupt(PIN_INTERRUPT, isrService, RISING);
@@ -29,25 +62,40 @@ void isrService()
 }
 
 void loop() {
-    int n = RawHID.recv(buffer, 0); // 0 timeout = do not wait
+    PROFILE_SCOPE(STAGE_LOOP);
+    int n;
+    {
+        PROFILE_SCOPE(STAGE_RECEIVE);
+        n = transport.recv(buffer, 0); // 0 timeout = do not wait
+    }
+    byte* request = buffer;
+    if ((n > 0) && (buffer[0] == FRAGMENT_ACK)) {
+        commands.ack(buffer);   // host got fragments of a response
+        n = 0;
+    }
+    if ((n > 0) && (buffer[0] & FRAGMENT_FLAG)) {
+        request = requests._message;
+        if (!requests.add(buffer, &txQueue)) n = 0;  // wait for the rest of the message
+    }
     if (n > 0) {
-        USBCommand cmd_code = BaseCommand::getCommandCode(buffer);
+        USBCommand cmd_code = BaseCommand::getCommandCode(request);
         switch (cmd_code){
-            case CMD_START_SENSORS  : pCommand.reset(new StartSensorsCommand    (&mpu9250, buffer)); break;
-            case CMD_STOP           : pCommand.reset(new GenericStopCommand     (&mpu9250, buffer)); break;
-            case CMD_MAG_CALIB      : pCommand.reset(new CalibrateMagnetometerCommand(&mpu9250, buffer)); break;
-            case CMD_READ_REGS      : pCommand.reset(new ReadRegistersCommand   (&mpu9250, buffer)); break;
-            case CMD_SETUP          : pCommand.reset(new SetupCommand           (&mpu9250, buffer)); break;
+            case CMD_START_SENSORS  : commands.start<StartSensorsCommand    >(&sensors, request); break;
+            case CMD_STOP           : commands.start<GenericStopCommand     >(&sensors, request); break;
+            case CMD_MAG_CALIB      : commands.start<CalibrateMagnetometerCommand>(&sensors, request); break;
+            case CMD_READ_REGS      : commands.start<ReadRegistersCommand   >(&sensors, request); break;
+            case CMD_SETUP          : commands.start<SetupCommand           >(&sensors, request); break;
+            case CMD_TIMING         : commands.start<TimingStatsCommand     >(&sensors, request); break;
+            case CMD_STATS          : commands.start<StatsCommand           >(&sensors, request); break;
+            case CMD_LINK_STATS     : commands.start<LinkStatsCommand       >(&sensors, request); break;
+            case CMD_BLACKBOX       : commands.start<BlackBoxCommand        >(&sensors, request); break;
+            case CMD_CALIBRATION    : commands.start<CalibrationCommand     >(&sensors, request); break;
             default: 
                 Serial.print(F("Unknown command received: "));
                 Serial.println(cmd_code);
         }
-        pCommand.get()->setup();
     }
 
-    if (pCommand){
-        bool continue_exec = pCommand.get()->exec();
-        if (!continue_exec) pCommand.reset();
-    }
+    commands.exec();
+    txQueue.flush();
 }
-
@@ -0,0 +1,169 @@
+#ifndef TIMING_h
+#define TIMING_h
+
+#include "Arduino.h"
+
+// Free running tick counter for sample timestamps. On Teensy 3.x it is the DWT cycle counter (F_CPU ticks per
+// second, wraps after ~45 s at 96 MHz, so only differences are meaningful). Off-target it is CLOCK_MONOTONIC in ns.
+#if defined(ARM_DWT_CYCCNT)
+static const uint32_t TICKS_PER_SECOND = F_CPU;
+
+inline void enableCycleCounter(){
+    ARM_DEMCR |= ARM_DEMCR_TRCENA;
+    ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+}
+
+inline uint32_t cycleCount(){
+    return ARM_DWT_CYCCNT;
+}
+#else
+#include <time.h>
+static const uint32_t TICKS_PER_SECOND = 1000000000UL;
+
+inline void enableCycleCounter(){
+}
+
+inline uint32_t cycleCount(){
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint32_t)(t.tv_sec * 1000000000ULL + t.tv_nsec);
+}
+#endif
+
+inline uint32_t ticksToMicros(uint32_t ticks){
+    return (uint32_t)((uint64_t)ticks * 1000000UL / TICKS_PER_SECOND);
+}
+
+// Single producer (ISR), single consumer (loop) ring of timestamps. Each side only writes its own index,
+// so no interrupts have to be disabled. SIZE must be a power of two, one slot is kept free.
+template <uint8_t SIZE>
+class TimestampRing {
+public:
+    static_assert((SIZE & (SIZE - 1)) == 0, "ring size must be a power of two");
+
+    volatile uint32_t _stamps[SIZE];
+    volatile uint8_t _head;         // written by producer only
+    volatile uint8_t _tail;         // written by consumer only
+    volatile uint32_t _overflows;   // stamps dropped because consumer fell behind
+
+    TimestampRing():_head(0), _tail(0), _overflows(0) {};
+
+    void push(uint32_t stamp){
+        uint8_t head = _head;
+        uint8_t next = (head + 1) & (SIZE - 1);
+        if (next == _tail) {
+            _overflows++;
+            return;
+        }
+        _stamps[head] = stamp;
+        _head = next;
+    }
+
+    bool pop(uint32_t& stamp){
+        uint8_t tail = _tail;
+        if (tail == _head) return false;
+        stamp = _stamps[tail];
+        _tail = (tail + 1) & (SIZE - 1);
+        return true;
+    }
+};
+
+// Sample interval statistics in us: lifetime count, min, max and mean, percentiles over the last WINDOW intervals.
+// Percentiles are only sorted out when queried, adding an interval is a few stores.
+class JitterStats {
+public:
+    static const uint8_t WINDOW = 128;
+
+    uint32_t _count;
+    uint32_t _missed;   // data ready events which were overwritten by the next one before being read
+    uint32_t _min;
+    uint32_t _max;
+    uint64_t _sum;
+    uint32_t _window[WINDOW];
+    uint8_t _pos;
+
+    JitterStats(){
+        reset();
+    }
+
+    void reset(){
+        _count = 0;
+        _missed = 0;
+        _min = 0xFFFFFFFF;
+        _max = 0;
+        _sum = 0;
+        _pos = 0;
+    }
+
+    void add(uint32_t dt_us){
+        _count++;
+        _sum += dt_us;
+        if (dt_us < _min) _min = dt_us;
+        if (dt_us > _max) _max = dt_us;
+        _window[_pos] = dt_us;
+        _pos = (_pos + 1) % WINDOW;
+    }
+
+    uint32_t mean() const {
+        return _count ? (uint32_t)(_sum / _count) : 0;
+    }
+
+    // percent in 0..100, 0 if nothing was collected yet
+    uint32_t percentile(uint8_t percent) const {
+        uint8_t n = (_count < WINDOW) ? _count : WINDOW;
+        if (n == 0) return 0;
+        uint32_t sorted[WINDOW];
+        for (uint8_t i = 0; i < n; i++){
+            uint32_t v = _window[i];
+            uint8_t j = i;
+            for (; (j > 0) && (sorted[j - 1] > v); j--) sorted[j] = sorted[j - 1];
+            sorted[j] = v;
+        }
+        return sorted[(uint16_t)(n - 1) * percent / 100];
+    }
+};
+
+// Turns sample timestamps into filter dt, so time spent in the loop before a sample is processed doesn't count.
+// Also keeps the time of the last sample since start() for the output streams, which outlasts tick counter wraps.
+class SampleClock {
+public:
+    uint32_t _prev;
+    uint64_t _elapsed;  // ticks from start() to _prev
+    bool _first;
+    JitterStats _jitter;
+
+    SampleClock(){
+        start();
+    }
+
+    // First interval is measured from here and left out of statistics
+    void start(){
+        _prev = cycleCount();
+        _elapsed = 0;
+        _first = true;
+        _jitter.reset();
+    }
+
+    // Next interval is measured from stamp, e.g. after samples were dropped. The gap still counts as elapsed time.
+    void resync(uint32_t stamp){
+        _elapsed += (uint32_t)(stamp - _prev);
+        _prev = stamp;
+    }
+
+    // Seconds since the previous sample
+    float update(uint32_t stamp){
+        uint32_t ticks = stamp - _prev;
+        _prev = stamp;
+        _elapsed += ticks;
+        if (_first) _first = false;
+        else _jitter.add(ticksToMicros(ticks));
+        return (float) ticks / TICKS_PER_SECOND;
+    }
+
+    // us from start() to the last sample, wraps after ~71 minutes
+    uint32_t timeMicros() const {
+        return (uint32_t)(_elapsed * 1000000UL / TICKS_PER_SECOND);
+    }
+};
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef TRANSPORT_h
+#define TRANSPORT_h
+
+#include <stdint.h>
+
+// Packet link to the host under the command layer. Packets are PACKET_SIZE bytes, header (cmd, data_len,
+// final_packet) and payload, on every link, so commands and host side decoding don't depend on what carries them.
+class Transport {
+public:
+    static const uint8_t PACKET_SIZE = 64;
+
+    uint32_t _sent = 0;     // packets handed over to the host side
+    uint32_t _dropped = 0;  // packets given up on, link busy or queue full
+
+    // Returns PACKET_SIZE once packet is taken, 0 if it couldn't be within timeout ms
+    virtual int send(const uint8_t* packet, uint16_t timeout) = 0;
+
+    // Returns PACKET_SIZE if a whole packet was received into packet, 0 if none came within timeout ms
+    virtual int recv(uint8_t* packet, uint16_t timeout) = 0;
+
+    // Moves queued packets on as far as the link takes them without waiting, call from loop()
+    virtual void flush(){};
+
+    virtual uint8_t queued(){
+        return 0;
+    }
+
+    virtual uint8_t capacity(){
+        return 0;
+    }
+
+    // Most packets queued at once since resetCounters()
+    virtual uint8_t highWater(){
+        return 0;
+    }
+
+    virtual void resetCounters(){
+        _sent = 0;
+        _dropped = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef TXQUEUE_h
+#define TXQUEUE_h
+
+#include <string.h>
+#include "transport.h"
+
+// Transmit queue in front of a link: send() copies the finished packet into a ring and returns at once, packets
+// go out from flush() (and every send()) only as fast as the link takes them without waiting. A slow or absent
+// host costs dropped packets instead of blocking the loop, so sample timing and filter dt stay intact.
+// When the ring is full DROP_OLDEST makes room for the new packet (live data stays current), DROP_NEWEST keeps
+// what is queued (command responses aren't cut in the middle). Only the main loop uses it, no ISR access.
+template <uint8_t SLOTS = 16>
+class TxQueue : public Transport {
+public:
+    static_assert((SLOTS & (SLOTS - 1)) == 0, "queue size must be a power of two");
+
+    enum DropPolicy
+    {
+        DROP_OLDEST,
+        DROP_NEWEST
+    };
+
+    Transport* _link;
+    DropPolicy _policy;
+    uint8_t _packets[SLOTS][PACKET_SIZE];
+    uint8_t _head;
+    uint8_t _tail;
+    uint8_t _highWater;
+
+    TxQueue(Transport* link, DropPolicy policy = DROP_OLDEST)
+        :_link(link), _policy(policy), _head(0), _tail(0), _highWater(0) {};
+
+    int send(const uint8_t* packet, uint16_t){
+        flush();
+        if (queued() == SLOTS - 1) {
+            _dropped++;
+            if (_policy == DROP_NEWEST) return 0;
+            _tail = (_tail + 1) & (SLOTS - 1);
+        }
+        memcpy(_packets[_head], packet, PACKET_SIZE);
+        _head = (_head + 1) & (SLOTS - 1);
+        if (queued() > _highWater) _highWater = queued();
+        return PACKET_SIZE;
+    }
+
+    int recv(uint8_t* packet, uint16_t timeout){
+        return _link->recv(packet, timeout);
+    }
+
+    void flush(){
+        while (_tail != _head) {
+            if (_link->send(_packets[_tail], 0) <= 0) return;
+            _tail = (_tail + 1) & (SLOTS - 1);
+            _sent++;
+        }
+    }
+
+    uint8_t queued(){
+        return (_head - _tail) & (SLOTS - 1);
+    }
+
+    uint8_t capacity(){
+        return SLOTS - 1;
+    }
+
+    uint8_t highWater(){
+        return _highWater;
+    }
+
+    void resetCounters(){
+        Transport::resetCounters();
+        _highWater = queued();
+    }
+};
+
+#endif
@@ -1,6 +1,8 @@
 #ifndef UTILS_h
 #define UTILS_h
 
+#include "Arduino.h"
+
 class TimeCounter{
 public:
     unsigned long _prev;
@@ -30,4 +32,14 @@ void setNthBit(byte* dist, byte n, bool value){
         *dist &= ~mask; 
 }
 
+// CRC-16/CCITT (polynomial 0x1021), pass previous result as crc to continue over several blocks
+inline uint16_t crc16(const uint8_t* data, uint16_t len, uint16_t crc = 0xFFFF){
+    for (uint16_t i = 0; i < len; i++){
+        crc ^= (uint16_t)data[i] << 8;
+        for (uint8_t bit = 0; bit < 8; bit++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+    return crc;
+}
+
 #endif
\ No newline at end of file
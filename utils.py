@@ -1,6 +1,8 @@
 import pywinusb.hid as hid
 from struct import pack, unpack
 from timeit import default_timer as timer
+import threading
+import Queue
 import math 
 import numpy as np
 from pylab import pi, array, mat, deg2rad
@@ -32,10 +34,91 @@ class Quaternion(object):
     def fromCoeffs(self, tupleCoeffs):
         self.q = array(tupleCoeffs)
 
+# Multi packet messages, same framing as firmware framing.h
+FRAGMENT_FLAG = 0x80
+FRAGMENT_ACK = 0x7F
+FRAGMENT_HEADER = 5
+FRAGMENT_DATA = 56
+FRAGMENT_WINDOW = 8
+ACK_PROGRESS, ACK_DONE, ACK_RESEND, ACK_TOO_LONG = range(4)
+COMMAND_COUNT = 10      # USBCommand codes of commands.h
+
+def crc16(data, crc = 0xFFFF):
+    """CRC-16/CCITT of a list of bytes, same as crc16() in utils.h"""
+    for byte in data:
+        crc ^= byte << 8
+        for bit in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+        crc &= 0xFFFF
+    return crc
+
+def fragmentMessage(transfer, data):
+    """Fragment payloads of a message: uint8 transfer, uint16 index, uint16 count, data followed by its CRC"""
+    crc = crc16(data)
+    stream = list(data) + [crc & 0xFF, crc >> 8]
+    count = (len(stream) + FRAGMENT_DATA - 1) // FRAGMENT_DATA
+    return [[transfer] + list(bytearray(pack('<2H', index, count))) +
+        stream[index * FRAGMENT_DATA:(index + 1) * FRAGMENT_DATA] for index in range(count)]
+
+class FragmentReassembler(object):
+    """Collects fragments of one command's responses and acknowledges them like FragmentReceiver in framing.h:
+    every FRAGMENT_WINDOW fragments, a gap or CRC mismatch asks to resend from the fragment missing, a complete
+    message is acknowledged done. ack(transfer, next, status) sends the acknowledgement, errors counts the resends"""
+    def __init__(self, ack = None):
+        self.ack = ack or (lambda transfer, next, status: None)
+        self.transfer = None
+        self.done = None    # transfer completed last, device repeats it when the acknowledgement got lost
+        self.next = 0
+        self.stream = []
+        self.gap = False
+        self.gapIndex = 0
+        self.errors = 0
+
+    def feed(self, data):
+        """Takes fragment payload, returns the message once complete"""
+        transfer = data[0]
+        index, count = unpack('<2H', str(bytearray(data[1:FRAGMENT_HEADER])))
+        if (transfer == self.done) and (self.transfer is None):
+            self.ack(transfer, count, ACK_DONE)
+            return None
+        if index == 0:
+            self.transfer = transfer
+            self.done = None
+            self.next = 0
+            self.stream = []
+        elif (transfer != self.transfer) or (index != self.next):
+            # rest of the window after a gap is dropped, resend is asked for once per window
+            if (transfer == self.transfer) and (not self.gap or index <= self.gapIndex):
+                self.errors += 1
+                self.ack(transfer, self.next, ACK_RESEND)
+            self.gap = True
+            self.gapIndex = index
+            return None
+        self.gap = False
+        self.stream += data[FRAGMENT_HEADER:]
+        self.next += 1
+        if self.next < count:
+            if self.next % FRAGMENT_WINDOW == 0:
+                self.ack(transfer, self.next, ACK_PROGRESS)
+            return None
+        message, crc = self.stream[:-2], self.stream[-2:]
+        if len(crc) < 2 or crc16(message) != crc[0] | (crc[1] << 8):
+            self.errors += 1
+            self.next = 0
+            self.ack(transfer, 0, ACK_RESEND)
+            return None
+        self.transfer = None
+        self.done = transfer
+        self.ack(transfer, count, ACK_DONE)
+        return message
+
 class RawHIDDevice(object):
     def __init__(self, deviceDescriptor):
         self.device = deviceDescriptor
         self.async = {}
+        self.fragments = {}
+        self.acks = Queue.Queue()
+        self.transfer = 0
 
     @staticmethod
     def tryOpen(vendor_id = 0x16C0, product_id = 0x486, usage_page = 0xFFAB, usage_id = 0x0200):
@@ -79,12 +162,46 @@ class RawHIDDevice(object):
 
     def call(self, cmd_id, cmd_data, callback, args=[], kwargs={}):       
         data_len = len(cmd_data)
-        if len(cmd_data)>62:
-            raise Exception('Too much data during command (%s) call. Max len is 64, %s given'.format(cmd_id, data_len))
         self.async[cmd_id] = [callback, args, kwargs]
+        if data_len > 62:
+            self.sendMessage(cmd_id, cmd_data)
+            return
         data_buffer = [cmd_id, data_len] + cmd_data
         self.sendRawData(data_buffer)
 
+    def sendAck(self, cmd_id, transfer, next, status):
+        """Acknowledges fragments of a response, the device sends its window again without it"""
+        self.sendRawData([FRAGMENT_ACK, 5, cmd_id, transfer, next & 0xFF, next >> 8, status])
+
+    def sendMessage(self, cmd_id, data, timeout = 0.5, retries = 3):
+        """Sends command data longer than one packet as fragments. Every FRAGMENT_WINDOW fragments wait for
+        the device to acknowledge, it asks to resend from the first missing one after a gap or CRC mismatch"""
+        self.transfer = (self.transfer + 1) & 0xFF
+        fragments = fragmentMessage(self.transfer, data)
+        while not self.acks.empty():
+            self.acks.get_nowait()
+        index = 0
+        attempts = 0
+        while True:
+            end = min((index // FRAGMENT_WINDOW + 1) * FRAGMENT_WINDOW, len(fragments))
+            for i in range(index, end):
+                self.sendRawData([cmd_id | FRAGMENT_FLAG, len(fragments[i])] + fragments[i])
+            try:
+                ack_cmd, ack_transfer, next, status = self.acks.get(timeout = timeout)
+            except Queue.Empty:
+                attempts += 1
+                if attempts > retries:
+                    raise Exception('No acknowledgement of command (%s) data, fragment %s'%(cmd_id, index))
+                continue    # window again, device answers with the index it waits for
+            if (ack_cmd != cmd_id) or (ack_transfer != self.transfer):
+                continue
+            if status == ACK_DONE:
+                return
+            if status == ACK_TOO_LONG:
+                raise Exception('Command (%s) data is too long for device, %s given'%(cmd_id, len(data)))
+            attempts = 0
+            index = next
+
     def releaseCallback(self, cmd_id):
         self.async.pop(cmd_id, None)
 
@@ -94,6 +211,18 @@ class RawHIDDevice(object):
         data_len = cmd_resp_data[2]
         final_packet = cmd_resp_data[3]
         data = cmd_resp_data[4:data_len+4]
+        if cmd_id == FRAGMENT_ACK:
+            hid.acks.put((data[0], data[1], data[2] | (data[3] << 8), data[4]))
+            return
+        if cmd_id & FRAGMENT_FLAG:
+            cmd_id &= ~FRAGMENT_FLAG
+            reassembler = hid.fragments.get(cmd_id)
+            if reassembler is None:
+                reassembler = hid.fragments[cmd_id] = FragmentReassembler(
+                    lambda transfer, next, status: hid.sendAck(cmd_id, transfer, next, status))
+            data = reassembler.feed(data)
+            if data is None:
+                return
         callback_config = hid.async.get(cmd_id)
         if callback_config is None:
             print 'Unknown command response. cmd_id = %s'%cmd_id
@@ -108,6 +237,239 @@ class RawHIDDevice(object):
     def close(self):
         self.device.close()    
 
+class SerialDevice(RawHIDDevice):
+    """Same 64 byte packets as RawHIDDevice, back to back over USB serial (SerialTransport in firmware)"""
+    def __init__(self, port):
+        RawHIDDevice.__init__(self, None)
+        self.port = port
+        self.buffer = bytearray()
+        self.resyncs = 0
+        self.running = True
+        self.reader = threading.Thread(target = self.readPackets)
+        self.reader.daemon = True
+        self.reader.start()
+
+    @staticmethod
+    def tryOpen(port_name, timeout = 0.1):
+        import serial
+        try:
+            return SerialDevice(serial.Serial(port_name, timeout = timeout))
+        except serial.SerialException:
+            return None
+
+    @staticmethod
+    def plausible(packet):
+        """Header of a packet the firmware sends: known command, fragment of one or acknowledgement, data length
+        that fits and zero padding after the data"""
+        cmd, data_len, final = packet[0], packet[1], packet[2]
+        if (cmd != FRAGMENT_ACK) and ((cmd & ~FRAGMENT_FLAG) >= COMMAND_COUNT):
+            return False
+        if (data_len > 61) or (final > 1):
+            return False
+        return not any(packet[3 + data_len:])
+
+    def readPackets(self):
+        """Reads whatever arrived and keeps partial packets. Bytes that don't start a plausible packet, like the
+        tail of one sent before the port was opened, are skipped one at a time until packets line up again. Until
+        then the packet following has to be plausible as well, or the line goes idle, which ends on a packet boundary.
+        Fragments are checked by the message CRC on top"""
+        synced = False
+        while self.running:
+            data = bytearray(self.port.read(64))
+            self.buffer += data
+            if not (data or synced) and self.buffer:
+                self.resyncs += len(self.buffer) % 64
+                del self.buffer[:len(self.buffer) % 64]
+                synced = True
+            while len(self.buffer) >= (64 if synced else 128):
+                if not (SerialDevice.plausible(self.buffer[:64]) and
+                        (synced or SerialDevice.plausible(self.buffer[64:128]))):
+                    del self.buffer[0]
+                    self.resyncs += 1
+                    synced = False
+                    continue
+                synced = True
+                packet = list(self.buffer[:64])
+                del self.buffer[:64]
+                RawHIDDevice.asyncDataHandler(self, [0] + packet)
+
+    def sendRawData(self, buffer64):
+        buf_len = len(buffer64)
+        if buf_len > 64:
+            raise Exception('Can\'t send raw data: buffer64 has length greater then 64, (len = %s)'%buf_len)
+        self.port.write(bytearray(buffer64 + [0] * (64 - buf_len)))
+
+    def close(self):
+        self.running = False
+        self.reader.join()
+        self.port.close()
+
+
+class PackedStreamDecoder(object):
+    """Decodes StartSensorsCommand packed stream (stream format 1) into samples
+    [ax, ay, az, gx, gy, gz, hx, hy, hz, dt, t] using the same scaling as firmware.
+    Every sensor of the array sends its own header and tags data packets with its id. Samples carry the low 16 bits
+    of their time in microseconds since the stream started, which wraps every 65 ms. The sequence number of the tag
+    tells how many samples lost packets carried, so the wraps over a gap follow from the sample interval. t is in
+    seconds from stream start and dt from the previous received sample of the sensor, so lost samples show as gaps"""
+    HEADER_LEN = 1 + 14 * 4
+    SAMPLE_SIZE = 9 * 2 + 2
+    SAMPLES_PER_PACKET = 3
+    DATA_LEN = 1 + SAMPLES_PER_PACKET * SAMPLE_SIZE
+    SEQ_BITS = 6
+    SEQ_MASK = (1 << SEQ_BITS) - 1
+
+    def __init__(self):
+        self.reset()
+
+    def reset(self):
+        self.sensors = {}
+        self.lostPackets = 0
+
+    def decode(self, data):
+        """Returns (sensor_id, samples), sensor_id is None for packets which are not part of packed stream"""
+        data_len = len(data)
+        if data_len == self.HEADER_LEN:
+            sensor_id = data[0]
+            self.sensors[sensor_id] = decodePackedHeader(data)
+            self.sensors[sensor_id]['seq'] = None
+            self.sensors[sensor_id]['time'] = None
+            self.sensors[sensor_id]['interval'] = None
+            return (sensor_id, [])
+        if data_len != self.DATA_LEN:
+            return (None, [])
+
+        sensor_id = data[0] >> self.SEQ_BITS
+        sensor = self.sensors.get(sensor_id)
+        if sensor is None:
+            return (sensor_id, [])
+        seq = data[0] & self.SEQ_MASK
+        lost = 0
+        if sensor['seq'] is not None:
+            lost = (seq - sensor['seq'] - 1) % (self.SEQ_MASK + 1)
+            self.lostPackets += lost
+        sensor['seq'] = seq
+
+        samples = []
+        missing = lost * self.SAMPLES_PER_PACKET
+        for i in range(self.SAMPLES_PER_PACKET):
+            offset = 1 + i * self.SAMPLE_SIZE
+            raw = unpack('<9hH', str(bytearray(data[offset:offset + self.SAMPLE_SIZE])))
+            time = raw[9]
+            dt = 0.
+            if sensor['time'] is not None:
+                delta = (raw[9] - sensor['time']) & 0xFFFF
+                if missing and sensor['interval']:
+                    delta += 0x10000 * max(0, int(round(((missing + 1) * sensor['interval'] - delta) / 0x10000)))
+                elif delta:
+                    sensor['interval'] = delta
+                time = sensor['time'] + delta
+                dt = delta / 1000000.
+            missing = 0
+            sensor['time'] = time
+            samples.append(scalePackedSample(sensor, raw) + [dt, time / 1000000.])
+        return (sensor_id, samples)
+
+
+def decodePackedHeader(data):
+    """Scales of packed stream header (also sent before black box uploads)"""
+    scales = unpack('<14f', str(bytearray(data[1:1 + 14 * 4])))
+    return {
+        'accelScale': scales[0],
+        'gyroScale': scales[1],
+        'magKernel': [scales[2:5], scales[5:8], scales[8:11]],
+        'magOffset': scales[11:14]}
+
+def scalePackedSample(scales, raw):
+    """[ax, ay, az, gx, gy, gz, hx, hy, hz] of the 9 raw values of a packed sample"""
+    accel = [v * scales['accelScale'] for v in raw[0:3]]
+    gyro = [v * scales['gyroScale'] for v in raw[3:6]]
+    mag = [sum(k * v for k, v in zip(scales['magKernel'][j], raw[6:9])) - scales['magOffset'][j] for j in range(3)]
+    return accel + gyro + mag
+
+def decodeBlackBoxSamples(scales, data, count):
+    """count black box samples from data as [ax, ay, az, gx, gy, gz, hx, hy, hz, dt], dt saturates at 65 ms"""
+    samples = []
+    for i in range(count):
+        offset = i * BlackBoxDecoder.SAMPLE_SIZE
+        raw = unpack('<9hH', str(bytearray(data[offset:offset + BlackBoxDecoder.SAMPLE_SIZE])))
+        samples.append(scalePackedSample(scales, raw) + [raw[9] / 1000000.])
+    return samples
+
+def decodeFloatSample(data):
+    """Float stream (stream format 0) packet data as (values, time_us, sensor_id), values as sent by firmware
+    (14 floats), time_us the sample time in microseconds since the stream started"""
+    values = unpack('<14f', str(bytearray(data[:14 * 4])))
+    time_us = unpack('<I', str(bytearray(data[14 * 4:15 * 4])))[0]
+    return (list(values), time_us, data[15 * 4])
+
+
+class BlackBoxDecoder(object):
+    """Decodes BlackBoxCommand responses. Feed it data of every response: status packets update status, the upload
+    message (status, packed stream header and samples) returns a capture {'sensor_id', 'cause', 'triggerIndex',
+    'samples'}, samples as decoded by decodeBlackBoxSamples"""
+    STATUS_LEN = 3 + 3 * 2
+    SAMPLE_SIZE = 9 * 2 + 2
+    STATES = ['idle', 'armed', 'triggered', 'frozen']
+    CAUSES = ['none', 'accel', 'gyro', 'host']
+
+    def __init__(self):
+        self.status = None
+
+    @staticmethod
+    def decodeStatus(data):
+        sensor_id, state, cause, count, capacity, triggerIndex = unpack('<3B3H', str(bytearray(data[:9])))
+        return {'sensor_id': sensor_id, 'state': BlackBoxDecoder.STATES[state], 'cause': BlackBoxDecoder.CAUSES[cause],
+            'count': count, 'capacity': capacity, 'triggerIndex': triggerIndex}
+
+    def feed(self, data):
+        if len(data) < self.STATUS_LEN:
+            return None
+        self.status = self.decodeStatus(data)
+        if len(data) < self.STATUS_LEN + PackedStreamDecoder.HEADER_LEN:
+            return None
+        scales = decodePackedHeader(data[self.STATUS_LEN:])
+        samples = data[self.STATUS_LEN + PackedStreamDecoder.HEADER_LEN:]
+        return {'sensor_id': self.status['sensor_id'], 'cause': self.status['cause'],
+            'triggerIndex': self.status['triggerIndex'],
+            'samples': decodeBlackBoxSamples(scales, samples, len(samples) // self.SAMPLE_SIZE)}
+
+
+def decodeTimingStats(data):
+    """Decodes TimingStatsCommand response, intervals are in microseconds"""
+    values = unpack('<B10I', str(bytearray(data[:41])))
+    keys = ['sensor_id', 'count', 'missed', 'overflows', 'min', 'max', 'mean', 'p50', 'p90', 'p99', 'windowMax']
+    return dict(zip(keys, values))
+
+
+STAGE_NAMES = ['busRead', 'parse', 'filter', 'send', 'receive', 'loop']
+STAGE_HIST_BINS = 20
+STAGE_HIST_SHIFT = 4
+
+def decodeStageStats(data):
+    """Decodes one StatsCommand response packet. Durations are converted to seconds,
+    histogram bin i counts durations from 2**(i + STAGE_HIST_SHIFT) ticks (first and last bins are open ended),
+    'histEdges' holds lower bin edges in seconds"""
+    values = unpack('<B5I%dH' % STAGE_HIST_BINS, str(bytearray(data[:1 + 5 * 4 + STAGE_HIST_BINS * 2])))
+    stage, ticksPerSecond, count, minTicks, maxTicks, meanTicks = values[:6]
+    tick = 1. / ticksPerSecond
+    return {
+        'stage': STAGE_NAMES[stage] if stage < len(STAGE_NAMES) else stage,
+        'count': count,
+        'min': minTicks * tick,
+        'max': maxTicks * tick,
+        'mean': meanTicks * tick,
+        'hist': list(values[6:]),
+        'histEdges': [(2 ** (i + STAGE_HIST_SHIFT) if i > 0 else 0) * tick for i in range(STAGE_HIST_BINS)]}
+
+
+def decodeLinkStats(data):
+    """Decodes LinkStatsCommand response: packets sent and dropped by the firmware transmit queue,
+    packets queued at the time, queue capacity and most packets queued at once"""
+    values = unpack('<2I3B', str(bytearray(data[:11])))
+    keys = ['sent', 'dropped', 'queued', 'capacity', 'highWater']
+    return dict(zip(keys, values))
+
 
 class TimeCounter(object):
     def __init__(self, avgThre = 100.):